@@ -2,58 +2,326 @@
 #include <string>
 #include <vector>
 #include <cstdlib>
-#include <ctime>
 #include <algorithm>
 #include <random>
 #include <cctype>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <cerrno>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
-string generateSecurePassword(int length = 12) {
-    const string uppercase = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    const string lowercase = "abcdefghijklmnopqrstuvwxyz";
-    const string digits = "0123456789";
-    const string special = "!@#$%^&*()_+-=[]{}|;:,.<>?";
-    
-    string allChars = uppercase + lowercase + digits + special;
-    random_device rd;
-    mt19937 generator(rd());
-    shuffle(allChars.begin(), allChars.end(), generator);
-    
-    string password;
-    for (int i = 0; i < length; ++i) {
-        password += allChars[rand() % allChars.size()];
+const unsigned CLASS_UPPER = 1;
+const unsigned CLASS_LOWER = 2;
+const unsigned CLASS_DIGIT = 4;
+const unsigned CLASS_SPECIAL = 8;
+
+// Таблица вместо isupper/islower/isdigit: не зависит от локали и корректна
+// для байтов UTF-8.
+const array<unsigned char, 256> charClasses = [] {
+    array<unsigned char, 256> classes{};
+    for (int c = 0; c < 256; ++c) {
+        if (c >= 'A' && c <= 'Z') classes[c] = CLASS_UPPER;
+        else if (c >= 'a' && c <= 'z') classes[c] = CLASS_LOWER;
+        else if (c >= '0' && c <= '9') classes[c] = CLASS_DIGIT;
+        else classes[c] = CLASS_SPECIAL;
     }
-    
-    password[0] = uppercase[rand() % uppercase.size()];
-    password[1] = lowercase[rand() % lowercase.size()];
-    password[2] = digits[rand() % digits.size()];
-    password[3] = special[rand() % special.size()];
-    
-    shuffle(password.begin(), password.end(), generator);
-    return password;
+    return classes;
+}();
+
+int strengthScore(size_t length, unsigned classes) {
+    int strength = 0;
+    if (length >= 8) strength += 1;
+    if (length >= 12) strength += 1;
+    strength += (int)bitset<4>(classes).count();
+    return min(strength, 5);
 }
 
 int passwordStrength(const string& password) {
-    int strength = 0;
-    bool hasUpper = false, hasLower = false, hasDigit = false, hasSpecial = false;
-    
-    if (password.length() >= 8) strength += 1;
-    if (password.length() >= 12) strength += 1;
-    
+    unsigned classes = 0;
     for (char c : password) {
-        if (isupper(c)) hasUpper = true;
-        else if (islower(c)) hasLower = true;
-        else if (isdigit(c)) hasDigit = true;
-        else hasSpecial = true;
+        classes |= charClasses[(unsigned char)c];
     }
-    
-    if (hasUpper) strength += 1;
-    if (hasLower) strength += 1;
-    if (hasDigit) strength += 1;
-    if (hasSpecial) strength += 1;
-    
-    return min(strength, 5);
+    return strengthScore(password.length(), classes);
+}
+
+bool systemRandom(void* buffer, size_t size) {
+#if defined(__linux__)
+    char* out = (char*)buffer;
+    while (size > 0) {
+        ssize_t got = getrandom(out, size, 0);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        out += got;
+        size -= (size_t)got;
+    }
+    return true;
+#elif !defined(_WIN32)
+    ifstream urandom("/dev/urandom", ios::binary);
+    return (bool)urandom.read((char*)buffer, size);
+#else
+    random_device device;
+    for (size_t i = 0; i < size; i += 4) {
+        unsigned value = device();
+        memcpy((char*)buffer + i, &value, min<size_t>(4, size - i));
+    }
+    return true;
+#endif
+}
+
+inline uint32_t rotateLeft(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+inline void quarterRound(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d) {
+    a += b; d = rotateLeft(d ^ a, 16);
+    c += d; b = rotateLeft(b ^ c, 12);
+    a += b; d = rotateLeft(d ^ a, 8);
+    c += d; b = rotateLeft(b ^ c, 7);
+}
+
+void chachaBlock(const uint32_t input[16], uint32_t output[16]) {
+    uint32_t x[16];
+    memcpy(x, input, sizeof(x));
+    for (int round = 0; round < 10; ++round) {
+        quarterRound(x[0], x[4], x[8], x[12]);
+        quarterRound(x[1], x[5], x[9], x[13]);
+        quarterRound(x[2], x[6], x[10], x[14]);
+        quarterRound(x[3], x[7], x[11], x[15]);
+        quarterRound(x[0], x[5], x[10], x[15]);
+        quarterRound(x[1], x[6], x[11], x[12]);
+        quarterRound(x[2], x[7], x[8], x[13]);
+        quarterRound(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i) {
+        output[i] = x[i] + input[i];
+    }
+}
+
+#ifdef __SSE2__
+inline __m128i rotateLeft4(__m128i value, int bits) {
+    return _mm_or_si128(_mm_slli_epi32(value, bits), _mm_srli_epi32(value, 32 - bits));
+}
+
+inline void quarterRound4(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+    a = _mm_add_epi32(a, b); d = rotateLeft4(_mm_xor_si128(d, a), 16);
+    c = _mm_add_epi32(c, d); b = rotateLeft4(_mm_xor_si128(b, c), 12);
+    a = _mm_add_epi32(a, b); d = rotateLeft4(_mm_xor_si128(d, a), 8);
+    c = _mm_add_epi32(c, d); b = rotateLeft4(_mm_xor_si128(b, c), 7);
+}
+
+// Четыре блока подряд (счётчики n..n+3), по блоку в каждой дорожке SSE2.
+// Результат транспонируется, так что поток совпадает с chachaBlock.
+void chachaBlocks4(const uint32_t input[16], uint32_t output[64]) {
+    uint64_t counter = input[12] | (uint64_t)input[13] << 32;
+    uint32_t start[64];
+    for (int i = 0; i < 16; ++i) {
+        for (int lane = 0; lane < 4; ++lane) {
+            start[4 * i + lane] = input[i];
+        }
+    }
+    for (int lane = 0; lane < 4; ++lane) {
+        start[48 + lane] = (uint32_t)(counter + lane);
+        start[52 + lane] = (uint32_t)((counter + lane) >> 32);
+    }
+    __m128i x[16];
+    for (int i = 0; i < 16; ++i) {
+        x[i] = _mm_loadu_si128((const __m128i*)(start + 4 * i));
+    }
+    for (int round = 0; round < 10; ++round) {
+        quarterRound4(x[0], x[4], x[8], x[12]);
+        quarterRound4(x[1], x[5], x[9], x[13]);
+        quarterRound4(x[2], x[6], x[10], x[14]);
+        quarterRound4(x[3], x[7], x[11], x[15]);
+        quarterRound4(x[0], x[5], x[10], x[15]);
+        quarterRound4(x[1], x[6], x[11], x[12]);
+        quarterRound4(x[2], x[7], x[8], x[13]);
+        quarterRound4(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i += 4) {
+        __m128i a = _mm_add_epi32(x[i], _mm_loadu_si128((const __m128i*)(start + 4 * i)));
+        __m128i b = _mm_add_epi32(x[i + 1], _mm_loadu_si128((const __m128i*)(start + 4 * i + 4)));
+        __m128i c = _mm_add_epi32(x[i + 2], _mm_loadu_si128((const __m128i*)(start + 4 * i + 8)));
+        __m128i d = _mm_add_epi32(x[i + 3], _mm_loadu_si128((const __m128i*)(start + 4 * i + 12)));
+        __m128i ab0 = _mm_unpacklo_epi32(a, b), ab1 = _mm_unpackhi_epi32(a, b);
+        __m128i cd0 = _mm_unpacklo_epi32(c, d), cd1 = _mm_unpackhi_epi32(c, d);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_unpacklo_epi64(ab0, cd0));
+        _mm_storeu_si128((__m128i*)(output + 16 + i), _mm_unpackhi_epi64(ab0, cd0));
+        _mm_storeu_si128((__m128i*)(output + 32 + i), _mm_unpacklo_epi64(ab1, cd1));
+        _mm_storeu_si128((__m128i*)(output + 48 + i), _mm_unpackhi_epi64(ab1, cd1));
+    }
+}
+#endif
+
+// Поток ChaCha20 с ключом из системного генератора. Блоки вырабатываются
+// пачкой в буфер; у каждого потока выполнения свой экземпляр со своим ключом.
+class ChaCha20Random {
+public:
+    bool seed() {
+        uint32_t key[8];
+        if (!systemRandom(key, sizeof(key))) {
+            return false;
+        }
+        const uint32_t constants[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+        memcpy(state, constants, sizeof(constants));
+        memcpy(state + 4, key, sizeof(key));
+        memset(state + 12, 0, 4 * sizeof(uint32_t));
+        memset(key, 0, sizeof(key));
+        position = BUFFER_HALVES;
+        return true;
+    }
+
+    uint16_t next16() {
+        if (position == BUFFER_HALVES) {
+            refill();
+        }
+        uint16_t half;
+        memcpy(&half, (const char*)buffer + 2 * position++, 2);
+        return half;
+    }
+
+    // Равномерное число в [0, bound), bound <= 65536: умножение со сдвигом и
+    // отбраковка редких смещённых значений (метод Лемира). Деление только на
+    // редкой ветке; пароли и алфавиты короткие, так что 16 бит хватает.
+    uint32_t below(uint32_t bound) {
+        uint32_t product = (uint32_t)next16() * bound;
+        uint16_t low = (uint16_t)product;
+        if (low < bound) {
+            uint32_t threshold = (0x10000 - bound) % bound;
+            while (low < threshold) {
+                product = (uint32_t)next16() * bound;
+                low = (uint16_t)product;
+            }
+        }
+        return product >> 16;
+    }
+
+private:
+    static const size_t BLOCKS = 16;
+    static const size_t BUFFER_HALVES = BLOCKS * 32;
+
+    void refill() {
+#ifdef __SSE2__
+        for (size_t block = 0; block < BLOCKS; block += 4) {
+            chachaBlocks4(state, buffer + block * 16);
+            advance(4);
+        }
+#else
+        for (size_t block = 0; block < BLOCKS; ++block) {
+            chachaBlock(state, buffer + block * 16);
+            advance(1);
+        }
+#endif
+        position = 0;
+    }
+
+    void advance(uint32_t blocks) {
+        uint64_t counter = (state[12] | (uint64_t)state[13] << 32) + blocks;
+        state[12] = (uint32_t)counter;
+        state[13] = (uint32_t)(counter >> 32);
+    }
+
+    uint32_t state[16];
+    uint32_t buffer[BLOCKS * 16];
+    size_t position = BUFFER_HALVES;
+};
+
+const string uppercaseChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+const string lowercaseChars = "abcdefghijklmnopqrstuvwxyz";
+const string digitChars = "0123456789";
+const string specialChars = "!@#$%^&*()_+-=[]{}|;:,.<>?";
+
+// Алфавиты собираются один раз на политику, а не на каждый пароль.
+struct PasswordPolicy {
+    size_t length = 0;
+    vector<string> required;
+    string alphabet;
+
+    PasswordPolicy(size_t length, unsigned classes) : length(length) {
+        const pair<unsigned, const string*> sets[] = { { CLASS_UPPER, &uppercaseChars }, { CLASS_LOWER, &lowercaseChars },
+                                                       { CLASS_DIGIT, &digitChars }, { CLASS_SPECIAL, &specialChars } };
+        for (const auto& set : sets) {
+            if (classes & set.first) {
+                required.push_back(*set.second);
+                alphabet += *set.second;
+            }
+        }
+    }
+
+    bool valid() const {
+        return !alphabet.empty() && length >= required.size();
+    }
+};
+
+// Все символы из общего алфавита, затем по символу из каждого обязательного
+// класса на случайные различные позиции. Распределение то же, что у
+// перемешивания всего пароля, но случайных чисел нужно на length - 1 меньше,
+// и требования выполняются без повторной генерации.
+void appendPassword(const PasswordPolicy& policy, ChaCha20Random& random, string& out) {
+    size_t start = out.size();
+    out.resize(start + policy.length);
+    char* password = &out[start];
+    const char* alphabet = policy.alphabet.data();
+    uint32_t alphabetSize = (uint32_t)policy.alphabet.size();
+    for (size_t i = 0; i < policy.length; ++i) {
+        password[i] = alphabet[random.below(alphabetSize)];
+    }
+    uint32_t taken[4];
+    for (size_t k = 0; k < policy.required.size(); ++k) {
+        uint32_t position;
+        do {
+            position = random.below((uint32_t)policy.length);
+        } while (find(taken, taken + k, position) != taken + k);
+        taken[k] = position;
+        const string& chars = policy.required[k];
+        password[position] = chars[random.below((uint32_t)chars.size())];
+    }
+}
+
+ChaCha20Random& threadRandom() {
+    thread_local ChaCha20Random random;
+    thread_local bool seeded = false;
+    if (!seeded) {
+        if (!random.seed()) {
+            cerr << "Системный генератор случайных чисел недоступен." << endl;
+            exit(1);
+        }
+        seeded = true;
+    }
+    return random;
+}
+
+string generateSecurePassword(int length = 12) {
+    PasswordPolicy policy(length, CLASS_UPPER | CLASS_LOWER | CLASS_DIGIT | CLASS_SPECIAL);
+    string password;
+    appendPassword(policy, threadRandom(), password);
+    return password;
 }
 
 string xorEncryptDecrypt(const string& input, char key) {
@@ -64,6 +332,610 @@ string xorEncryptDecrypt(const string& input, char key) {
     return output;
 }
 
+class MappedFile {
+public:
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped != nullptr) {
+            munmap(mapped, length);
+        }
+#endif
+    }
+
+    bool open(const string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return false;
+        }
+        length = (size_t)info.st_size;
+        if (length > 0) {
+            mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                mapped = nullptr;
+                close(fd);
+                return false;
+            }
+            madvise(mapped, length, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        return true;
+#else
+        ifstream file(path, ios::binary);
+        if (!file) {
+            return false;
+        }
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        length = buffer.size();
+        return true;
+#endif
+    }
+
+    const char* data() const {
+#ifndef _WIN32
+        return (const char*)mapped;
+#else
+        return buffer.data();
+#endif
+    }
+
+    size_t size() const { return length; }
+
+private:
+    size_t length = 0;
+#ifndef _WIN32
+    void* mapped = nullptr;
+#else
+    vector<char> buffer;
+#endif
+};
+
+// Хвост читается перекрывающимися загрузками фиксированной длины, без
+// побайтового цикла: длина уже подмешана в хэш.
+uint64_t hashPassword(const char* data, size_t length) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+    const char* end = data + length;
+    while (end - data > 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+        data += 8;
+    }
+    size_t rest = end - data;
+    uint64_t tail = 0;
+    if (length >= 8) {
+        memcpy(&tail, end - 8, 8);
+    } else if (rest >= 4) {
+        uint32_t first, last;
+        memcpy(&first, data, 4);
+        memcpy(&last, end - 4, 4);
+        tail = first | (uint64_t)last << 32;
+    } else if (rest > 0) {
+        tail = (unsigned char)data[0] | (unsigned char)data[rest / 2] << 8 | (unsigned char)end[-1] << 16;
+    }
+    hash = (hash ^ tail) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 29);
+}
+
+// Блочный фильтр Блума: все 7 бит ключа лежат в одной 64-байтной строке кэша,
+// поэтому проверка стоит одного промаха кэша. 10 бит на ключ дают около 1%
+// ложных срабатываний. Таблица на десятки мегабайт размещается на больших
+// страницах, иначе к промаху кэша добавляется промах TLB.
+class BloomFilter {
+public:
+    explicit BloomFilter(size_t expectedKeys) {
+        blocks = max<size_t>(1, (expectedKeys * 10 + 511) / 512);
+#ifndef _WIN32
+        const size_t hugePage = 2 << 20;
+        mappedSize = blocks * 64 + hugePage;
+        mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping != MAP_FAILED) {
+            words = (uint64_t*)(((uintptr_t)mapping + hugePage - 1) & ~(uintptr_t)(hugePage - 1));
+#ifdef MADV_HUGEPAGE
+            madvise(words, blocks * 64, MADV_HUGEPAGE);
+#endif
+            return;
+        }
+        mapping = nullptr;
+#endif
+        storage.assign(blocks * 8, 0);
+        words = storage.data();
+    }
+
+    ~BloomFilter() {
+#ifndef _WIN32
+        if (mapping != nullptr) {
+            munmap(mapping, mappedSize);
+        }
+#endif
+    }
+
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    void add(uint64_t hash) {
+        uint64_t* block = &words[blockOf(hash) * 8];
+        uint64_t bits = spread(hash);
+        for (int i = 0; i < 7; ++i, bits >>= 9) {
+            block[(bits >> 6) & 7] |= 1ULL << (bits & 63);
+        }
+    }
+
+    bool mayContain(uint64_t hash) const {
+        const uint64_t* block = &words[blockOf(hash) * 8];
+        uint64_t bits = spread(hash);
+        bool found = true;
+        for (int i = 0; i < 7; ++i, bits >>= 9) {
+            found &= (block[(bits >> 6) & 7] >> (bits & 63)) & 1;
+        }
+        return found;
+    }
+
+    void prefetch(uint64_t hash) const {
+#ifdef __SSE2__
+        _mm_prefetch((const char*)&words[blockOf(hash) * 8], _MM_HINT_T0);
+#else
+        (void)hash;
+#endif
+    }
+
+    size_t bytes() const { return blocks * 64; }
+
+private:
+    size_t blockOf(uint64_t hash) const {
+        return (size_t)(((hash >> 32) * blocks) >> 32);
+    }
+
+    static uint64_t spread(uint64_t hash) {
+        hash = (hash ^ (hash >> 33)) * 0xFF51AFD7ED558CCDULL;
+        return hash ^ (hash >> 33);
+    }
+
+    size_t blocks;
+    uint64_t* words;
+    vector<uint64_t> storage;
+#ifndef _WIN32
+    void* mapping;
+    size_t mappedSize;
+#endif
+};
+
+// Оценка, энтропия и прочие показатели зависят только от длины и набора
+// классов символов, поэтому на пароль приходится одно увеличение счётчика,
+// а отчёт строится из гистограммы в конце.
+struct AuditStats {
+    static const size_t LONG = 64;
+
+    uint64_t breached = 0;
+    array<array<uint64_t, 16>, LONG + 1> counts{};
+    array<uint64_t, 16> longLengths{};
+
+    void merge(const AuditStats& other) {
+        breached += other.breached;
+        for (size_t length = 0; length <= LONG; ++length) {
+            for (unsigned classes = 0; classes < 16; ++classes) {
+                counts[length][classes] += other.counts[length][classes];
+            }
+        }
+        for (unsigned classes = 0; classes < 16; ++classes) {
+            longLengths[classes] += other.longLengths[classes];
+        }
+    }
+};
+
+const array<double, 16> poolBits = [] {
+    array<double, 16> bits{};
+    for (unsigned classes = 1; classes < 16; ++classes) {
+        int pool = 0;
+        if (classes & CLASS_UPPER) pool += 26;
+        if (classes & CLASS_LOWER) pool += 26;
+        if (classes & CLASS_DIGIT) pool += 10;
+        if (classes & CLASS_SPECIAL) pool += 33;
+        bits[classes] = log2((double)pool);
+    }
+    return bits;
+}();
+
+// Большой фильтр не помещается в кэш, поэтому проверки копятся пачками:
+// сначала для каждого хэша запрашивается строка фильтра, потом проверяются
+// все сразу, и промахи кэша идут параллельно.
+class BreachCheck {
+public:
+    BreachCheck(const BloomFilter* filter, AuditStats& stats) : filter(filter), stats(stats) {}
+
+    void add(const char* start, size_t length) {
+        uint64_t hash = hashPassword(start, length);
+        filter->prefetch(hash);
+        pending[count++] = hash;
+        if (count == pending.size()) {
+            flush();
+        }
+    }
+
+    void flush() {
+        for (size_t i = 0; i < count; ++i) {
+            stats.breached += filter->mayContain(pending[i]);
+        }
+        count = 0;
+    }
+
+private:
+    const BloomFilter* filter;
+    AuditStats& stats;
+    array<uint64_t, 16> pending;
+    size_t count = 0;
+};
+
+inline void recordPassword(const char* start, size_t length, unsigned classes,
+                           BreachCheck* breached, AuditStats& stats) {
+    if (length > 0 && start[length - 1] == '\r') {
+        --length;
+    }
+    if (length == 0) {
+        return;
+    }
+    if (length < AuditStats::LONG) {
+        stats.counts[length][classes]++;
+    } else {
+        stats.counts[AuditStats::LONG][classes]++;
+        stats.longLengths[classes] += length;
+    }
+    if (breached != nullptr) {
+        breached->add(start, length);
+    }
+}
+
+#ifdef __SSE2__
+struct BlockMasks {
+    uint64_t newline = 0, upper = 0, lower = 0, digit = 0, special = 0;
+};
+
+// Классифицирует 64 байта за раз: по биту на байт для каждого класса.
+inline BlockMasks classifyBlock(const char* p) {
+    const __m128i upperShift = _mm_set1_epi8((char)(128 - 'A'));
+    const __m128i lowerShift = _mm_set1_epi8((char)(128 - 'a'));
+    const __m128i digitShift = _mm_set1_epi8((char)(128 - '0'));
+    const __m128i letterLimit = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i digitLimit = _mm_set1_epi8((char)(-128 + 10));
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+    BlockMasks masks;
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+        __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(v, upperShift), letterLimit);
+        __m128i lower = _mm_cmplt_epi8(_mm_add_epi8(v, lowerShift), letterLimit);
+        __m128i digit = _mm_cmplt_epi8(_mm_add_epi8(v, digitShift), digitLimit);
+        __m128i lineEnd = _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, carriageReturn));
+        __m128i known = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, lineEnd));
+        int shift = 16 * i;
+        masks.newline |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << shift;
+        masks.upper |= (uint64_t)(unsigned)_mm_movemask_epi8(upper) << shift;
+        masks.lower |= (uint64_t)(unsigned)_mm_movemask_epi8(lower) << shift;
+        masks.digit |= (uint64_t)(unsigned)_mm_movemask_epi8(digit) << shift;
+        masks.special |= (uint64_t)(~(unsigned)_mm_movemask_epi8(known) & 0xFFFF) << shift;
+    }
+    return masks;
+}
+
+inline unsigned classesIn(const BlockMasks& masks, uint64_t span) {
+    return ((masks.upper & span) ? CLASS_UPPER : 0u) | ((masks.lower & span) ? CLASS_LOWER : 0u) |
+           ((masks.digit & span) ? CLASS_DIGIT : 0u) | ((masks.special & span) ? CLASS_SPECIAL : 0u);
+}
+#endif
+
+void auditRange(const char* begin, const char* end, const BloomFilter* filter, AuditStats& stats) {
+    BreachCheck check(filter, stats);
+    BreachCheck* breached = filter != nullptr ? &check : nullptr;
+    const char* lineStart = begin;
+    const char* p = begin;
+    unsigned classes = 0;
+#ifdef __SSE2__
+    while (end - p >= 64) {
+        BlockMasks masks = classifyBlock(p);
+        uint64_t newlines = masks.newline;
+        uint64_t pending = ~0ULL;
+        while (newlines != 0) {
+            int at = __builtin_ctzll(newlines);
+            uint64_t upToNewline = (1ULL << at) - 1;
+            classes |= classesIn(masks, pending & upToNewline);
+            recordPassword(lineStart, p + at - lineStart, classes, breached, stats);
+            lineStart = p + at + 1;
+            classes = 0;
+            pending = ~upToNewline << 1;
+            newlines &= newlines - 1;
+        }
+        classes |= classesIn(masks, pending);
+        p += 64;
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == '\n') {
+            recordPassword(lineStart, p - lineStart, classes, breached, stats);
+            lineStart = p + 1;
+            classes = 0;
+        } else if (*p != '\r') {
+            classes |= charClasses[(unsigned char)*p];
+        }
+    }
+    recordPassword(lineStart, end - lineStart, classes, breached, stats);
+    check.flush();
+}
+
+vector<const char*> splitAtLines(const char* data, size_t size, size_t parts) {
+    vector<const char*> bounds = { data };
+    const char* end = data + size;
+    for (size_t i = 1; i < parts; ++i) {
+        const char* cut = max(bounds.back(), data + size / parts * i);
+        const char* newline = (const char*)memchr(cut, '\n', end - cut);
+        bounds.push_back(newline != nullptr ? newline + 1 : end);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+unique_ptr<BloomFilter> loadBreachedList(const string& path) {
+    MappedFile list;
+    if (!list.open(path)) {
+        return nullptr;
+    }
+    const char* p = list.data();
+    const char* end = p + list.size();
+    size_t lines = 0;
+    for (const char* at = p; at < end && (at = (const char*)memchr(at, '\n', end - at)) != nullptr; ++at) {
+        ++lines;
+    }
+    auto filter = make_unique<BloomFilter>(lines + 1);
+    while (p < end) {
+        const char* newline = (const char*)memchr(p, '\n', end - p);
+        const char* lineEnd = newline != nullptr ? newline : end;
+        size_t length = lineEnd - p;
+        if (length > 0 && p[length - 1] == '\r') {
+            --length;
+        }
+        if (length > 0) {
+            filter->add(hashPassword(p, length));
+        }
+        p = lineEnd + 1;
+    }
+    return filter;
+}
+
+string classMixName(unsigned classes) {
+    string name;
+    if (classes & CLASS_UPPER) name += "A-Z ";
+    if (classes & CLASS_LOWER) name += "a-z ";
+    if (classes & CLASS_DIGIT) name += "0-9 ";
+    if (classes & CLASS_SPECIAL) name += "спецсимволы ";
+    return name.empty() ? name : name.substr(0, name.size() - 1);
+}
+
+void printShare(const string& label, uint64_t count, uint64_t total) {
+    cout << "  " << label << ": " << count << " (" << fixed << setprecision(2)
+         << (total > 0 ? 100.0 * count / total : 0.0) << "%)" << endl;
+}
+
+int auditPasswords(const string& path, const string& breachedPath, unsigned threadCount) {
+    unique_ptr<BloomFilter> breached;
+    if (!breachedPath.empty()) {
+        auto buildStart = chrono::steady_clock::now();
+        breached = loadBreachedList(breachedPath);
+        if (!breached) {
+            cerr << "Не удалось открыть список утечек: " << breachedPath << endl;
+            return 1;
+        }
+        double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - buildStart).count();
+        cout << "Фильтр утечек: " << breached->bytes() / 1024 << " КБ, построен за " << buildSeconds << " с" << endl;
+    }
+
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Не удалось открыть файл паролей: " << path << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<const char*> bounds = splitAtLines(file.data(), file.size(), threadCount);
+    vector<AuditStats> partial(threadCount);
+    vector<thread> workers;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        workers.emplace_back([&, i] {
+            AuditStats local;
+            auditRange(bounds[i], bounds[i + 1], breached.get(), local);
+            partial[i] = local;
+        });
+    }
+    AuditStats stats;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        workers[i].join();
+        stats.merge(partial[i]);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t passwords = 0, totalLength = 0;
+    double totalEntropy = 0;
+    array<uint64_t, AuditStats::LONG + 1> lengths{};
+    array<uint64_t, 16> classMixes{};
+    array<uint64_t, 6> strengths{};
+    array<uint64_t, 5> entropyBands{};
+    for (size_t length = 1; length <= AuditStats::LONG; ++length) {
+        for (unsigned classes = 1; classes < 16; ++classes) {
+            uint64_t count = stats.counts[length][classes];
+            if (count == 0) {
+                continue;
+            }
+            uint64_t lengthSum = length < AuditStats::LONG ? count * length : stats.longLengths[classes];
+            double entropy = length * poolBits[classes];
+            passwords += count;
+            totalLength += lengthSum;
+            totalEntropy += lengthSum * poolBits[classes];
+            lengths[length] += count;
+            classMixes[classes] += count;
+            strengths[strengthScore(length, classes)] += count;
+            entropyBands[entropy < 28 ? 0 : entropy < 36 ? 1 : entropy < 60 ? 2 : entropy < 128 ? 3 : 4] += count;
+        }
+    }
+
+    cout << "Проверено паролей: " << passwords << " (" << fixed << setprecision(2)
+         << file.size() / 1e9 << " ГБ за " << seconds << " с, "
+         << (seconds > 0 ? file.size() / 1e9 / seconds : 0.0) << " ГБ/с, "
+         << (seconds > 0 ? passwords / 1e6 / seconds : 0.0) << " млн/с, потоков: " << threadCount << ")" << endl;
+    if (passwords == 0) {
+        return 0;
+    }
+    if (breached) {
+        cout << "Найдено в списке утечек (возможны ~1% ложных срабатываний):" << endl;
+        printShare("совпадений", stats.breached, passwords);
+    }
+    cout << "Средняя длина: " << (double)totalLength / passwords
+         << ", средняя энтропия: " << totalEntropy / passwords << " бит" << endl;
+
+    cout << "Длина:" << endl;
+    for (size_t length = 1; length <= AuditStats::LONG; ++length) {
+        if (lengths[length] > 0) {
+            printShare(length == AuditStats::LONG ? "64+" : to_string(length), lengths[length], passwords);
+        }
+    }
+    cout << "Наборы символов:" << endl;
+    for (unsigned classes = 1; classes < 16; ++classes) {
+        if (classMixes[classes] > 0) {
+            printShare(classMixName(classes), classMixes[classes], passwords);
+        }
+    }
+    cout << "Оценка сложности:" << endl;
+    for (size_t score = 0; score < strengths.size(); ++score) {
+        printShare(to_string(score) + "/5", strengths[score], passwords);
+    }
+    const char* bands[] = { "до 28 бит (очень слабый)", "28-35 бит (слабый)", "36-59 бит (средний)",
+                            "60-127 бит (сильный)", "128+ бит (очень сильный)" };
+    cout << "Энтропия:" << endl;
+    for (size_t band = 0; band < entropyBands.size(); ++band) {
+        printShare(bands[band], entropyBands[band], passwords);
+    }
+    return 0;
+}
+
+// Каждый поток пишет свою долю паролей блоками по мегабайту; порядок блоков
+// в выводе не важен.
+int generatePasswords(uint64_t count, const PasswordPolicy& policy, const string& outputPath, unsigned threadCount) {
+    FILE* output = outputPath.empty() ? stdout : fopen(outputPath.c_str(), "wb");
+    if (output == nullptr) {
+        cerr << "Не удалось открыть файл для записи: " << outputPath << endl;
+        return 1;
+    }
+    const size_t chunkBytes = 1 << 20;
+    mutex outputLock;
+    atomic<bool> failed(false);
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        uint64_t share = count / threadCount + (i < count % threadCount ? 1 : 0);
+        workers.emplace_back([&, share] {
+            ChaCha20Random& random = threadRandom();
+            string chunk;
+            chunk.reserve(chunkBytes + policy.length + 1);
+            for (uint64_t n = 0; n < share && !failed; ++n) {
+                appendPassword(policy, random, chunk);
+                chunk += '\n';
+                if (chunk.size() >= chunkBytes || n + 1 == share) {
+                    lock_guard<mutex> lock(outputLock);
+                    if (fwrite(chunk.data(), 1, chunk.size(), output) != chunk.size()) {
+                        failed = true;
+                    }
+                    chunk.clear();
+                }
+            }
+        });
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    if (fflush(output) != 0) {
+        failed = true;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (output != stdout) {
+        fclose(output);
+    }
+    if (failed) {
+        cerr << "Ошибка записи паролей." << endl;
+        return 1;
+    }
+    cerr << "Сгенерировано паролей: " << count << " за " << fixed << setprecision(2) << seconds << " с ("
+         << (seconds > 0 ? count / 1e6 / seconds : 0.0) << " млн/с, потоков: " << threadCount << ")" << endl;
+    return 0;
+}
+
+void printUsage(const char* program) {
+    cerr << "Использование:" << endl
+         << "  " << program << "                       интерактивное меню" << endl
+         << "  " << program << " --audit файл [--breached список] [--threads N]" << endl
+         << "      проверить пароли из файла (по одному на строку); список утечек -" << endl
+         << "      пароли открытым текстом, по одному на строку" << endl
+         << "  " << program << " --generate N [--length L] [--classes Aa0!] [--output файл] [--threads N]" << endl
+         << "      сгенерировать N паролей (по умолчанию длина 16, все классы символов:" << endl
+         << "      A - заглавные, a - строчные, 0 - цифры, ! - спецсимволы)" << endl;
+}
+
+unsigned parseClasses(const string& letters) {
+    unsigned classes = 0;
+    for (char c : letters) {
+        if (c == 'A') classes |= CLASS_UPPER;
+        else if (c == 'a') classes |= CLASS_LOWER;
+        else if (c == '0') classes |= CLASS_DIGIT;
+        else if (c == '!') classes |= CLASS_SPECIAL;
+        else return 0;
+    }
+    return classes;
+}
+
+int runCommandLine(int argc, char* argv[]) {
+    string auditPath, breachedPath, outputPath;
+    long long generateCount = -1;
+    int length = 16;
+    unsigned classes = CLASS_UPPER | CLASS_LOWER | CLASS_DIGIT | CLASS_SPECIAL;
+    unsigned threadCount = max(1u, thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (option == "--audit" && i + 1 < argc) {
+            auditPath = argv[++i];
+        } else if (option == "--generate" && i + 1 < argc) {
+            generateCount = atoll(argv[++i]);
+        } else if (option == "--length" && i + 1 < argc) {
+            length = atoi(argv[++i]);
+        } else if (option == "--classes" && i + 1 < argc) {
+            classes = parseClasses(argv[++i]);
+        } else if (option == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (option == "--breached" && i + 1 < argc) {
+            breachedPath = argv[++i];
+        } else if (option == "--threads" && i + 1 < argc) {
+            threadCount = (unsigned)max(1, atoi(argv[++i]));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (generateCount >= 0 && auditPath.empty()) {
+        PasswordPolicy policy(length > 0 ? length : 0, classes);
+        if (!policy.valid() || length > 4096) {
+            cerr << "Неверная политика: длина должна быть от числа классов символов до 4096." << endl;
+            return 1;
+        }
+        return generatePasswords((uint64_t)generateCount, policy, outputPath, threadCount);
+    }
+    if (auditPath.empty() || generateCount >= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    return auditPasswords(auditPath, breachedPath, threadCount);
+}
+
 void displayMenu() {
     cout << "\n=== Кибербезопасность - Меню ===" << endl;
     cout << "1. Сгенерировать безопасный пароль" << endl;
@@ -74,8 +946,10 @@ void displayMenu() {
     cout << "Выберите опцию: ";
 }
 
-int main() {
-    srand(time(nullptr));
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        return runCommandLine(argc, argv);
+    }
     
     int choice;
     string input;
@@ -94,6 +968,9 @@ int main() {
                 if (length < 8) {
                     cout << "Пароль слишком короткий. Установлена минимальная длина 8." << endl;
                     length = 8;
+                } else if (length > 4096) {
+                    cout << "Пароль слишком длинный. Установлена максимальная длина 4096." << endl;
+                    length = 4096;
                 }
                 string password = generateSecurePassword(length);
                 cout << "Сгенерированный пароль: " << password << endl;
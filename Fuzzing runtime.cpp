@@ -0,0 +1,390 @@
+// Link this file into a target to let "Fuzzing tool" drive it through a
+// fork server:
+//
+//     g++ -O2 target.cpp "Fuzzing runtime.cpp" -o target
+//
+// A target either keeps its own main(), which reads the input file named on
+// its command line, or defines fuzz_target() and uses the main() below; only
+// the latter can run in persistent mode. Run outside the fuzzer, a target
+// behaves exactly as it would without this file.
+//
+// For coverage feedback, also compile the target's own sources with
+// SanitizerCoverage: -fsanitize-coverage=trace-pc-guard with clang, or
+// -fsanitize-coverage=trace-pc with gcc. Compilers without an attribute to
+// exempt functions from coverage need this file built separately without it.
+//
+// Under the fuzzer, a crashing target reports a hash of its stack, which the
+// fuzzer uses to keep one input per distinct crash. On glibc older than 2.34
+// this needs -ldl for dladdr().
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <new>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Inherited from the fuzzer: commands arrive on the first, and the fork
+// server answers with a child pid and then its wait status on the second.
+const int FORKSERVER_CONTROL_FD = 198;
+const int FORKSERVER_STATUS_FD = 199;
+const uint32_t FORKSERVER_HELLO = 0x46535256;
+const size_t COVERAGE_MAP_SIZE = 1 << 16;
+const int OOM_EXIT_CODE = 79;
+const size_t CRASH_REPORT_SIZE = 4096;
+const uint32_t CRASH_REPORT_MAGIC = 0x46535448;
+
+// Lives in the page after the coverage map in the fuzzer's shared memfd.
+struct CrashReport {
+    uint32_t magic;
+    uint32_t frames;
+    uint64_t stack_hash;
+};
+
+#if defined(__clang__)
+#define NO_COVERAGE __attribute__((no_sanitize("coverage")))
+#elif defined(__has_attribute)
+#if __has_attribute(no_sanitize_coverage)
+#define NO_COVERAGE __attribute__((no_sanitize_coverage))
+#endif
+#endif
+#ifndef NO_COVERAGE
+#define NO_COVERAGE
+#endif
+
+// Edge hit counters. Until the fuzzer's shared map is attached they land in
+// a private scratch map, since instrumented constructors may run first.
+static uint8_t scratch_map[COVERAGE_MAP_SIZE];
+static uint8_t* coverage_map = scratch_map;
+static __thread uintptr_t previous_location;
+static __thread uintptr_t last_location;
+static CrashReport* crash_report = nullptr;
+// Load address of the target's executable, found once at startup so that
+// block ids do not depend on the ASLR layout of a particular process.
+static uintptr_t module_base = 0;
+
+// clang: every instrumented edge gets a guard, numbered here from 1; index
+// 0 is left unused so a zero guard stays a no-op.
+extern "C" NO_COVERAGE void __sanitizer_cov_trace_pc_guard_init(uint32_t* start, uint32_t* stop) {
+    static uint32_t next_guard = 0;
+    if (start == stop || *start != 0) {
+        return;
+    }
+    for (uint32_t* guard = start; guard < stop; ++guard) {
+        *guard = 1 + next_guard++ % (uint32_t)(COVERAGE_MAP_SIZE - 1);
+    }
+}
+
+extern "C" NO_COVERAGE void __sanitizer_cov_trace_pc_guard(uint32_t* guard) {
+    coverage_map[*guard]++;
+    last_location = *guard;
+}
+
+// gcc: only basic blocks are reported, so edges are formed from the
+// previous and current block, hashed by their offsets in the executable.
+extern "C" NO_COVERAGE void __sanitizer_cov_trace_pc() {
+    uintptr_t location = (uintptr_t)__builtin_return_address(0) - module_base;
+    location = (location ^ (location >> 16)) * 0x45D9F3B;
+    location = (location ^ (location >> 16)) & (COVERAGE_MAP_SIZE - 1);
+    coverage_map[location ^ previous_location]++;
+    previous_location = location >> 1;
+    last_location = location;
+}
+
+NO_COVERAGE static void attach_coverage_map() {
+    const char* shared = getenv("FUZZ_COVERAGE_FD");
+    if (shared == nullptr) {
+        return;
+    }
+    void* map = mmap(nullptr, COVERAGE_MAP_SIZE + CRASH_REPORT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, atoi(shared), 0);
+    if (map != MAP_FAILED) {
+        coverage_map = (uint8_t*)map;
+        crash_report = (CrashReport*)(coverage_map + COVERAGE_MAP_SIZE);
+    }
+}
+
+NO_COVERAGE static void find_module_base() {
+    Dl_info self;
+    if (dladdr((void*)&find_module_base, &self) != 0) {
+        module_base = (uintptr_t)self.dli_fbase;
+    }
+}
+
+NO_COVERAGE static uint64_t hash_word(uint64_t hash, uint64_t word) {
+    for (int b = 0; b < 8; ++b) {
+        hash = (hash ^ ((word >> (b * 8)) & 0xFF)) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Hashes the top 3 frames of the crashing stack that lie in the target's
+// own executable, as offsets from its load address so that runs under
+// different ASLR layouts agree. The handler's own frames come first and are
+// dropped, as are frames in libc and sanitizer runtimes, so an abort() or
+// an overflow inside memcpy is keyed by the target code that called it.
+//
+// A smashed stack may leave no usable frame, and unwinding it may even
+// fault, so the last coverage location is reported first as a fallback.
+// Only the first report of a run is kept.
+NO_COVERAGE static void record_crash() {
+    if (crash_report == nullptr || crash_report->magic == CRASH_REPORT_MAGIC) {
+        return;
+    }
+    crash_report->stack_hash = hash_word(0xCBF29CE484222325ull, last_location);
+    crash_report->frames = 0;
+    crash_report->magic = CRASH_REPORT_MAGIC;
+
+    if (module_base == 0) {
+        return;
+    }
+    void* frames[64];
+    int count = backtrace(frames, 64);
+    uint64_t hash = 0xCBF29CE484222325ull;
+    uint32_t used = 0;
+    bool past_handler = false;
+    for (int i = 0; i < count && used < 3; ++i) {
+        Dl_info info;
+        if (dladdr(frames[i], &info) == 0 || (uintptr_t)info.dli_fbase != module_base) {
+            past_handler = true;
+            continue;
+        }
+        if (past_handler) {
+            hash = hash_word(hash, (uintptr_t)frames[i] - module_base);
+            used++;
+        }
+    }
+    if (used > 0) {
+        crash_report->stack_hash = hash;
+        crash_report->frames = used;
+    }
+}
+
+// The default action is restored before the handler runs, so re-raising
+// kills the process with the original signal once the report is written.
+NO_COVERAGE static void crash_signal(int signal) {
+    record_crash();
+    raise(signal);
+}
+
+// Called by AddressSanitizer when it finds an error, before it reports it.
+extern "C" NO_COVERAGE void __asan_on_error() {
+    record_crash();
+}
+
+NO_COVERAGE static void install_crash_handlers() {
+    if (crash_report == nullptr) {
+        return;
+    }
+    // Stack overflows need the handler to run somewhere else.
+    static char alternate_stack[1 << 16];
+    stack_t stack = {};
+    stack.ss_sp = alternate_stack;
+    stack.ss_size = sizeof(alternate_stack);
+    sigaltstack(&stack, nullptr);
+
+    struct sigaction action = {};
+    action.sa_handler = crash_signal;
+    action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    const int signals[] = { SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL };
+    for (int signal : signals) {
+        sigaction(signal, &action, nullptr);
+    }
+    // The first backtrace() loads the unwinder; better here than in a
+    // process whose heap may be corrupt.
+    void* frame;
+    backtrace(&frame, 1);
+}
+
+// Under the fuzzer's memory limit (-m), a failed operator new exits with a
+// code the fuzzer reports as out of memory rather than as a crash.
+NO_COVERAGE static void out_of_memory() {
+    _exit(OOM_EXIT_CODE);
+}
+
+extern "C" __attribute__((weak)) int fuzz_target(const uint8_t* data, size_t size);
+
+NO_COVERAGE static bool read_all(int fd, void* buffer, size_t size) {
+    unsigned char* out = (unsigned char*)buffer;
+    while (size > 0) {
+        ssize_t got = read(fd, out, size);
+        if (got <= 0) {
+            return false;
+        }
+        out += got;
+        size -= (size_t)got;
+    }
+    return true;
+}
+
+// Runs in the target before main(). The process parks here as a fork
+// server, and each command forks a child that returns from this function
+// into main() with the runtime linker and static initialisers already done.
+// A persistent child stops itself after every input instead of exiting; the
+// next command continues it rather than forking a new one.
+__attribute__((constructor)) NO_COVERAGE static void fork_server() {
+    find_module_base();
+    attach_coverage_map();
+    install_crash_handlers();
+    if (getenv("FUZZ_MEMORY_LIMIT") != nullptr) {
+        std::set_new_handler(out_of_memory);
+    }
+    if (getenv("FUZZ_FORKSERVER") == nullptr) {
+        return;
+    }
+    uint32_t hello = FORKSERVER_HELLO;
+    if (write(FORKSERVER_STATUS_FD, &hello, 4) != 4) {
+        return;
+    }
+
+    pid_t child = -1;
+    bool stopped = false;
+    for (;;) {
+        uint32_t command;
+        if (!read_all(FORKSERVER_CONTROL_FD, &command, 4)) {
+            _exit(0);
+        }
+        if (stopped) {
+            kill(child, SIGCONT);
+        }
+        else {
+            child = fork();
+            if (child < 0) {
+                _exit(1);
+            }
+            if (child == 0) {
+                close(FORKSERVER_CONTROL_FD);
+                close(FORKSERVER_STATUS_FD);
+                previous_location = 0;
+                last_location = 0;
+                return;
+            }
+        }
+        int32_t reported = child;
+        if (write(FORKSERVER_STATUS_FD, &reported, 4) != 4) {
+            _exit(1);
+        }
+        int status;
+        if (waitpid(child, &status, WUNTRACED) < 0) {
+            _exit(1);
+        }
+        stopped = WIFSTOPPED(status);
+        if (write(FORKSERVER_STATUS_FD, &status, 4) != 4) {
+            _exit(1);
+        }
+    }
+}
+
+// The harness gets each input in its own exact-size heap block, so reads
+// past the end stay detectable. Plain C buffers keep library templates,
+// which would be instrumented along with the target, out of the runtime.
+struct Input {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+NO_COVERAGE static bool set_input(Input& input, const uint8_t* data, size_t size) {
+    free(input.data);
+    input.data = (uint8_t*)malloc(size > 0 ? size : 1);
+    input.size = size;
+    if (input.data == nullptr) {
+        return false;
+    }
+    memcpy(input.data, data, size);
+    return true;
+}
+
+// With FUZZ_INPUT_FD the fuzzer shares the input as a memfd whose size is
+// the input length; it is mapped once and copied out per run.
+NO_COVERAGE static bool read_shared_input(int fd, Input& input) {
+    static const unsigned char* map = nullptr;
+    static size_t mapped = 0;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    if (size > mapped) {
+        if (map != nullptr) {
+            munmap((void*)map, mapped);
+        }
+        void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            map = nullptr;
+            mapped = 0;
+            return false;
+        }
+        map = (const unsigned char*)address;
+        mapped = size;
+    }
+    return set_input(input, map, size);
+}
+
+NO_COVERAGE static bool read_input(const char* path, Input& input) {
+    const char* shared = getenv("FUZZ_INPUT_FD");
+    if (shared != nullptr) {
+        return read_shared_input(atoi(shared), input);
+    }
+    FILE* file = path != nullptr ? fopen(path, "rb") : stdin;
+    if (file == nullptr) {
+        return false;
+    }
+    static uint8_t* buffer = nullptr;
+    static size_t capacity = 0;
+    size_t size = 0;
+    for (;;) {
+        if (size == capacity) {
+            capacity = capacity == 0 ? 65536 : capacity * 2;
+            buffer = (uint8_t*)realloc(buffer, capacity);
+            if (buffer == nullptr) {
+                return false;
+            }
+        }
+        size_t got = fread(buffer + size, 1, capacity - size, file);
+        if (got == 0) {
+            break;
+        }
+        size += got;
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    else {
+        // Persistent runs read stdin again from the start.
+        clearerr(stdin);
+        rewind(stdin);
+    }
+    return set_input(input, buffer, size);
+}
+
+// Used only when the target has no main() of its own. FUZZ_PERSISTENT=N
+// runs N inputs in one process, stopping between them for the fork server.
+// The input comes from the fuzzer's shared memory, the file named on the
+// command line, or stdin.
+__attribute__((weak)) NO_COVERAGE int main(int argc, char* argv[]) {
+    if (fuzz_target == nullptr) {
+        fprintf(stderr, "Target defines neither main() nor fuzz_target()\n");
+        return 1;
+    }
+    const char* path = argc > 1 ? argv[1] : nullptr;
+    const char* persistent = getenv("FUZZ_PERSISTENT");
+    long iterations = persistent != nullptr && getenv("FUZZ_FORKSERVER") != nullptr ? atol(persistent) : 1;
+    Input input;
+    for (long i = 0;;) {
+        if (!read_input(path, input)) {
+            perror(path != nullptr ? path : "input");
+            return 1;
+        }
+        fuzz_target(input.data, input.size);
+        if (++i >= iterations) {
+            return 0;
+        }
+        raise(SIGSTOP);
+        previous_location = 0;
+    }
+}
@@ -0,0 +1,54 @@
+// A small target for trying out "Fuzzing tool":
+//
+//     g++ -O2 -fsanitize-coverage=trace-pc "Fuzzing sample target.cpp" "Fuzzing runtime.cpp" -o sample_target
+//     "./Fuzzing tool" ./sample_target seeds 100000
+//
+// It parses a toy record format and crashes on a few inputs a fuzzer can
+// reach by mutation. Magic bytes are compared one at a time so that
+// coverage feedback sees each one matched.
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+
+static int parse_record(const uint8_t* data, size_t size) {
+    if (size < 4 || data[0] != 'R' || data[1] != 'E' || data[2] != 'C') {
+        return 0;
+    }
+    uint8_t fields = data[3];
+    size_t offset = 4;
+    int sum = 0;
+    for (uint8_t i = 0; i < fields; ++i) {
+        if (offset >= size) {
+            return -1;
+        }
+        uint8_t length = data[offset++];
+        if (length > 200) {
+            // Unchecked length: a long field overruns both the input and `copy`.
+            char copy[16];
+            volatile size_t copy_length = length;
+            memcpy(copy, data + offset, copy_length);
+            sum += copy[fields % 16];
+        }
+        offset += length;
+        sum += length;
+    }
+    if (fields == 0 && size > 4 && data[4] == '!') {
+        abort();
+    }
+    return sum;
+}
+
+extern "C" int fuzz_target(const uint8_t* data, size_t size) {
+    if (size >= 4 && data[0] == 'F') {
+        if (data[1] == 'U') {
+            if (data[2] == 'Z') {
+                if (data[3] == 'Z') {
+                    volatile int* null_pointer = nullptr;
+                    *null_pointer = 1;
+                }
+            }
+        }
+    }
+    return parse_record(data, size);
+}
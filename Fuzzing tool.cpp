@@ -7,167 +7,1986 @@
 #include <cstdlib>
 #include <chrono>
 #include <csignal>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <cctype>
+#include <sstream>
+#include <filesystem>
+#include <atomic>
+#include <new>
+#include <iterator>
+#include <unordered_set>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 int total_tests = 0;
 int crashes = 0;
+int hangs = 0;
+int nonzero_exits = 0;
+int out_of_memory = 0;
 std::vector<std::string> seed_corpus;
 
-void signal_handler(int signal) {
-    std::cerr << "\nCrash detected! Signal: " << signal << std::endl;
-    crashes++;
+// With -o, and always in parallel mode, each instance keeps its queue and
+// crashes under <output_dir>/worker_<id>, where the others can sync them.
+std::string output_dir;
+int worker_id = 0;
+int worker_count = 1;
+bool quiet = false;
+
+// xorshift64*: one multiply per number, plenty for picking mutations.
+struct Rng {
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    // In [0, n), by multiply and shift rather than a modulo.
+    uint32_t below(uint32_t n) {
+        return (uint32_t)(((next() >> 32) * n) >> 32);
+    }
+};
+
+const int8_t INTERESTING_8[] = { -128, -1, 0, 1, 16, 32, 64, 100, 127 };
+const int16_t INTERESTING_16[] = { -32768, -129, 128, 255, 256, 512, 1000, 1024, 4096, 32767 };
+const int32_t INTERESTING_32[] = { INT32_MIN, -100663046, -32769, 32768, 65535, 65536, 100663045, INT32_MAX };
+const int ARITH_MAX = 35;
+const size_t MAX_BLOCK = 1500;
+
+// AFL-style havoc over one preallocated buffer: each test case starts as a
+// copy of a queue entry and gets a stack of 2-16 random operators applied
+// in place, so mutating never allocates.
+class Mutator {
+public:
+    explicit Mutator(size_t max_size) : buffer(max_size) {}
+
+    void seed(uint64_t value) {
+        rng.state = value | 1;
+    }
+
+    // AFL dictionary format: one token per line as name="value" or just
+    // "value", with \\, \" and \xNN escapes; # starts a comment.
+    bool load_dictionary(const std::string& path, std::string& error) {
+        std::ifstream file(path);
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+        std::string line;
+        int number = 0;
+        while (std::getline(file, line)) {
+            number++;
+            size_t open = line.find_first_not_of(" \t\r");
+            if (open == std::string::npos || line[open] == '#') {
+                continue;
+            }
+            open = line.find('"');
+            size_t close = line.rfind('"');
+            std::string token;
+            if (open == std::string::npos || close <= open || !unescape(line.substr(open + 1, close - open - 1), token)) {
+                error = path + ":" + std::to_string(number) + ": expected name=\"value\"";
+                return false;
+            }
+            if (!token.empty() && token.size() <= 128) {
+                dictionary.push_back(token);
+            }
+        }
+        return true;
+    }
+
+    size_t dictionary_size() const {
+        return dictionary.size();
+    }
+
+    void load(const std::string& input) {
+        length = std::min(input.size(), buffer.size());
+        memcpy(buffer.data(), input.data(), length);
+    }
+
+    void randomize(size_t max_length) {
+        length = 1 + rng.below((uint32_t)std::min(max_length, buffer.size()));
+        for (size_t i = 0; i < length; i += 8) {
+            uint64_t bytes = rng.next();
+            memcpy(&buffer[i], &bytes, std::min<size_t>(8, length - i));
+        }
+    }
+
+    // `splice_source`, when given, is another queue entry that chunks may
+    // be copied from. Returns the number of operators applied.
+    int havoc(const std::string* splice_source) {
+        // Operators 0-10 always apply; splicing and tokens only when there
+        // is something to take them from.
+        uint32_t ops[14];
+        uint32_t op_count = 0;
+        for (uint32_t op = 0; op < 14; ++op) {
+            if ((op != 11 || splice_source != nullptr) && (op < 12 || !dictionary.empty())) {
+                ops[op_count++] = op;
+            }
+        }
+        int stack = 2 << rng.below(4);
+        int applied = 0;
+        for (int attempt = 0; applied < stack && attempt < stack * 4; ++attempt) {
+            applied += apply(ops[rng.below(op_count)], splice_source);
+        }
+        return applied;
+    }
+
+    const char* data() const {
+        return (const char*)buffer.data();
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    static bool unescape(const std::string& text, std::string& out) {
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] != '\\') {
+                out.push_back(text[i]);
+            }
+            else if (i + 1 < text.size() && (text[i + 1] == '\\' || text[i + 1] == '"')) {
+                out.push_back(text[++i]);
+            }
+            else if (i + 3 < text.size() && text[i + 1] == 'x' && isxdigit((unsigned char)text[i + 2]) && isxdigit((unsigned char)text[i + 3])) {
+                out.push_back((char)std::stoi(text.substr(i + 2, 2), nullptr, 16));
+                i += 3;
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static uint16_t swap16(uint16_t value) {
+        return (uint16_t)(value << 8 | value >> 8);
+    }
+
+    static uint32_t swap32(uint32_t value) {
+        return value << 24 | (value & 0xFF00) << 8 | (value >> 8 & 0xFF00) | value >> 24;
+    }
+
+    // Mostly short blocks, now and then a long one, never past `limit`.
+    size_t block_length(size_t limit) {
+        uint32_t roll = rng.below(10);
+        size_t cap = roll < 7 ? 32 : roll < 9 ? 128 : MAX_BLOCK;
+        return 1 + rng.below((uint32_t)std::min(cap, limit));
+    }
+
+    // A nonzero value in [-ARITH_MAX, ARITH_MAX].
+    int32_t arith_delta() {
+        int32_t delta = 1 + (int32_t)rng.below(ARITH_MAX);
+        return rng.next() & 1 ? -delta : delta;
+    }
+
+    template <typename T>
+    T load_at(size_t offset) const {
+        T value;
+        memcpy(&value, &buffer[offset], sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void store_at(size_t offset, T value) {
+        memcpy(&buffer[offset], &value, sizeof(T));
+    }
+
+    // Opens a gap of `count` bytes at `offset`; false if the buffer is full.
+    bool make_gap(size_t offset, size_t count) {
+        if (length + count > buffer.size()) {
+            return false;
+        }
+        memmove(&buffer[offset + count], &buffer[offset], length - offset);
+        length += count;
+        return true;
+    }
+
+    bool apply(uint32_t op, const std::string* splice_source) {
+        uint8_t* data = buffer.data();
+        switch (op) {
+        case 0:
+            if (length == 0) return false;
+            {
+                uint32_t bit = rng.below((uint32_t)length * 8);
+                data[bit >> 3] ^= (uint8_t)(0x80 >> (bit & 7));
+            }
+            return true;
+        case 1:
+            if (length == 0) return false;
+            data[rng.below((uint32_t)length)] = (uint8_t)INTERESTING_8[rng.below(sizeof(INTERESTING_8))];
+            return true;
+        case 2:
+            if (length < 2) return false;
+            {
+                uint16_t value = (uint16_t)INTERESTING_16[rng.below(sizeof(INTERESTING_16) / 2)];
+                store_at<uint16_t>(rng.below((uint32_t)length - 1), rng.next() & 1 ? swap16(value) : value);
+            }
+            return true;
+        case 3:
+            if (length < 4) return false;
+            {
+                uint32_t value = (uint32_t)INTERESTING_32[rng.below(sizeof(INTERESTING_32) / 4)];
+                store_at<uint32_t>(rng.below((uint32_t)length - 3), rng.next() & 1 ? swap32(value) : value);
+            }
+            return true;
+        case 4:
+            if (length == 0) return false;
+            data[rng.below((uint32_t)length)] += (uint8_t)arith_delta();
+            return true;
+        case 5:
+            if (length < 2) return false;
+            {
+                size_t offset = rng.below((uint32_t)length - 1);
+                uint16_t value = load_at<uint16_t>(offset);
+                int32_t delta = arith_delta();
+                bool swapped = rng.next() & 1;
+                value = swapped ? swap16((uint16_t)(swap16(value) + delta)) : (uint16_t)(value + delta);
+                store_at<uint16_t>(offset, value);
+            }
+            return true;
+        case 6:
+            if (length < 4) return false;
+            {
+                size_t offset = rng.below((uint32_t)length - 3);
+                uint32_t value = load_at<uint32_t>(offset);
+                int32_t delta = arith_delta();
+                bool swapped = rng.next() & 1;
+                value = swapped ? swap32(swap32(value) + (uint32_t)delta) : value + (uint32_t)delta;
+                store_at<uint32_t>(offset, value);
+            }
+            return true;
+        case 7:
+            // XOR with a nonzero value so the byte always changes.
+            if (length == 0) return false;
+            data[rng.below((uint32_t)length)] ^= (uint8_t)(1 + rng.below(255));
+            return true;
+        case 8:
+            if (length < 2) return false;
+            {
+                size_t count = block_length(length - 1);
+                size_t offset = rng.below((uint32_t)(length - count + 1));
+                memmove(&data[offset], &data[offset + count], length - offset - count);
+                length -= count;
+            }
+            return true;
+        case 9: {
+            // Insert a copy of a block of the input, or a run of one byte.
+            bool clone = length > 0 && rng.below(4) != 0;
+            size_t count = block_length(clone ? length : 128);
+            if (clone) {
+                memcpy(scratch, &data[rng.below((uint32_t)(length - count + 1))], count);
+            }
+            else {
+                memset(scratch, length > 0 && (rng.next() & 1) ? data[rng.below((uint32_t)length)] : (int)rng.below(256), count);
+            }
+            size_t offset = rng.below((uint32_t)length + 1);
+            if (!make_gap(offset, count)) return false;
+            memcpy(&data[offset], scratch, count);
+            return true;
+        }
+        case 10:
+            if (length < 2) return false;
+            {
+                size_t count = block_length(length - 1);
+                size_t from = rng.below((uint32_t)(length - count + 1));
+                size_t to = rng.below((uint32_t)(length - count + 1));
+                if (rng.below(4) != 0) {
+                    memmove(&data[to], &data[from], count);
+                }
+                else {
+                    memset(&data[to], (int)rng.below(256), count);
+                }
+            }
+            return true;
+        case 11:
+            // Splice: overwrite the tail from a random point with the other
+            // entry's tail, or insert a chunk of it.
+            if (splice_source == nullptr || splice_source->empty()) return false;
+            {
+                const std::string& other = *splice_source;
+                size_t count = block_length(other.size());
+                size_t from = rng.below((uint32_t)(other.size() - count + 1));
+                size_t to = rng.below((uint32_t)length + 1);
+                if (rng.next() & 1) {
+                    if (!make_gap(to, count)) return false;
+                }
+                else if (to + count > length) {
+                    if (to + count > buffer.size()) return false;
+                    length = to + count;
+                }
+                memcpy(&data[to], other.data() + from, count);
+            }
+            return true;
+        case 12:
+        case 13:
+            if (dictionary.empty()) return false;
+            {
+                const std::string& token = dictionary[rng.below((uint32_t)dictionary.size())];
+                if (op == 12) {
+                    if (token.size() > length) return false;
+                    memcpy(&data[rng.below((uint32_t)(length - token.size() + 1))], token.data(), token.size());
+                }
+                else {
+                    size_t offset = rng.below((uint32_t)length + 1);
+                    if (!make_gap(offset, token.size())) return false;
+                    memcpy(&data[offset], token.data(), token.size());
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<uint8_t> buffer;
+    size_t length = 0;
+    std::vector<std::string> dictionary;
+    Rng rng;
+    uint8_t scratch[MAX_BLOCK];
+};
+
+const size_t MAX_INPUT_SIZE = 1 << 20;
+Mutator mutator(MAX_INPUT_SIZE);
+
+// Times havoc on a typical small input, restoring it before each round as
+// the fuzzing loop does.
+int benchmark_mutator(long rounds) {
+    std::string input = "GET /index.html HTTP/1.1\r\nHost: example.com\r\nContent-Length: 42\r\n\r\n";
+    std::string other = "POST /form HTTP/1.0\r\nCookie: a=b\r\n\r\nname=value&x=1";
+    mutator.seed(1);
+    long operators = 0;
+    size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; ++i) {
+        mutator.load(input);
+        operators += mutator.havoc((i & 3) == 0 ? &other : nullptr);
+        checksum += mutator.size() + (unsigned char)mutator.data()[0];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << rounds << " havoc rounds, " << operators << " operators in " << seconds << " s" << std::endl;
+    std::cout << "Rounds per second: " << rounds / seconds << std::endl;
+    std::cout << "Operators per second: " << operators / seconds << std::endl;
+    std::cout << "(checksum " << checksum << ")" << std::endl;
+    return 0;
 }
 
-std::string generate_random_data(size_t max_length) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<int> dist(0, 255);
+// What became of one run. A hang is a run the executor killed at the
+// timeout; a SIGKILL it did not send is taken as the kernel's OOM killer.
+enum class ExecOutcome {
+    Ok,
+    Crash,
+    Hang,
+    Exit,
+    Oom,
+    Error,
+};
 
-    std::uniform_int_distribution<size_t> len_dist(1, max_length);
-    size_t length = len_dist(gen);
-    std::string data;
-    data.reserve(length);
+// `code` is the signal for a crash and the exit code for a nonzero exit.
+struct ExecResult {
+    ExecOutcome outcome = ExecOutcome::Error;
+    int code = 0;
+};
+
+#ifndef _WIN32
+// Must match "Fuzzing runtime.cpp".
+const int FORKSERVER_CONTROL_FD = 198;
+const int FORKSERVER_STATUS_FD = 199;
+const int INPUT_FD = 197;
+const int COVERAGE_FD = 196;
+const int OOM_EXIT_CODE = 79;
+const size_t COVERAGE_MAP_SIZE = 1 << 16;
+const size_t CRASH_REPORT_SIZE = 4096;
+const uint32_t CRASH_REPORT_MAGIC = 0x46535448;
+
+// Follows the coverage map in the same memfd.
+struct CrashReport {
+    uint32_t magic;
+    uint32_t frames;
+    uint64_t stack_hash;
+};
+const uint32_t FORKSERVER_HELLO = 0x46535256;
+
+enum class InputMode {
+    Shared,
+    Stdin,
+    File,
+};
+
+// Carries each test case to the target without creating or unlinking a
+// file per exec. The default is an anonymous memfd mapped into the fuzzer
+// and inherited by the target as fd 197: targets linked with the runtime
+// read it through their own mapping, others open /dev/fd/197. Stdin mode
+// hands the same descriptor over as standard input, rewound before each
+// run. File mode keeps one file per fuzzer instance open and rewrites it
+// in place. Without memfd, the other modes fall back to that file.
+class InputChannel {
+public:
+    ~InputChannel() {
+        if (map != nullptr) {
+            munmap(map, capacity);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!path.empty()) {
+            unlink(path.c_str());
+        }
+    }
+
+    bool open(InputMode requested, size_t max_size) {
+        mode = requested;
+        capacity = max_size;
+#ifdef __linux__
+        if (mode != InputMode::File) {
+            fd = memfd_create("fuzz_input", MFD_CLOEXEC);
+            if (fd >= 0 && ftruncate(fd, (off_t)capacity) == 0) {
+                void* mapped = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    map = (char*)mapped;
+                    return true;
+                }
+            }
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+#endif
+        if (mode == InputMode::Shared) {
+            mode = InputMode::File;
+        }
+        path = ".fuzz_input." + std::to_string(getpid());
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        return fd >= 0;
+    }
+
+    bool write(const char* data, size_t size) {
+        size = std::min(size, capacity);
+        if (map != nullptr) {
+            if (ftruncate(fd, (off_t)size) != 0) {
+                return false;
+            }
+            memcpy(map, data, size);
+        }
+        else if (ftruncate(fd, (off_t)size) != 0 || pwrite(fd, data, size, 0) != (ssize_t)size) {
+            return false;
+        }
+        return mode != InputMode::Stdin || lseek(fd, 0, SEEK_SET) == 0;
+    }
+
+    // What the target is told to read; empty when it reads stdin.
+    std::string target_path() const {
+        if (mode == InputMode::Stdin) {
+            return "";
+        }
+        return map != nullptr ? "/dev/fd/" + std::to_string(INPUT_FD) : path;
+    }
+
+    int descriptor() const {
+        return fd;
+    }
+
+    InputMode input_mode() const {
+        return mode;
+    }
+
+    bool shared() const {
+        return map != nullptr;
+    }
+
+private:
+    InputMode mode = InputMode::Shared;
+    int fd = -1;
+    char* map = nullptr;
+    size_t capacity = 0;
+    std::string path;
+};
+
+// Edge hit counters shared with the target through a memfd it inherits as
+// fd 196. After each run the raw counts are bucketed (1, 2, 3, 4-7, 8-15,
+// 16-31, 32-127, 128+ hits, one bit each) and compared with the virgin map,
+// which keeps a bit set for every bucket not yet seen on that edge. Both
+// passes go a 64-bit word at a time, and whole 64-byte blocks that stayed
+// zero, which is most of the map for a typical run, are skipped.
+class CoverageMap {
+public:
+    ~CoverageMap() {
+        if (map != nullptr) {
+            munmap(map, COVERAGE_MAP_SIZE + CRASH_REPORT_SIZE);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool open() {
+#ifdef __linux__
+        fd = memfd_create("fuzz_coverage", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, COVERAGE_MAP_SIZE + CRASH_REPORT_SIZE) != 0) {
+            return false;
+        }
+        void* mapped = mmap(nullptr, COVERAGE_MAP_SIZE + CRASH_REPORT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        map = (uint8_t*)mapped;
+        virgin.assign(COVERAGE_MAP_SIZE / 8, ~0ull);
+        for (uint32_t pair = 0; pair < 65536; ++pair) {
+            bucket_pairs[pair] = (uint16_t)(bucket(pair & 0xFF) | bucket(pair >> 8) << 8);
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Returns 2 if the run hit an edge never seen before, 1 if it only hit
+    // a known edge a new number of times, else 0. `edges` gets the number
+    // of edges the run hit. Counters are cleared as they are read, so the
+    // map is ready for the next run without a separate reset. `path_hash`
+    // is left identifying the set of edges and hit-count buckets.
+    int check(uint32_t& edges) {
+        uint64_t* words = (uint64_t*)map;
+        int result = 0;
+        edges = 0;
+        path_hash = 0;
+        for (size_t block = 0; block < COVERAGE_MAP_SIZE / 8; block += 8) {
+            if (block_is_zero(words + block)) {
+                continue;
+            }
+            for (size_t i = block; i < block + 8; ++i) {
+                uint64_t word = words[i];
+                if (word == 0) {
+                    continue;
+                }
+                uint16_t pairs[4];
+                memcpy(pairs, &word, 8);
+                for (uint16_t& pair : pairs) {
+                    pair = bucket_pairs[pair];
+                }
+                memcpy(&word, pairs, 8);
+                words[i] = 0;
+                path_hash = (path_hash ^ word ^ i) * 0x9E3779B97F4A7C15ull;
+                for (uint64_t bytes = word; bytes != 0; bytes >>= 8) {
+                    edges += (bytes & 0xFF) != 0;
+                }
+
+                uint64_t fresh = word & virgin[i];
+                if (fresh != 0) {
+                    if (result < 2) {
+                        // A byte still all-virgin means the edge itself is new.
+                        for (int b = 0; b < 8; ++b) {
+                            if (((word >> (b * 8)) & 0xFF) && ((virgin[i] >> (b * 8)) & 0xFF) == 0xFF) {
+                                result = 2;
+                                break;
+                            }
+                        }
+                        result = std::max(result, 1);
+                    }
+                    virgin[i] &= ~word;
+                }
+            }
+        }
+        if (result == 2) {
+            covered = 0;
+            for (uint64_t word : virgin) {
+                for (int b = 0; b < 8; ++b) {
+                    covered += ((word >> (b * 8)) & 0xFF) != 0xFF;
+                }
+            }
+        }
+        return result;
+    }
+
+    // The stack hash a crashing run left behind, if any. Clears the report
+    // for the next run.
+    bool take_stack_hash(uint64_t& hash) {
+        CrashReport* report = (CrashReport*)(map + COVERAGE_MAP_SIZE);
+        bool reported = report->magic == CRASH_REPORT_MAGIC;
+        hash = report->stack_hash;
+        memset(report, 0, sizeof(CrashReport));
+        return reported;
+    }
+
+    int descriptor() const {
+        return fd;
+    }
+
+    size_t covered = 0;
+    uint64_t path_hash = 0;
+
+private:
+    // 64 bytes of the map; SSE2 keeps this scan close to memset speed,
+    // where a chain of 64-bit ORs was several times slower.
+    static bool block_is_zero(const uint64_t* block) {
+#ifdef __SSE2__
+        const __m128i* lanes = (const __m128i*)block;
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_load_si128(lanes), _mm_load_si128(lanes + 1)),
+            _mm_or_si128(_mm_load_si128(lanes + 2), _mm_load_si128(lanes + 3)));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xFFFF;
+#else
+        uint64_t any = 0;
+        for (int i = 0; i < 8; ++i) {
+            any |= block[i];
+        }
+        return any == 0;
+#endif
+    }
+
+    static uint8_t bucket(uint32_t hits) {
+        if (hits == 0) return 0;
+        if (hits <= 3) return (uint8_t)(1 << (hits - 1));
+        if (hits <= 7) return 8;
+        if (hits <= 15) return 16;
+        if (hits <= 31) return 32;
+        if (hits <= 127) return 64;
+        return 128;
+    }
+
+    int fd = -1;
+    uint8_t* map = nullptr;
+    std::vector<uint64_t> virgin;
+    uint16_t bucket_pairs[65536];
+};
+
+// Runs the target on one input file. A target linked with the fuzzing
+// runtime is exec'd once and parks at a handshake; every run after that is
+// a fork of that process, or in persistent mode a continue of a child that
+// stopped after its previous input. Other targets get a plain fork and
+// exec per run, which still skips the shell that system() would start.
+//
+// Each run has one deadline, a timerfd armed when it starts, that every
+// wait of the run polls alongside the descriptor it waits on: the fork
+// server's status pipe, or a pidfd for an exec'd child.
+class Executor {
+public:
+    ~Executor() {
+        stop_fork_server();
+        if (timer_fd >= 0) {
+            close(timer_fd);
+        }
+    }
+
+    void start(const std::string& target_program, const InputChannel& input, int coverage_fd,
+        bool use_fork_server, int persistent_iterations, int timeout_ms, int memory_limit_mb) {
+        std::istringstream words(target_program);
+        std::string word;
+        while (words >> word) {
+            args.push_back(word);
+        }
+        if (!input.target_path().empty()) {
+            args.push_back(input.target_path());
+        }
+        input_fd = input.descriptor();
+        input_on_stdin = input.input_mode() == InputMode::Stdin;
+        input_shared = input.shared();
+        this->coverage_fd = coverage_fd;
+        this->timeout_ms = timeout_ms;
+        this->persistent_iterations = persistent_iterations;
+        this->memory_limit_mb = memory_limit_mb;
+#ifdef __linux__
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+#endif
+        if (use_fork_server && start_fork_server()) {
+            if (!quiet) {
+                std::cout << "Fork server up" << (persistent_iterations > 1 ? ", persistent mode" : "") << std::endl;
+            }
+        }
+    }
+
+    // A persistent child that finished its input and stopped counts as a
+    // clean exit.
+    ExecResult run() {
+        timed_out = false;
+        arm_deadline();
+        if (server_pid > 0) {
+            int status = run_fork_server();
+            if (status != -1) {
+                return classify(status);
+            }
+            std::cerr << "Fork server died; falling back to fork and exec" << std::endl;
+            stop_fork_server();
+            timed_out = false;
+            arm_deadline();
+        }
+        pid_t child = fork();
+        if (child == 0) {
+            exec_target();
+        }
+        if (child < 0) {
+            return ExecResult();
+        }
+        return classify(wait_for_child(child));
+    }
+
+    bool fork_server_active() const {
+        return server_pid > 0;
+    }
+
+private:
+    ExecResult classify(int status) const {
+        ExecResult result;
+        if (timed_out) {
+            result.outcome = ExecOutcome::Hang;
+        }
+        else if (WIFSIGNALED(status)) {
+            result.code = WTERMSIG(status);
+            result.outcome = result.code == SIGKILL ? ExecOutcome::Oom : ExecOutcome::Crash;
+        }
+        else if (WIFEXITED(status)) {
+            result.code = WEXITSTATUS(status);
+            result.outcome = result.code == 0 ? ExecOutcome::Ok
+                : result.code == OOM_EXIT_CODE && memory_limit_mb > 0 ? ExecOutcome::Oom
+                : ExecOutcome::Exit;
+        }
+        return result;
+    }
+
+    [[noreturn]] void exec_target() {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        dup2(input_fd, input_on_stdin ? STDIN_FILENO : INPUT_FD);
+        if (input_shared && !input_on_stdin) {
+            setenv("FUZZ_INPUT_FD", std::to_string(INPUT_FD).c_str(), 1);
+        }
+        if (coverage_fd >= 0) {
+            dup2(coverage_fd, COVERAGE_FD);
+            setenv("FUZZ_COVERAGE_FD", std::to_string(COVERAGE_FD).c_str(), 1);
+        }
+        // Sanitizer errors should look like crashes, and leak checking at
+        // exit would slow every run down.
+        setenv("ASAN_OPTIONS", "abort_on_error=1:detect_leaks=0:symbolize=0", 0);
+        if (memory_limit_mb > 0) {
+            rlimit limit;
+            limit.rlim_cur = limit.rlim_max = (rlim_t)memory_limit_mb << 20;
+            setrlimit(RLIMIT_AS, &limit);
+            setenv("FUZZ_MEMORY_LIMIT", std::to_string(memory_limit_mb).c_str(), 1);
+        }
+        std::vector<char*> argv;
+        for (std::string& arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    bool start_fork_server() {
+        int control[2], status[2];
+        if (pipe(control) != 0) {
+            return false;
+        }
+        if (pipe(status) != 0) {
+            close(control[0]);
+            close(control[1]);
+            return false;
+        }
+        server_pid = fork();
+        if (server_pid == 0) {
+            dup2(control[0], FORKSERVER_CONTROL_FD);
+            dup2(status[1], FORKSERVER_STATUS_FD);
+            close(control[0]);
+            close(control[1]);
+            close(status[0]);
+            close(status[1]);
+            setenv("FUZZ_FORKSERVER", "1", 1);
+            if (persistent_iterations > 1) {
+                setenv("FUZZ_PERSISTENT", std::to_string(persistent_iterations).c_str(), 1);
+            }
+            exec_target();
+        }
+        close(control[0]);
+        close(status[1]);
+        control_fd = control[1];
+        status_fd = status[0];
+        if (server_pid < 0) {
+            stop_fork_server();
+            return false;
+        }
+
+        // A target without the runtime never says hello; it just runs once.
+        uint32_t hello = 0;
+        if (!read_status(&hello, 10000) || hello != FORKSERVER_HELLO) {
+            stop_fork_server();
+            return false;
+        }
+        return true;
+    }
+
+    void stop_fork_server() {
+        if (control_fd >= 0) {
+            close(control_fd);
+            control_fd = -1;
+        }
+        if (status_fd >= 0) {
+            close(status_fd);
+            status_fd = -1;
+        }
+        if (server_pid > 0) {
+            kill(server_pid, SIGKILL);
+            waitpid(server_pid, nullptr, 0);
+            server_pid = -1;
+        }
+    }
+
+    int run_fork_server() {
+        uint32_t command = 0;
+        int32_t child = -1;
+        if (write(control_fd, &command, 4) != 4 || !read_status(&child, -1) || child <= 0) {
+            return -1;
+        }
+        int32_t status;
+        if (!read_status(&status, -1)) {
+            timed_out = true;
+            kill(child, SIGKILL);
+            if (!read_status(&status, 1000)) {
+                return -1;
+            }
+        }
+        return WIFSTOPPED(status) ? 0 : status;
+    }
+
+    void arm_deadline() {
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+#ifdef __linux__
+        if (timer_fd >= 0) {
+            itimerspec spec = {};
+            spec.it_value.tv_sec = timeout_ms / 1000;
+            spec.it_value.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+            timerfd_settime(timer_fd, 0, &spec, nullptr);
+        }
+#endif
+    }
+
+    // 1 once `fd` is readable or closed, 0 if the run's deadline passes
+    // first, -1 on error.
+    int wait_readable(int fd) {
+        pollfd fds[2] = { { fd, POLLIN, 0 }, { timer_fd, POLLIN, 0 } };
+        for (;;) {
+            int wait_ms = -1;
+            if (timer_fd < 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                wait_ms = (int)std::max<long long>(0, left.count());
+            }
+            int ready = poll(fds, timer_fd >= 0 ? 2 : 1, wait_ms);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready < 0) {
+                return -1;
+            }
+            if (fds[0].revents != 0) {
+                return 1;
+            }
+            if (ready == 0 || fds[1].revents != 0) {
+                return 0;
+            }
+        }
+    }
+
+    // Waits up to `wait_ms`, or until the run's deadline when negative.
+    bool read_status(void* value, int wait_ms) {
+        unsigned char* out = (unsigned char*)value;
+        size_t got = 0;
+        while (got < 4) {
+            if (wait_ms < 0) {
+                if (wait_readable(status_fd) != 1) {
+                    return false;
+                }
+            }
+            else {
+                pollfd pfd = { status_fd, POLLIN, 0 };
+                if (poll(&pfd, 1, wait_ms) <= 0) {
+                    return false;
+                }
+            }
+            ssize_t n = read(status_fd, out + got, 4 - got);
+            if (n <= 0) {
+                return false;
+            }
+            got += (size_t)n;
+        }
+        return true;
+    }
+
+    // Waits on a pidfd where the kernel has them, else polls with a short
+    // sleep; a child past the deadline is killed.
+    int wait_for_child(pid_t child) {
+        int status = 0;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        int pid_fd = (int)syscall(SYS_pidfd_open, child, 0);
+        if (pid_fd >= 0) {
+            if (wait_readable(pid_fd) == 0) {
+                timed_out = true;
+                kill(child, SIGKILL);
+            }
+            close(pid_fd);
+            waitpid(child, &status, 0);
+            return status;
+        }
+#endif
+        while (waitpid(child, &status, WNOHANG) == 0) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                timed_out = true;
+                kill(child, SIGKILL);
+                waitpid(child, &status, 0);
+                break;
+            }
+            usleep(100);
+        }
+        return status;
+    }
+
+    std::vector<std::string> args;
+    int input_fd = -1;
+    bool input_on_stdin = false;
+    bool input_shared = false;
+    int coverage_fd = -1;
+    int timeout_ms = 1000;
+    int persistent_iterations = 0;
+    int memory_limit_mb = 0;
+    pid_t server_pid = -1;
+    int control_fd = -1;
+    int status_fd = -1;
+    int timer_fd = -1;
+    std::chrono::steady_clock::time_point deadline;
+    bool timed_out = false;
+};
+
+InputChannel input_channel;
+CoverageMap coverage;
+bool coverage_enabled = false;
+Executor executor;
+#endif
+
+std::string instance_path(const std::string& name) {
+    return output_dir + "/worker_" + std::to_string(worker_id) + "/" + name;
+}
+
+// Written under a temporary name and renamed, so a worker syncing from the
+// directory never reads a partial file.
+void write_file(const std::string& path, const std::string& data) {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file << data;
+    }
+    std::rename(temporary.c_str(), path.c_str());
+}
+
+// Exec times in log-spaced buckets, four per doubling from 1 us, so
+// percentiles come out within about 20% at no per-run cost worth noting.
+struct ExecStats {
+    long long runs = 0;
+    double total_us = 0;
+    long long histogram[128] = {};
+
+    void add(double us) {
+        runs++;
+        total_us += us;
+        int bucket = us < 1 ? 0 : std::min(127, 1 + (int)(4 * std::log2(us)));
+        histogram[bucket]++;
+    }
 
-    for (size_t i = 0; i < length; ++i) {
-        data.push_back(static_cast<char>(dist(gen)));
+    double average_us() const {
+        return runs > 0 ? total_us / runs : 0;
     }
 
-    return data;
+    // Upper edge of the bucket holding the given fraction of runs.
+    double percentile_us(double fraction) const {
+        long long rank = (long long)(fraction * runs);
+        long long seen = 0;
+        for (int bucket = 0; bucket < 128; ++bucket) {
+            seen += histogram[bucket];
+            if (seen > rank) {
+                return std::exp2(bucket / 4.0);
+            }
+        }
+        return 0;
+    }
+};
+
+ExecStats exec_stats;
+double bitmap_seconds = 0;
+
+// One run, with what identifies its behaviour: the stack hash the runtime
+// reported for a crash, or else a hash of the coverage path and the signal
+// or exit code.
+struct RunRecord {
+    ExecResult result;
+    double exec_us = 0;
+    uint32_t edges = 0;
+    int found = 0;
+    uint64_t signature = 0;
+};
+
+RunRecord run_target(const std::string& target_program, const char* test_case, size_t size) {
+    using clock = std::chrono::steady_clock;
+    RunRecord record;
+#ifdef _WIN32
+    std::string input_path = "temp_fuzz_input." + std::to_string(_getpid());
+    std::ofstream temp_file(input_path, std::ios::binary);
+    temp_file.write(test_case, size);
+    temp_file.close();
+
+    std::string command = target_program + " " + input_path;
+
+    // A crashed process exits with its exception code, 0xC0000005 and up.
+    auto exec_start = clock::now();
+    int result = system(command.c_str());
+    record.exec_us = std::chrono::duration<double, std::micro>(clock::now() - exec_start).count();
+    remove(input_path.c_str());
+    record.result.code = result;
+    record.result.outcome = result == -1 ? ExecOutcome::Error
+        : (unsigned)result >= 0xC0000000u ? ExecOutcome::Crash
+        : result != 0 ? ExecOutcome::Exit
+        : ExecOutcome::Ok;
+    record.signature = (uint64_t)(unsigned)result;
+#else
+    (void)target_program;
+    auto exec_start = clock::now();
+    if (input_channel.write(test_case, size)) {
+        record.result = executor.run();
+    }
+    auto exec_end = clock::now();
+    record.exec_us = std::chrono::duration<double, std::micro>(exec_end - exec_start).count();
+    if (coverage_enabled) {
+        record.found = coverage.check(record.edges);
+        uint64_t stack_hash = 0;
+        bool reported = record.result.outcome != ExecOutcome::Ok && coverage.take_stack_hash(stack_hash);
+        record.signature = reported && record.result.outcome == ExecOutcome::Crash ? stack_hash
+            : coverage.path_hash ^ ((uint64_t)record.result.code << 56);
+        bitmap_seconds += std::chrono::duration<double>(clock::now() - exec_end).count();
+    }
+    else {
+        record.signature = (uint64_t)record.result.code;
+    }
+#endif
+    return record;
 }
 
-std::string mutate_input(const std::string& input) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> dist(0, 3);
+// Crash buckets seen so far, by signature, here or in a synced worker.
+std::unordered_set<uint64_t> crash_buckets;
+int unique_crashes = 0;
 
-    std::string mutated = input;
-    int mutation_type = dist(gen);
+std::string crash_name(uint64_t signature) {
+    char name[40];
+    snprintf(name, sizeof(name), "crash_%016llx.input", (unsigned long long)signature);
+    return name;
+}
 
-    switch (mutation_type) {
-    case 0: {
-        std::uniform_int_distribution<size_t> pos_dist(0, mutated.size());
-        size_t pos = pos_dist(gen);
-        std::uniform_int_distribution<size_t> n_dist(1, 10);
-        size_t n = n_dist(gen);
-        std::string extra;
-        for (size_t i = 0; i < n; ++i) {
-            extra.push_back(static_cast<char>(dist(gen)));
+// Counts every outcome and saves the first input of each crash bucket and
+// every hang, each to their own directory with -o. A nonzero exit is only
+// counted: plenty of targets exit with an error on malformed input.
+void record_outcome(const RunRecord& record, const char* test_case, size_t size) {
+    std::string saved;
+    switch (record.result.outcome) {
+    case ExecOutcome::Crash:
+        crashes++;
+        if (crash_buckets.insert(record.signature).second) {
+            unique_crashes++;
+            saved = crash_name(record.signature);
+            write_file(output_dir.empty() ? saved : instance_path("crashes/" + saved), std::string(test_case, size));
         }
-        mutated.insert(pos, extra);
+        break;
+    case ExecOutcome::Hang:
+        saved = "hang_" + std::to_string(hangs++) + ".input";
+        write_file(output_dir.empty() ? saved : instance_path("hangs/" + saved), std::string(test_case, size));
+        break;
+    case ExecOutcome::Exit:
+        nonzero_exits++;
+        break;
+    case ExecOutcome::Oom:
+        out_of_memory++;
+        break;
+    default:
         break;
     }
-    case 1:
-        if (!mutated.empty()) {
-            std::uniform_int_distribution<size_t> pos_dist(0, mutated.size() - 1);
-            size_t pos = pos_dist(gen);
-            size_t max_len = std::min(mutated.size() - pos, static_cast<size_t>(10));
-            std::uniform_int_distribution<size_t> len_dist(1, max_len);
-            size_t len = len_dist(gen);
-            mutated.erase(pos, len);
+}
+
+struct QueueEntry {
+    std::string data;
+    double exec_us = 0;
+    uint32_t edges = 0;
+    int depth = 0;
+    int fuzzed = 0;
+};
+
+std::vector<QueueEntry> queue;
+// Entries this worker found itself, saved as queue/id_N for others to sync.
+size_t published = 0;
+double queue_exec_us = 0;
+double queue_edges = 0;
+
+// How many mutants an entry gets per pass over the queue, after AFL's
+// performance score: fast entries, entries that cover more edges than
+// average and entries found deep in a mutation chain get more, and each
+// pass over an entry halves, thirds, ... its share.
+int entry_energy(const QueueEntry& entry) {
+    double average_us = queue_exec_us / queue.size();
+    double average_edges = queue_edges / queue.size();
+    double score = 100;
+    if (entry.exec_us * 0.1 > average_us) score = 10;
+    else if (entry.exec_us * 0.25 > average_us) score = 25;
+    else if (entry.exec_us * 0.5 > average_us) score = 50;
+    else if (entry.exec_us * 0.75 > average_us) score = 75;
+    else if (entry.exec_us * 4 < average_us) score = 300;
+    else if (entry.exec_us * 3 < average_us) score = 200;
+    else if (entry.exec_us * 2 < average_us) score = 150;
+
+    if (entry.edges * 0.3 > average_edges) score *= 3;
+    else if (entry.edges * 0.5 > average_edges) score *= 2;
+    else if (entry.edges * 0.75 > average_edges) score *= 1.5;
+    else if (entry.edges * 3 < average_edges) score *= 0.25;
+    else if (entry.edges * 2 < average_edges) score *= 0.5;
+    else if (entry.edges * 1.5 < average_edges) score *= 0.75;
+
+    if (entry.depth >= 26) score *= 5;
+    else if (entry.depth >= 14) score *= 4;
+    else if (entry.depth >= 8) score *= 3;
+    else if (entry.depth >= 4) score *= 2;
+
+    score /= entry.fuzzed + 1;
+    return (int)std::min(1600.0, std::max(16.0, score));
+}
+
+// Entries taken from another worker are saved under `sync_name` instead, so
+// they are never offered back to the workers that already have them.
+void add_to_queue(const std::string& data, double exec_us, uint32_t edges, int depth, const char* sync_name) {
+    QueueEntry entry;
+    entry.data = data;
+    entry.exec_us = exec_us;
+    entry.edges = edges;
+    entry.depth = depth;
+    queue.push_back(entry);
+    queue_exec_us += exec_us;
+    queue_edges += edges;
+    if (!output_dir.empty()) {
+        char name[48];
+        if (sync_name != nullptr) {
+            snprintf(name, sizeof(name), "queue/%s", sync_name);
         }
-        break;
-    case 2:
-        if (!mutated.empty()) {
-            size_t max_n = std::min(mutated.size(), static_cast<size_t>(10));
-            std::uniform_int_distribution<size_t> n_dist(1, max_n);
-            size_t n = n_dist(gen);
-            for (size_t i = 0; i < n; ++i) {
-                std::uniform_int_distribution<size_t> pos_dist(0, mutated.size() - 1);
-                size_t pos = pos_dist(gen);
-                mutated[pos] = static_cast<char>(dist(gen));
+        else {
+            snprintf(name, sizeof(name), "queue/id_%06zu", published++);
+        }
+        write_file(instance_path(name), data);
+    }
+}
+
+// Runs one input and queues it if it reached new coverage and exited
+// cleanly. Seeds are queued whenever they run clean. `sync_name` is set for
+// inputs imported from another worker.
+void fuzz_one(const std::string& target_program, const char* test_case, size_t size, int depth, bool seed,
+    const char* sync_name = nullptr) {
+    RunRecord record = run_target(target_program, test_case, size);
+    exec_stats.add(record.exec_us);
+    total_tests++;
+    record_outcome(record, test_case, size);
+    if (record.result.outcome == ExecOutcome::Ok && (record.found > 0 || seed)) {
+        add_to_queue(std::string(test_case, size), record.exec_us, record.edges, depth, sync_name);
+    }
+}
+
+// One "key: value" per line, rewritten about once a second for dashboards
+// and scripts to poll.
+void write_stats_file(std::chrono::steady_clock::time_point start_time) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::ostringstream out;
+    out << "last_update: " << (long long)time(nullptr) << "\n"
+        << "run_time_s: " << (long long)seconds << "\n"
+        << "execs_done: " << total_tests << "\n"
+        << "execs_per_sec: " << (seconds > 0 ? total_tests / seconds : 0) << "\n"
+        << "exec_us_avg: " << exec_stats.average_us() << "\n"
+        << "exec_us_p99: " << exec_stats.percentile_us(0.99) << "\n"
+        << "timeouts: " << hangs << "\n"
+        << "timeout_rate: " << (total_tests > 0 ? (double)hangs / total_tests : 0) << "\n"
+        << "crashes: " << crashes << "\n"
+        << "unique_crashes: " << unique_crashes << "\n"
+        << "nonzero_exits: " << nonzero_exits << "\n"
+        << "out_of_memory: " << out_of_memory << "\n"
+        << "corpus_count: " << queue.size() << "\n";
+#ifndef _WIN32
+    if (coverage_enabled) {
+        out << "edges_covered: " << coverage.covered << "\n";
+    }
+#endif
+    write_file(instance_path("fuzzer_stats"), out.str());
+}
+
+std::vector<std::string> load_seeds(const std::string& seed_dir) {
+    std::vector<std::string> seeds;
+    std::error_code error;
+    if (std::filesystem::is_directory(seed_dir, error)) {
+        for (const auto& file : std::filesystem::directory_iterator(seed_dir, error)) {
+            if (file.is_regular_file(error)) {
+                std::ifstream in(file.path(), std::ios::binary);
+                seeds.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
             }
         }
-        break;
-    case 3:
-        if (mutated.size() > 1) {
-            std::uniform_int_distribution<size_t> pos1_dist(0, mutated.size() / 2);
-            size_t pos1 = pos1_dist(gen);
-            std::uniform_int_distribution<size_t> pos2_dist(mutated.size() / 2, mutated.size() - 1);
-            size_t pos2 = pos2_dist(gen);
-            std::swap_ranges(mutated.begin() + pos1, mutated.begin() + pos1 + 1, mutated.begin() + pos2);
+        return seeds;
+    }
+    return {
+        "normal input",
+        "very very very long input.........................................................................",
+        "",
+        std::string("\x00\x01\x02\x03\x04", 5),
+        "!@#$%^&*()"
+    };
+}
+
+// Runs the inputs other workers queued since the last sync; the ones that
+// add coverage here join this worker's queue too, marked as synced. Crash buckets the others
+// saved are taken over so that no worker saves the same crash again.
+void sync_workers(const std::string& target_program) {
+    static std::vector<size_t> synced(worker_count, 0);
+    for (int other = 0; other < worker_count; ++other) {
+        if (other == worker_id) {
+            continue;
+        }
+        std::error_code error;
+        for (const auto& file : std::filesystem::directory_iterator(output_dir + "/worker_" + std::to_string(other) + "/crashes", error)) {
+            unsigned long long signature;
+            if (sscanf(file.path().filename().string().c_str(), "crash_%16llx.input", &signature) == 1) {
+                crash_buckets.insert(signature);
+            }
+        }
+        std::string queue_dir = output_dir + "/worker_" + std::to_string(other) + "/queue/";
+        for (;;) {
+            char name[32];
+            snprintf(name, sizeof(name), "id_%06zu", synced[other]);
+            std::ifstream in(queue_dir + name, std::ios::binary);
+            if (!in) {
+                break;
+            }
+            std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            char sync_name[32];
+            snprintf(sync_name, sizeof(sync_name), "sync_%d_%06zu", other, synced[other]);
+            fuzz_one(target_program, data.data(), data.size(), 1, false, sync_name);
+            synced[other]++;
         }
-        break;
     }
+}
 
-    return mutated;
+#ifndef _WIN32
+// One slot per worker, in memory shared with the parent that reports them.
+struct WorkerStats {
+    std::atomic<long long> execs;
+    std::atomic<long long> crashes;
+    std::atomic<long long> hangs;
+    std::atomic<long long> corpus;
+    std::atomic<long long> edges;
+};
+
+WorkerStats* worker_stats = nullptr;
+
+void publish_stats() {
+    if (worker_stats == nullptr) {
+        return;
+    }
+    WorkerStats& stats = worker_stats[worker_id];
+    stats.execs = total_tests;
+    stats.crashes = unique_crashes;
+    stats.hangs = hangs;
+    stats.corpus = (long long)queue.size();
+    stats.edges = coverage_enabled ? (long long)coverage.covered : 0;
 }
 
-void run_target(const std::string& target_program, const std::string& test_case) {
-    std::ofstream temp_file("temp_fuzz_input");
-    temp_file << test_case;
-    temp_file.close();
+int available_cpus() {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0) {
+        return CPU_COUNT(&allowed);
+    }
+#endif
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
+}
+
+// Worker i runs on the i-th CPU this process may use, wrapping around when
+// there are more workers than CPUs.
+void pin_to_cpu(int index) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    int target = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(cpu, &pinned);
+            sched_setaffinity(0, sizeof(pinned), &pinned);
+            return;
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+// Forks the workers. Returns true in each worker, which goes on to fuzz
+// with its own executor, input channel and coverage map, and false in the
+// parent, with `workers` filled in.
+bool fork_workers(int jobs, std::vector<pid_t>& workers) {
+    void* shared = mmap(nullptr, sizeof(WorkerStats) * jobs, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return false;
+    }
+    worker_stats = new (shared) WorkerStats[jobs]();
+    worker_count = jobs;
+    for (int i = 0; i < jobs; ++i) {
+        std::error_code error;
+        std::filesystem::create_directories(output_dir + "/worker_" + std::to_string(i) + "/queue", error);
+        std::filesystem::create_directories(output_dir + "/worker_" + std::to_string(i) + "/crashes", error);
+        std::filesystem::create_directories(output_dir + "/worker_" + std::to_string(i) + "/hangs", error);
+    }
+    std::cout.flush();
+    for (int i = 0; i < jobs; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            worker_id = i;
+            quiet = true;
+            pin_to_cpu(i);
+            return true;
+        }
+        if (pid > 0) {
+            workers.push_back(pid);
+        }
+    }
+    return false;
+}
 
-    std::string command = target_program + " temp_fuzz_input";
+// Prints aggregate stats a few times a second until every worker exits.
+// Edge and corpus counts are the best single worker's, as each keeps its
+// own virgin map.
+int supervise_workers(std::vector<pid_t>& workers) {
+    auto start_time = std::chrono::steady_clock::now();
+    int failed = 0;
+    long long execs = 0, crash_inputs = 0, hang_inputs = 0, corpus = 0, edges = 0;
+    size_t running = workers.size();
+    while (running > 0) {
+        for (pid_t& pid : workers) {
+            int status;
+            if (pid > 0 && waitpid(pid, &status, WNOHANG) == pid) {
+                failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+                pid = -1;
+                running--;
+            }
+        }
+        execs = crash_inputs = hang_inputs = corpus = edges = 0;
+        for (int i = 0; i < worker_count; ++i) {
+            execs += worker_stats[i].execs;
+            crash_inputs += worker_stats[i].crashes;
+            hang_inputs += worker_stats[i].hangs;
+            corpus = std::max(corpus, worker_stats[i].corpus.load());
+            edges = std::max(edges, worker_stats[i].edges.load());
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Workers: " << running << "/" << worker_count << " running, " << execs << " tests ("
+            << (long long)(seconds > 0 ? execs / seconds : 0) << "/s), " << crash_inputs << " unique crashes, "
+            << hang_inputs << " hangs, corpus "
+            << corpus << ", " << edges << " edges   \r" << std::flush;
+        if (running > 0) {
+            usleep(250000);
+        }
+    }
 
-    signal(SIGSEGV, signal_handler);
-    signal(SIGABRT, signal_handler);
-    signal(SIGILL, signal_handler);
-    signal(SIGFPE, signal_handler);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "\n\nFuzzing completed!" << std::endl;
+    std::cout << "Workers: " << worker_count << std::endl;
+    std::cout << "Total tests: " << execs << std::endl;
+    std::cout << "Unique crashes: " << crash_inputs << " (inputs under " << output_dir << "/worker_*/crashes)" << std::endl;
+    std::cout << "Hangs found: " << hang_inputs << " (inputs under " << output_dir << "/worker_*/hangs)" << std::endl;
+    std::cout << "Time elapsed: " << (long long)seconds << " seconds" << std::endl;
+    std::cout << "Execs per second: " << (seconds > 0 ? execs / seconds : 0) << std::endl;
+    std::cout << "Corpus size: " << corpus << std::endl;
+    std::cout << "Edges covered: " << edges << std::endl;
+    return failed == 0 ? 0 : 1;
+}
 
-    int result = system(command.c_str());
+bool start_target(const std::string& target_program, InputMode mode, bool use_fork_server,
+    int persistent_iterations, int timeout_ms, int memory_limit_mb) {
+    if (!input_channel.open(mode, MAX_INPUT_SIZE)) {
+        std::cerr << "Cannot create the input channel: " << strerror(errno) << std::endl;
+        return false;
+    }
+    coverage_enabled = coverage.open();
+    executor.start(target_program, input_channel, coverage_enabled ? coverage.descriptor() : -1,
+        use_fork_server, persistent_iterations, timeout_ms, memory_limit_mb);
+    return true;
+}
+
+bool read_exact(int fd, void* buffer, size_t size) {
+    char* out = (char*)buffer;
+    while (size > 0) {
+        ssize_t got = read(fd, out, size);
+        if (got <= 0) {
+            return false;
+        }
+        out += got;
+        size -= (size_t)got;
+    }
+    return true;
+}
+
+bool write_exact(int fd, const void* buffer, size_t size) {
+    const char* in = (const char*)buffer;
+    while (size > 0) {
+        ssize_t put = write(fd, in, size);
+        if (put <= 0) {
+            return false;
+        }
+        in += put;
+        size -= (size_t)put;
+    }
+    return true;
+}
 
-    remove("temp_fuzz_input");
+// What the minimizer must preserve: the outcome and the signature, which is
+// the crash bucket for a crash and the exact coverage path otherwise.
+struct Verdict {
+    int32_t outcome = -1;
+    uint64_t signature = 0;
 
-    if (result != 0) {
-        std::ofstream crash_file("crash_" + std::to_string(crashes) + ".input");
-        crash_file << test_case;
-        crash_file.close();
+    bool operator==(const Verdict& other) const {
+        return outcome == other.outcome && signature == other.signature;
     }
+};
+
+// Delta debugging (ddmin) over the input's bytes: cut it into n chunks and
+// try every complement, keeping the first that still behaves the same; when
+// none does, double n. The complements of a round run in parallel on helper
+// processes, each pinned to a CPU with its own executor, input channel and
+// coverage map, so with a fork server they all stay on the fast path.
+class Minimizer {
+public:
+    ~Minimizer() {
+        for (Runner& runner : runners) {
+            close(runner.to);
+            close(runner.from);
+            waitpid(runner.pid, nullptr, 0);
+        }
+    }
+
+    bool start(int count, const std::string& target_program, InputMode mode, bool use_fork_server,
+        int persistent_iterations, int timeout_ms, int memory_limit_mb) {
+        std::cout.flush();
+        for (int i = 0; i < count; ++i) {
+            int request[2], reply[2];
+            if (pipe(request) != 0 || pipe(reply) != 0) {
+                return false;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                for (Runner& runner : runners) {
+                    close(runner.to);
+                    close(runner.from);
+                }
+                close(request[1]);
+                close(reply[0]);
+                quiet = true;
+                pin_to_cpu(i);
+                if (!start_target(target_program, mode, use_fork_server, persistent_iterations, timeout_ms, memory_limit_mb)) {
+                    _exit(1);
+                }
+                serve(target_program, request[0], reply[1]);
+                _exit(0);
+            }
+            close(request[0]);
+            close(reply[1]);
+            if (pid < 0) {
+                close(request[1]);
+                close(reply[0]);
+                return false;
+            }
+            runners.push_back({ pid, request[1], reply[0] });
+        }
+        return !runners.empty();
+    }
+
+    bool judge(const std::string& input, Verdict& verdict) {
+        std::vector<std::string> single = { input };
+        std::vector<Verdict> verdicts;
+        if (!run_all(single, nullptr, verdicts)) {
+            return false;
+        }
+        verdict = verdicts[0];
+        return true;
+    }
+
+    // Runs the input once on every runner, or twice on a lone one, to check
+    // that its verdict does not depend on the process that ran it.
+    bool judge_everywhere(const std::string& input, std::vector<Verdict>& verdicts) {
+        size_t rounds = std::max<size_t>(runners.size(), 2);
+        verdicts.assign(rounds, Verdict());
+        uint32_t size = (uint32_t)input.size();
+        for (size_t done = 0; done < rounds; done += runners.size()) {
+            size_t batch = std::min(runners.size(), rounds - done);
+            for (size_t r = 0; r < batch; ++r) {
+                if (!write_exact(runners[r].to, &size, 4) || !write_exact(runners[r].to, input.data(), size)) {
+                    return false;
+                }
+            }
+            for (size_t r = 0; r < batch; ++r) {
+                if (!read_exact(runners[r].from, &verdicts[done + r], sizeof(Verdict))) {
+                    return false;
+                }
+                executions++;
+            }
+        }
+        return true;
+    }
+
+    std::string minimize(const std::string& input, const Verdict& goal) {
+        std::string current = input;
+        size_t chunks = 2;
+        std::vector<std::string> candidates;
+        std::vector<Verdict> verdicts;
+        while (current.size() >= 2) {
+            chunks = std::min(chunks, current.size());
+            size_t chunk = (current.size() + chunks - 1) / chunks;
+            candidates.clear();
+            for (size_t start = 0; start < current.size(); start += chunk) {
+                candidates.push_back(current.substr(0, start) + current.substr(std::min(current.size(), start + chunk)));
+            }
+            if (!run_all(candidates, &goal, verdicts)) {
+                break;
+            }
+            size_t match = std::find(verdicts.begin(), verdicts.end(), goal) - verdicts.begin();
+            if (match < verdicts.size()) {
+                current = candidates[match];
+                chunks = std::max<size_t>(chunks - 1, 2);
+            }
+            else if (chunks >= current.size()) {
+                break;
+            }
+            else {
+                chunks *= 2;
+            }
+        }
+        return current;
+    }
+
+    long long executions = 0;
+
+private:
+    struct Runner {
+        pid_t pid;
+        int to;
+        int from;
+    };
+
+    // Requests are a 32-bit length and the bytes; replies are a Verdict.
+    static void serve(const std::string& target_program, int requests, int replies) {
+        std::string input;
+        uint32_t size;
+        while (read_exact(requests, &size, 4)) {
+            input.resize(size);
+            if (!read_exact(requests, &input[0], size)) {
+                break;
+            }
+            RunRecord record = run_target(target_program, input.data(), input.size());
+            Verdict verdict;
+            verdict.outcome = (int32_t)record.result.outcome;
+            verdict.signature = record.signature;
+            if (!write_exact(replies, &verdict, sizeof(verdict))) {
+                break;
+            }
+        }
+    }
+
+    // Fills `verdicts` in candidate order. With a goal, candidates not yet
+    // handed out are skipped once one has matched; they keep outcome -1.
+    bool run_all(const std::vector<std::string>& candidates, const Verdict* goal, std::vector<Verdict>& verdicts) {
+        verdicts.assign(candidates.size(), Verdict());
+        std::vector<long> assigned(runners.size(), -1);
+        size_t next = 0;
+        size_t busy = 0;
+        bool matched = false;
+        for (;;) {
+            for (size_t r = 0; r < runners.size() && next < candidates.size() && !matched; ++r) {
+                if (assigned[r] >= 0) {
+                    continue;
+                }
+                const std::string& candidate = candidates[next];
+                uint32_t size = (uint32_t)candidate.size();
+                if (!write_exact(runners[r].to, &size, 4) || !write_exact(runners[r].to, candidate.data(), size)) {
+                    return false;
+                }
+                assigned[r] = (long)next++;
+                busy++;
+            }
+            if (busy == 0) {
+                return true;
+            }
+            std::vector<pollfd> fds;
+            for (size_t r = 0; r < runners.size(); ++r) {
+                fds.push_back({ assigned[r] >= 0 ? runners[r].from : -1, POLLIN, 0 });
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+                return false;
+            }
+            for (size_t r = 0; r < runners.size(); ++r) {
+                if (assigned[r] < 0 || fds[r].revents == 0) {
+                    continue;
+                }
+                Verdict& verdict = verdicts[assigned[r]];
+                if (!read_exact(runners[r].from, &verdict, sizeof(verdict))) {
+                    return false;
+                }
+                executions++;
+                matched = matched || (goal != nullptr && verdict == *goal);
+                assigned[r] = -1;
+                busy--;
+            }
+        }
+    }
+
+    std::vector<Runner> runners;
+};
+
+// Minimizes one file, or every regular file in a directory (crashes or a
+// queue), writing the results next to them: file.min, or dir/minimized/.
+int minimize_inputs(const std::string& path, int runners, const std::string& target_program, InputMode mode,
+    bool use_fork_server, int persistent_iterations, int timeout_ms, int memory_limit_mb) {
+    std::vector<std::pair<std::string, std::string>> jobs;
+    std::error_code error;
+    if (std::filesystem::is_directory(path, error)) {
+        std::filesystem::create_directories(path + "/minimized", error);
+        for (const auto& file : std::filesystem::directory_iterator(path, error)) {
+            if (file.is_regular_file(error)) {
+                jobs.push_back({ file.path().string(), path + "/minimized/" + file.path().filename().string() });
+            }
+        }
+        std::sort(jobs.begin(), jobs.end());
+    }
+    else {
+        jobs.push_back({ path, path + ".min" });
+    }
+
+    Minimizer minimizer;
+    if (!minimizer.start(runners, target_program, mode, use_fork_server, persistent_iterations, timeout_ms, memory_limit_mb)) {
+        std::cerr << "Cannot start minimizer runners: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::cout << "Minimizing " << jobs.size() << " input(s) on " << runners << " runner(s)" << std::endl;
+    auto start_time = std::chrono::steady_clock::now();
+    size_t before = 0, after = 0;
+    for (const auto& job : jobs) {
+        std::ifstream in(job.first, std::ios::binary);
+        std::string input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::vector<Verdict> verdicts;
+        if (!minimizer.judge_everywhere(input, verdicts) ||
+            std::count(verdicts.begin(), verdicts.end(), verdicts[0]) != (long)verdicts.size()) {
+            std::cout << job.first << ": behaviour not reproducible, skipped" << std::endl;
+            continue;
+        }
+        std::string smaller = minimizer.minimize(input, verdicts[0]);
+        write_file(job.second, smaller);
+        before += input.size();
+        after += smaller.size();
+        std::cout << job.first << ": " << input.size() << " -> " << smaller.size() << " bytes" << std::endl;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Total: " << before << " -> " << after << " bytes, " << minimizer.executions << " executions in "
+        << seconds << " s (" << (seconds > 0 ? minimizer.executions / seconds : 0) << "/s)" << std::endl;
+    return 0;
 }
 
+// Runs every seed, plus inputs that crash the sample target, on two runners
+// with their own executors (and so their own fork servers and address
+// layouts), and checks they agree on each outcome and crash bucket or
+// coverage path.
+int check_runners_agree(const std::string& seed_dir, const std::string& target_program, InputMode mode,
+    bool use_fork_server, int persistent_iterations, int timeout_ms, int memory_limit_mb) {
+    std::vector<std::string> inputs = load_seeds(seed_dir);
+    inputs.push_back("FUZZ");
+    inputs.push_back(std::string("REC\0!", 5));
+    inputs.push_back(std::string("REC\1\xff", 5) + std::string(255, 'A'));
+
+    Minimizer minimizer;
+    if (!minimizer.start(2, target_program, mode, use_fork_server, persistent_iterations, timeout_ms, memory_limit_mb)) {
+        std::cerr << "Cannot start runners: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    int disagreements = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::vector<Verdict> verdicts;
+        if (!minimizer.judge_everywhere(inputs[i], verdicts)) {
+            std::cerr << "Runner failed on input " << i << std::endl;
+            return 1;
+        }
+        if (!(verdicts[0] == verdicts[1])) {
+            std::cout << "Input " << i << ": outcome " << verdicts[0].outcome << " signature " << std::hex
+                << verdicts[0].signature << " vs outcome " << std::dec << verdicts[1].outcome << " signature "
+                << std::hex << verdicts[1].signature << std::dec << std::endl;
+            disagreements++;
+        }
+    }
+    std::cout << "Runners disagree on " << disagreements << " of " << inputs.size() << " input(s)" << std::endl;
+    return disagreements == 0 ? 0 : 1;
+}
+#endif
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <target_program> [seed_dir] [iterations]" << std::endl;
+    bool use_fork_server = true;
+    int persistent_iterations = 0;
+    int timeout_ms = 1000;
+    int memory_limit_mb = 0;
+    std::string input_mode = "shm";
+    int jobs = 1;
+    std::string minimize_path;
+    bool self_test = false;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-' && argv[first][1] != '\0'; ++first) {
+        std::string option = argv[first];
+        if (option == "-E") {
+            use_fork_server = false;
+        }
+        else if (option == "-P" && first + 1 < argc) {
+            persistent_iterations = std::stoi(argv[++first]);
+        }
+        else if (option == "-t" && first + 1 < argc) {
+            timeout_ms = std::stoi(argv[++first]);
+        }
+        else if (option == "-i" && first + 1 < argc) {
+            input_mode = argv[++first];
+            if (input_mode != "shm" && input_mode != "stdin" && input_mode != "file") {
+                std::cerr << "Unknown input mode \"" << input_mode << "\": use -i shm, -i stdin or -i file" << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "-m" && first + 1 < argc) {
+            memory_limit_mb = std::stoi(argv[++first]);
+        }
+        else if (option == "-j" && first + 1 < argc) {
+            jobs = std::max(1, std::stoi(argv[++first]));
+        }
+        else if (option == "-o" && first + 1 < argc) {
+            output_dir = argv[++first];
+        }
+        else if (option == "-x" && first + 1 < argc) {
+            std::string error;
+            if (!mutator.load_dictionary(argv[++first], error)) {
+                std::cerr << "Bad dictionary: " << error << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--minimize" && first + 1 < argc) {
+            minimize_path = argv[++first];
+        }
+        else if (option == "--self-test") {
+            self_test = true;
+        }
+        else if (option == "--bench-mutator") {
+            long rounds = first + 1 < argc ? atol(argv[first + 1]) : 0;
+            return benchmark_mutator(rounds > 0 ? rounds : 10000000);
+        }
+        else {
+            break;
+        }
+    }
+    if (argc - first < 1) {
+        std::cerr << "Usage: " << argv[0] << " [-E] [-P iterations] [-t ms] [-m MB] [-i shm|stdin|file] [-j workers] [-o dir] [-x dict] <target_program> [seed_dir] [iterations]\n"
+            << "  -E             exec the target for every input instead of using its fork server\n"
+            << "  -P iterations  persistent mode: inputs per target process (needs fuzz_target)\n"
+            << "  -t ms          per-input timeout (default 1000); inputs that hit it are saved as hangs\n"
+            << "  -m MB          address space limit for the target; running out counts as OOM, not a crash\n"
+            << "  -i shm         input in a memfd: the runtime maps it, other targets read /dev/fd/197\n"
+            << "  -i stdin       input on the target's standard input\n"
+            << "  -i file        input in a file private to this fuzzer instance\n"
+            << "  -j workers     run this many fuzzer processes, one per CPU, sharing finds (iterations are split)\n"
+            << "  -o dir         keep the queue, crashes, hangs and a fuzzer_stats file under dir/worker_N\n"
+            << "                 (default fuzz_out with -j)\n"
+            << "  -x dict        tokens to insert, one name=\"value\" per line (AFL dictionary format)\n"
+            << "  --minimize path  shrink a file, or each file in a directory, keeping its crash bucket or\n"
+            << "                 coverage; writes path.min or path/minimized/ (runs -j runners, default all CPUs)\n"
+            << "  --self-test    run each seed on two separate executors, check they agree on its crash\n"
+            << "                 bucket or coverage, and exit\n"
+            << "  --bench-mutator [rounds]  time the havoc mutator and exit\n"
+            << "seed_dir is a directory of seed inputs; any other non-empty value uses built-in seeds.\n"
+            << "Targets linked with \"Fuzzing runtime.cpp\" start a fork server automatically, and report\n"
+            << "edge coverage when built with -fsanitize-coverage (see that file)." << std::endl;
         return 1;
     }
 
-    std::string target_program = argv[1];
-    std::string seed_dir = (argc > 2) ? argv[2] : "";
-    int iterations = (argc > 3) ? std::stoi(argv[3]) : 1000;
+    std::string target_program = argv[first];
+    std::string seed_dir = (argc > first + 1) ? argv[first + 1] : "";
+    int iterations = (argc > first + 2) ? std::stoi(argv[first + 2]) : 1000;
+
+#ifndef _WIN32
+    InputMode mode = input_mode == "stdin" ? InputMode::Stdin : input_mode == "file" ? InputMode::File : InputMode::Shared;
+    if (self_test) {
+        return check_runners_agree(seed_dir, target_program, mode, use_fork_server, persistent_iterations, timeout_ms,
+            memory_limit_mb);
+    }
+    if (!minimize_path.empty()) {
+        return minimize_inputs(minimize_path, jobs > 1 ? jobs : available_cpus(), target_program, mode,
+            use_fork_server, persistent_iterations, timeout_ms, memory_limit_mb);
+    }
+    if (jobs > 1) {
+        if (output_dir.empty()) {
+            output_dir = "fuzz_out";
+        }
+        std::vector<pid_t> workers;
+        if (!fork_workers(jobs, workers)) {
+            if (workers.empty()) {
+                std::cerr << "Cannot start workers: " << strerror(errno) << std::endl;
+                return 1;
+            }
+            return supervise_workers(workers);
+        }
+        iterations = (iterations + jobs - 1) / jobs;
+    }
+#else
+    (void)jobs;
+    if (!minimize_path.empty() || self_test) {
+        std::cerr << "--minimize and --self-test are not available on Windows." << std::endl;
+        return 1;
+    }
+#endif
+    if (!output_dir.empty() && worker_count == 1) {
+        std::error_code error;
+        std::filesystem::create_directories(instance_path("queue"), error);
+        std::filesystem::create_directories(instance_path("crashes"), error);
+        std::filesystem::create_directories(instance_path("hangs"), error);
+    }
+
+#ifndef _WIN32
+    if (!start_target(target_program, mode, use_fork_server, persistent_iterations, timeout_ms, memory_limit_mb)) {
+        return 1;
+    }
+#else
+    (void)input_mode;
+    (void)use_fork_server;
+    (void)persistent_iterations;
+    (void)timeout_ms;
+    (void)memory_limit_mb;
+#endif
 
     if (!seed_dir.empty()) {
-        seed_corpus = {
-            "normal input",
-            "very very very long input.........................................................................",
-            "",
-            "\x00\x01\x02\x03\x04",
-            "!@#$%^&*()"
-        };
+        seed_corpus = load_seeds(seed_dir);
     }
 
     auto start_time = std::chrono::steady_clock::now();
 
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::bernoulli_distribution bernoulli_dist(0.7);
-    std::uniform_int_distribution<size_t> corpus_dist(0, seed_corpus.empty() ? 0 : seed_corpus.size() - 1);
+    std::bernoulli_distribution splice_dist(0.25);
+    std::uniform_int_distribution<size_t> other_dist;
+    mutator.seed((uint64_t)rd() << 32 ^ rd());
 
-    for (int i = 0; i < iterations; ++i) {
-        std::string test_case;
+    for (const std::string& seed : seed_corpus) {
+        fuzz_one(target_program, seed.data(), seed.size(), 0, true);
+    }
 
-        if (!seed_corpus.empty() && bernoulli_dist(gen)) {
-            const std::string& seed = seed_corpus[corpus_dist(gen)];
-            test_case = mutate_input(seed);
+    size_t cursor = 0;
+    int next_progress = 0;
+    auto next_sync = std::chrono::steady_clock::now();
+    auto next_stats = next_sync;
+    while (total_tests < iterations) {
+        if (queue.empty()) {
+            mutator.randomize(1024);
+            fuzz_one(target_program, mutator.data(), mutator.size(), 1, false);
         }
         else {
-            test_case = generate_random_data(1024);
+            size_t index = cursor++ % queue.size();
+            int energy = entry_energy(queue[index]);
+            for (int n = 0; n < energy && total_tests < iterations; ++n) {
+                mutator.load(queue[index].data);
+                const std::string* splice_source = queue.size() > 1 && splice_dist(gen) ? &queue[other_dist(gen) % queue.size()].data : nullptr;
+                mutator.havoc(splice_source);
+                fuzz_one(target_program, mutator.data(), mutator.size(), queue[index].depth + 1, false);
+            }
+            queue[index].fuzzed++;
         }
 
-        run_target(target_program, test_case);
-        total_tests++;
-
-        if (i % 100 == 0) {
-            std::cout << "Progress: " << i << "/" << iterations
-                << " tests, " << crashes << " crashes found\r" << std::flush;
+        if (total_tests >= next_progress) {
+            next_progress = total_tests + 100;
+            auto now = std::chrono::steady_clock::now();
+            if (!output_dir.empty() && now >= next_stats) {
+                write_stats_file(start_time);
+                next_stats = now + std::chrono::seconds(1);
+            }
+#ifndef _WIN32
+            if (worker_count > 1) {
+                publish_stats();
+                if (std::chrono::steady_clock::now() >= next_sync) {
+                    sync_workers(target_program);
+                    next_sync = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+                }
+                continue;
+            }
+#endif
+            double elapsed = std::chrono::duration<double>(now - start_time).count();
+            std::cout << "Progress: " << total_tests << "/" << iterations << " tests, "
+                << (long long)(elapsed > 0 ? total_tests / elapsed : 0) << "/s, "
+                << (long long)exec_stats.average_us() << " us avg, " << (long long)exec_stats.percentile_us(0.99) << " us p99, "
+                << unique_crashes << " unique crashes, " << hangs << " hangs, corpus " << queue.size();
+#ifndef _WIN32
+            if (coverage_enabled) {
+                std::cout << ", " << coverage.covered << " edges";
+            }
+#endif
+            std::cout << "\r" << std::flush;
         }
     }
 
+    if (!output_dir.empty()) {
+        write_stats_file(start_time);
+    }
+#ifndef _WIN32
+    if (worker_count > 1) {
+        publish_stats();
+        return 0;
+    }
+#endif
+
     auto end_time = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
+    double seconds = std::chrono::duration<double>(end_time - start_time).count();
 
     std::cout << "\n\nFuzzing completed!" << std::endl;
     std::cout << "Total tests: " << total_tests << std::endl;
-    std::cout << "Crashes found: " << crashes << std::endl;
+    std::cout << "Crashes found: " << crashes << " (" << unique_crashes << " unique)" << std::endl;
+    std::cout << "Hangs found: " << hangs << " (" << (total_tests > 0 ? 100.0 * hangs / total_tests : 0) << "% of runs timed out)" << std::endl;
+    std::cout << "Nonzero exits: " << nonzero_exits << std::endl;
+    std::cout << "Out of memory: " << out_of_memory << std::endl;
     std::cout << "Time elapsed: " << duration.count() << " seconds" << std::endl;
+    std::cout << "Execs per second: " << (seconds > 0 ? total_tests / seconds : 0) << std::endl;
+    std::cout << "Exec time: " << exec_stats.average_us() << " us average, " << exec_stats.percentile_us(0.99) << " us p99" << std::endl;
+    std::cout << "Corpus size: " << queue.size() << std::endl;
+#ifndef _WIN32
+    if (coverage_enabled) {
+        std::cout << "Edges covered: " << coverage.covered << std::endl;
+        std::cout << "Bitmap overhead: " << (seconds > 0 ? 100 * bitmap_seconds / seconds : 0) << "% of run time" << std::endl;
+    }
+#endif
 
     return 0;
 }
@@ -1,56 +1,3532 @@
+#ifdef _WIN32
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #define WIN32_LEAN_AND_MEAN
+#endif
 
 #include <iostream>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <csignal>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+#ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <windows.h>
 #include <iphlpapi.h>
 #include <npcap/npcap.h>
+#else
+#include <pcap.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <netinet/in.h>
 #include <net/ethernet.h>
+#ifndef _WIN32
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#endif
+#ifdef __linux__
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#endif
+
+#ifdef _WIN32
+#pragma comment(lib, "wpcap.lib")
+#pragma comment(lib, "Packet.lib")
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+struct PacketStats {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t ipv4 = 0;
+    uint64_t ipv6 = 0;
+    uint64_t vlan = 0;
+    uint64_t fragments = 0;
+    uint64_t truncated = 0;
+    uint64_t tcp = 0;
+    uint64_t udp = 0;
+    uint64_t icmp = 0;
+    uint64_t arp = 0;
+    uint64_t other = 0;
+
+    void merge(const PacketStats& other_stats) {
+        packets += other_stats.packets;
+        bytes += other_stats.bytes;
+        ipv4 += other_stats.ipv4;
+        ipv6 += other_stats.ipv6;
+        vlan += other_stats.vlan;
+        fragments += other_stats.fragments;
+        truncated += other_stats.truncated;
+        tcp += other_stats.tcp;
+        udp += other_stats.udp;
+        icmp += other_stats.icmp;
+        arp += other_stats.arp;
+        other += other_stats.other;
+    }
+};
+
+// Zero-copy reference to one captured frame, valid only while the buffer
+// it points into (file mapping, ring block or pcap buffer) is.
+struct PacketView {
+    const unsigned char* data;
+    uint32_t caplen;
+    uint32_t len;
+    uint64_t timestamp_us;
+};
+
+const size_t DECODE_BATCH = 256;
+
+enum DecodeFlags : uint8_t {
+    DECODED_VLAN = 1,
+    DECODED_IPV4 = 2,
+    DECODED_IPV6 = 4,
+    DECODED_ARP = 8,
+    DECODED_FRAGMENT = 16,
+    DECODED_TRUNCATED = 32,
+    DECODED_L4 = 64
+};
+
+// Decoded headers for a batch of packets, one array per field so filters
+// and aggregation can sweep a single column. Addresses are 16 bytes with
+// IPv4 stored IPv4-mapped; ports are in host order, and for ICMP the
+// destination port carries type * 256 + code as NetFlow does.
+struct DecodedBatch {
+    size_t count = 0;
+    uint8_t flags[DECODE_BATCH];
+    uint8_t protocol[DECODE_BATCH];
+    uint8_t tcp_flags[DECODE_BATCH];
+    uint32_t tcp_seq[DECODE_BATCH];
+    uint16_t vlan_id[DECODE_BATCH];
+    uint16_t src_port[DECODE_BATCH];
+    uint16_t dst_port[DECODE_BATCH];
+    uint16_t payload_offset[DECODE_BATCH];
+    uint16_t payload_length[DECODE_BATCH];
+    uint32_t wire_length[DECODE_BATCH];
+    uint64_t timestamp_us[DECODE_BATCH];
+    unsigned char src_addr[DECODE_BATCH][16];
+    unsigned char dst_addr[DECODE_BATCH][16];
+};
+
+static inline uint16_t load_be16(const unsigned char* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline void store_mapped_ipv4(unsigned char* out, const unsigned char* addr) {
+    memset(out, 0, 10);
+    out[10] = 0xFF;
+    out[11] = 0xFF;
+    memcpy(out + 12, addr, 4);
+}
+
+// Every read is checked against caplen; a header that does not fit marks the
+// packet truncated and leaves the remaining fields zero. Lengths are taken
+// from the IP header so Ethernet padding never counts as payload.
+static void decode_packet(const PacketView& view, DecodedBatch& batch, size_t i) {
+    const unsigned char* data = view.data;
+    uint32_t caplen = std::min<uint32_t>(view.caplen, 65535);
+    uint8_t flags = 0;
+    uint8_t protocol = 0;
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+    uint16_t vlan_id = 0;
+    uint8_t tcp_flags = 0;
+    uint32_t tcp_seq = 0;
+    uint32_t l4 = 0;
+    uint32_t end = caplen;
+    uint32_t payload = caplen;
+
+    memset(batch.src_addr[i], 0, 16);
+    memset(batch.dst_addr[i], 0, 16);
+
+    if (caplen < 14) {
+        flags |= DECODED_TRUNCATED;
+        goto done;
+    }
+    {
+        uint16_t ethertype = load_be16(data + 12);
+        uint32_t offset = 14;
+        for (int tag = 0; tag < 2 && (ethertype == 0x8100 || ethertype == 0x88A8); ++tag) {
+            if (offset + 4 > caplen) {
+                flags |= DECODED_TRUNCATED;
+                goto done;
+            }
+            if (tag == 0) {
+                vlan_id = load_be16(data + offset) & 0x0FFF;
+            }
+            ethertype = load_be16(data + offset + 2);
+            offset += 4;
+            flags |= DECODED_VLAN;
+        }
+
+        if (ethertype == 0x0806) {
+            flags |= DECODED_ARP;
+            goto done;
+        }
+        if (ethertype == 0x0800) {
+            if (offset + 20 > caplen) {
+                flags |= DECODED_TRUNCATED;
+                goto done;
+            }
+            uint32_t ihl = (uint32_t)(data[offset] & 0x0F) * 4;
+            if ((data[offset] >> 4) != 4 || ihl < 20 || offset + ihl > caplen) {
+                flags |= DECODED_TRUNCATED;
+                goto done;
+            }
+            flags |= DECODED_IPV4;
+            protocol = data[offset + 9];
+            store_mapped_ipv4(batch.src_addr[i], data + offset + 12);
+            store_mapped_ipv4(batch.dst_addr[i], data + offset + 16);
+            end = std::min<uint32_t>(caplen, offset + std::max<uint32_t>(load_be16(data + offset + 2), ihl));
+            if (load_be16(data + offset + 6) & 0x1FFF) {
+                flags |= DECODED_FRAGMENT;
+            }
+            l4 = offset + ihl;
+        }
+        else if (ethertype == 0x86DD) {
+            if (offset + 40 > caplen || (data[offset] >> 4) != 6) {
+                flags |= DECODED_TRUNCATED;
+                goto done;
+            }
+            flags |= DECODED_IPV6;
+            protocol = data[offset + 6];
+            memcpy(batch.src_addr[i], data + offset + 8, 16);
+            memcpy(batch.dst_addr[i], data + offset + 24, 16);
+            end = std::min<uint32_t>(caplen, offset + 40 + load_be16(data + offset + 4));
+            l4 = offset + 40;
+            // Hop-by-hop, routing, fragment, AH and destination options.
+            for (int header = 0; header < 8; ++header) {
+                if (protocol != 0 && protocol != 43 && protocol != 44 && protocol != 51 && protocol != 60) {
+                    break;
+                }
+                if (l4 + 8 > end) {
+                    flags |= DECODED_TRUNCATED;
+                    goto done;
+                }
+                uint32_t length = protocol == 44 ? 8 : protocol == 51 ? ((uint32_t)data[l4 + 1] + 2) * 4 :
+                    ((uint32_t)data[l4 + 1] + 1) * 8;
+                if (protocol == 44 && (load_be16(data + l4 + 2) & 0xFFF8)) {
+                    flags |= DECODED_FRAGMENT;
+                }
+                protocol = data[l4];
+                l4 += length;
+            }
+        }
+        else {
+            goto done;
+        }
+
+        if (flags & DECODED_FRAGMENT) {
+            goto done;
+        }
+        switch (protocol) {
+        case IPPROTO_TCP: {
+            uint32_t header_length = l4 + 13 < end ? (uint32_t)(data[l4 + 12] >> 4) * 4 : 0;
+            if (header_length < 20 || l4 + header_length > end) {
+                flags |= DECODED_TRUNCATED;
+                goto done;
+            }
+            src_port = load_be16(data + l4);
+            dst_port = load_be16(data + l4 + 2);
+            tcp_flags = data[l4 + 13];
+            tcp_seq = (uint32_t)load_be16(data + l4 + 4) << 16 | load_be16(data + l4 + 6);
+            payload = l4 + header_length;
+            flags |= DECODED_L4;
+            break;
+        }
+        case IPPROTO_UDP:
+            if (l4 + 8 > end) {
+                flags |= DECODED_TRUNCATED;
+                goto done;
+            }
+            src_port = load_be16(data + l4);
+            dst_port = load_be16(data + l4 + 2);
+            payload = l4 + 8;
+            flags |= DECODED_L4;
+            break;
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            if (l4 + 4 > end) {
+                flags |= DECODED_TRUNCATED;
+                goto done;
+            }
+            dst_port = load_be16(data + l4);
+            payload = l4 + 4;
+            flags |= DECODED_L4;
+            break;
+        default:
+            payload = l4;
+            break;
+        }
+    }
+
+done:
+    if (payload > end) {
+        payload = end;
+    }
+    batch.flags[i] = flags;
+    batch.protocol[i] = protocol;
+    batch.tcp_flags[i] = tcp_flags;
+    batch.tcp_seq[i] = tcp_seq;
+    batch.vlan_id[i] = vlan_id;
+    batch.src_port[i] = src_port;
+    batch.dst_port[i] = dst_port;
+    batch.payload_offset[i] = (uint16_t)payload;
+    batch.payload_length[i] = (uint16_t)(end - payload);
+    batch.wire_length[i] = view.len;
+    batch.timestamp_us[i] = view.timestamp_us;
+}
+
+void decode_batch(const PacketView* views, size_t count, DecodedBatch& batch) {
+    batch.count = std::min(count, DECODE_BATCH);
+    for (size_t i = 0; i < batch.count; ++i) {
+#ifdef __GNUC__
+        if (i + 4 < batch.count) {
+            __builtin_prefetch(views[i + 4].data);
+        }
+#endif
+        decode_packet(views[i], batch, i);
+    }
+}
+
+// Built zero-initialised so the padding compares equal too.
+struct FlowKey {
+    unsigned char src_addr[16];
+    unsigned char dst_addr[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;
+    uint8_t padding[3];
+
+    bool operator==(const FlowKey& other) const {
+        return memcmp(this, &other, sizeof(FlowKey)) == 0;
+    }
+};
+
+struct FlowRecord {
+    FlowKey key;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first_us;
+    uint64_t last_us;
+};
+
+static bool is_mapped_ipv4(const unsigned char* addr) {
+    static const unsigned char prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+    return memcmp(addr, prefix, 12) == 0;
+}
+
+// IPv6 addresses are bracketed when a port will follow.
+static void format_address(const unsigned char* addr, char* out, size_t size, bool bracket) {
+    if (is_mapped_ipv4(addr)) {
+        inet_ntop(AF_INET, addr + 12, out, (socklen_t)size);
+        return;
+    }
+    char text[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, addr, text, sizeof(text));
+    snprintf(out, size, bracket ? "[%s]" : "%s", text);
+}
+
+static const char* protocol_name(uint8_t protocol) {
+    switch (protocol) {
+    case IPPROTO_TCP:
+        return "TCP";
+    case IPPROTO_UDP:
+        return "UDP";
+    case IPPROTO_ICMP:
+        return "ICMP";
+    case IPPROTO_ICMPV6:
+        return "ICMPv6";
+    default:
+        return "Other";
+    }
+}
+
+static size_t hash_flow_key(const FlowKey& key) {
+    uint64_t words[sizeof(FlowKey) / 8];
+    memcpy(words, &key, sizeof(words));
+    uint64_t value = 0;
+    for (uint64_t word : words) {
+        value = (value ^ word) * 0x9E3779B97F4A7C15ull;
+        value ^= value >> 32;
+    }
+    return (size_t)value;
+}
+
+// Writes exported flows a batch at a time; shared by all capture threads.
+class FlowExporter {
+public:
+    explicit FlowExporter(FILE* out = stdout) : out(out) {}
+
+    void export_batch(const FlowRecord* records, size_t count) {
+        std::string text;
+        text.reserve(count * 112);
+        char line[256];
+        for (size_t i = 0; i < count; ++i) {
+            const FlowRecord& flow = records[i];
+            char src_ip[INET6_ADDRSTRLEN + 2], dst_ip[INET6_ADDRSTRLEN + 2];
+            format_address(flow.key.src_addr, src_ip, sizeof(src_ip), true);
+            format_address(flow.key.dst_addr, dst_ip, sizeof(dst_ip), true);
+            int length = snprintf(line, sizeof(line), "Flow: %s:%u -> %s:%u %s packets=%llu bytes=%llu duration=%.3fs\n",
+                src_ip, flow.key.src_port, dst_ip, flow.key.dst_port, protocol_name(flow.key.protocol),
+                (unsigned long long)flow.packets, (unsigned long long)flow.bytes,
+                (flow.last_us - flow.first_us) / 1e6);
+            text.append(line, (size_t)length);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        fwrite(text.data(), 1, text.size(), out);
+        fflush(out);
+        exported += count;
+    }
+
+    uint64_t exported = 0;
+
+private:
+    FILE* out;
+    std::mutex mutex;
+};
+
+// Open-addressing flow table with linear probing over a preallocated slot
+// array; a slot with zero packets is empty. Removal shifts the rest of the
+// probe run back, so lookups never wade through tombstones. A flow is
+// exported once idle for idle_timeout or alive for active_timeout, and when
+// the table is at its load limit the least recently seen flow in the new
+// key's probe run is exported early to make room.
+class FlowTable {
+public:
+    FlowTable(size_t capacity, uint64_t idle_timeout_us, uint64_t active_timeout_us, FlowExporter& exporter)
+        : idle_timeout_us(idle_timeout_us), active_timeout_us(active_timeout_us), exporter(exporter) {
+        size_t slot_count = 16;
+        while (slot_count < capacity) {
+            slot_count <<= 1;
+        }
+        slots.assign(slot_count, FlowRecord());
+        mask = slot_count - 1;
+        max_flows = slot_count / 4 * 3;
+        pending.reserve(batch_size);
+    }
+
+    void update(const FlowKey& key, uint32_t bytes, uint64_t now_us) {
+        if (holding && !started) {
+            started = true;
+            start_us = now_us;
+        }
+        // A sweep reads every slot, so it also waits for enough packets to
+        // keep its cost at a few slot reads per packet when a capture file
+        // replays hours of traffic in seconds.
+        if (++packets_since_sweep > mask / 4 && now_us >= last_sweep_us + sweep_interval_us) {
+            expire(now_us);
+        }
+
+        size_t index = hash(key) & mask;
+        while (slots[index].packets != 0) {
+            FlowRecord& flow = slots[index];
+            if (flow.key == key) {
+                flow.packets++;
+                flow.bytes += bytes;
+                flow.last_us = std::max(flow.last_us, now_us);
+                return;
+            }
+            index = (index + 1) & mask;
+        }
+
+        if (count >= max_flows) {
+            evictions++;
+            remove(eviction_victim(hash(key) & mask));
+            insert(key, bytes, now_us);
+            return;
+        }
+        FlowRecord& flow = slots[index];
+        flow.key = key;
+        flow.packets = 1;
+        flow.bytes = bytes;
+        flow.first_us = now_us;
+        flow.last_us = now_us;
+        count++;
+    }
+
+    void expire(uint64_t now_us) {
+        last_sweep_us = now_us;
+        packets_since_sweep = 0;
+        for (size_t index = 0; index <= mask;) {
+            const FlowRecord& flow = slots[index];
+            // Capture files are not always in timestamp order, so a flow can
+            // be newer than `now_us`; count that as no time elapsed.
+            if (flow.packets != 0 && (elapsed(flow.last_us, now_us) >= idle_timeout_us ||
+                elapsed(flow.first_us, now_us) >= active_timeout_us)) {
+                // The shift may pull a later flow into this slot; look again.
+                remove(index);
+                continue;
+            }
+            index++;
+        }
+        flush_pending();
+    }
+
+    // Exports every remaining flow, e.g. at the end of a capture file.
+    void flush() {
+        for (size_t index = 0; index <= mask; ++index) {
+            if (slots[index].packets != 0) {
+                if (holding) {
+                    tail.push_back(slots[index]);
+                }
+                else {
+                    export_flow(slots[index]);
+                }
+                slots[index].packets = 0;
+            }
+        }
+        count = 0;
+        flush_pending();
+    }
+
+    // For one chunk of a capture file split across threads. Flows first seen
+    // within idle_timeout of the chunk's start may continue one from the
+    // previous chunk, so they are kept in `head` instead of exported, and
+    // flush() leaves what is still open in `tail`; merge_split_flows() joins
+    // them up across chunks.
+    void hold_split_flows() {
+        holding = true;
+    }
+
+    uint64_t idle_timeout() const {
+        return idle_timeout_us;
+    }
+
+    uint64_t evictions = 0;
+    std::vector<FlowRecord> head;
+    std::vector<FlowRecord> tail;
+
+private:
+    static const size_t batch_size = 4096;
+    static const uint64_t sweep_interval_us = 1000000;
+
+    static size_t hash(const FlowKey& key) {
+        return hash_flow_key(key);
+    }
+
+    static uint64_t elapsed(uint64_t since_us, uint64_t now_us) {
+        return now_us > since_us ? now_us - since_us : 0;
+    }
+
+    // Picks the least recently seen flow in the run of occupied slots at or
+    // after `index`; the table is never empty when this is called.
+    size_t eviction_victim(size_t index) const {
+        while (slots[index].packets == 0) {
+            index = (index + 1) & mask;
+        }
+        size_t victim = index;
+        for (size_t next = (index + 1) & mask; slots[next].packets != 0 && next != index; next = (next + 1) & mask) {
+            if (slots[next].last_us < slots[victim].last_us) {
+                victim = next;
+            }
+        }
+        return victim;
+    }
+
+    void insert(const FlowKey& key, uint32_t bytes, uint64_t now_us) {
+        size_t index = hash(key) & mask;
+        while (slots[index].packets != 0) {
+            index = (index + 1) & mask;
+        }
+        FlowRecord& flow = slots[index];
+        flow.key = key;
+        flow.packets = 1;
+        flow.bytes = bytes;
+        flow.first_us = now_us;
+        flow.last_us = now_us;
+        count++;
+    }
+
+    void remove(size_t index) {
+        export_flow(slots[index]);
+        size_t hole = index;
+        for (size_t next = (hole + 1) & mask; slots[next].packets != 0; next = (next + 1) & mask) {
+            size_t home = hash(slots[next].key) & mask;
+            // Move `next` into the hole unless its home lies cyclically in (hole, next].
+            bool stays = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+            if (!stays) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+        }
+        slots[hole].packets = 0;
+        count--;
+    }
+
+    void export_flow(const FlowRecord& flow) {
+        if (holding && elapsed(start_us, flow.first_us) < idle_timeout_us) {
+            head.push_back(flow);
+            return;
+        }
+        pending.push_back(flow);
+        if (pending.size() == batch_size) {
+            flush_pending();
+        }
+    }
+
+    void flush_pending() {
+        if (!pending.empty()) {
+            exporter.export_batch(pending.data(), pending.size());
+            pending.clear();
+        }
+    }
+
+    std::vector<FlowRecord> slots;
+    std::vector<FlowRecord> pending;
+    size_t mask;
+    size_t count = 0;
+    size_t max_flows;
+    uint64_t idle_timeout_us;
+    uint64_t active_timeout_us;
+    uint64_t last_sweep_us = 0;
+    uint64_t packets_since_sweep = 0;
+    bool holding = false;
+    bool started = false;
+    uint64_t start_us = 0;
+    FlowExporter& exporter;
+};
+
+// A payload signature. A rule fires when its content occurs in a TCP or UDP
+// payload starting at or after `offset` and, when depth is non-zero, ending
+// within the first `depth` bytes; protocol 0 and port 0 match anything, and
+// the port may be either end of the packet. With reassembly on, TCP offsets
+// count from the start of the stream instead of the packet.
+struct SignatureRule {
+    uint32_t id;
+    uint8_t protocol;
+    uint16_t port;
+    uint32_t offset;
+    uint32_t depth;
+    std::string content;
+    std::string message;
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SNIFFER_SHUFTI 1
+#include <immintrin.h>
+
+// Shufti byte-set test on 16 bytes at a time: a byte is a candidate when the
+// bucket bits looked up by its low and high nibble intersect. Returns the
+// first candidate, or the offset where fewer than 16 bytes remain.
+__attribute__((target("ssse3")))
+static size_t shufti_skip(const unsigned char* data, size_t i, size_t n, const uint8_t* low_table, const uint8_t* high_table) {
+    const __m128i low = _mm_loadu_si128((const __m128i*)low_table);
+    const __m128i high = _mm_loadu_si128((const __m128i*)high_table);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i low_bits = _mm_shuffle_epi8(low, _mm_and_si128(bytes, nibble));
+        __m128i high_bits = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+        int misses = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(low_bits, high_bits), zero));
+        if (misses != 0xFFFF) {
+            return i + __builtin_ctz(~misses & 0xFFFF);
+        }
+    }
+    return i;
+}
+#endif
+
+// Aho-Corasick automaton compiled to a dense DFA over byte equivalence
+// classes: bytes that appear in no pattern share one class, which keeps the
+// table to states x (distinct pattern bytes + 1). While the automaton sits
+// in the root state, a first-byte prefilter skips ahead, vectorised with
+// shufti where SSSE3 is available.
+class SignatureEngine {
+public:
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream file(path);
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+        std::string line;
+        int number = 0;
+        while (std::getline(file, line)) {
+            number++;
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == std::string::npos || line[start] == '#') {
+                continue;
+            }
+            SignatureRule rule;
+            std::string problem;
+            if (!parse_rule(line, rule, problem)) {
+                error = path + ":" + std::to_string(number) + ": " +
+                    (problem.empty() ? "expected id proto port offset depth \"content\" message" : problem);
+                return false;
+            }
+            rules.push_back(rule);
+        }
+        return true;
+    }
+
+    void add(const SignatureRule& rule) {
+        rules.push_back(rule);
+    }
+
+    void compile() {
+        bool used[256] = {};
+        for (const SignatureRule& rule : rules) {
+            for (unsigned char c : rule.content) {
+                used[c] = true;
+            }
+            if (!rule.content.empty()) {
+                first_byte[(unsigned char)rule.content[0]] = 1;
+            }
+        }
+        class_count = 1;
+        for (int c = 0; c < 256; ++c) {
+            byte_class[c] = used[c] ? (uint16_t)class_count++ : 0;
+        }
+
+        // Trie, with 0 meaning "no edge" (the root is never a child).
+        transitions.assign(class_count, 0);
+        std::vector<std::vector<uint32_t>> outputs(1);
+        for (uint32_t r = 0; r < rules.size(); ++r) {
+            if (rules[r].content.empty()) {
+                continue;
+            }
+            uint32_t state = 0;
+            for (unsigned char c : rules[r].content) {
+                size_t edge = (size_t)state * class_count + byte_class[c];
+                if (transitions[edge] == 0) {
+                    transitions[edge] = (uint32_t)(transitions.size() / class_count);
+                    transitions.resize(transitions.size() + class_count, 0);
+                    outputs.emplace_back();
+                }
+                state = transitions[edge];
+            }
+            outputs[state].push_back(r);
+        }
+
+        // Breadth-first: fill missing edges from the failure state and
+        // inherit its outputs, so matching never follows failure links.
+        size_t states = transitions.size() / class_count;
+        std::vector<uint32_t> failure(states, 0);
+        std::vector<uint32_t> queue;
+        queue.reserve(states);
+        for (uint32_t c = 0; c < class_count; ++c) {
+            if (transitions[c] != 0) {
+                queue.push_back(transitions[c]);
+            }
+        }
+        for (size_t head = 0; head < queue.size(); ++head) {
+            uint32_t state = queue[head];
+            const std::vector<uint32_t>& inherited = outputs[failure[state]];
+            outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+            for (uint32_t c = 0; c < class_count; ++c) {
+                uint32_t& next = transitions[(size_t)state * class_count + c];
+                uint32_t fallback = transitions[(size_t)failure[state] * class_count + c];
+                if (next != 0) {
+                    failure[next] = fallback;
+                    queue.push_back(next);
+                }
+                else {
+                    next = fallback;
+                }
+            }
+        }
+
+        output_begin.assign(states + 1, 0);
+        output_rules.clear();
+        for (size_t state = 0; state < states; ++state) {
+            output_begin[state] = (uint32_t)output_rules.size();
+            output_rules.insert(output_rules.end(), outputs[state].begin(), outputs[state].end());
+        }
+        output_begin[states] = (uint32_t)output_rules.size();
+
+        // When every rule is depth-limited, stream bytes past the deepest
+        // one can never match.
+        max_depth = 0;
+        for (const SignatureRule& rule : rules) {
+            if (rule.depth == 0) {
+                max_depth = 0;
+                break;
+            }
+            max_depth = std::max<uint64_t>(max_depth, rule.depth);
+        }
+
+#ifdef SNIFFER_SHUFTI
+        // One bucket per high nibble keeps the filter exact for up to eight
+        // distinct high nibbles; beyond that buckets are shared.
+        memset(shufti_low, 0, sizeof(shufti_low));
+        memset(shufti_high, 0, sizeof(shufti_high));
+        for (int c = 0; c < 256; ++c) {
+            if (first_byte[c]) {
+                uint8_t bucket = (uint8_t)(1 << ((c >> 4) & 7));
+                shufti_low[c & 15] |= bucket;
+                shufti_high[c >> 4] |= bucket;
+            }
+        }
+        use_shufti = __builtin_cpu_supports("ssse3");
+#endif
+    }
+
+    size_t rule_count() const {
+        return rules.size();
+    }
+
+    size_t state_count() const {
+        return class_count == 0 ? 0 : transitions.size() / class_count;
+    }
+
+    const SignatureRule& rule(uint32_t index) const {
+        return rules[index];
+    }
+
+    // Calls on_match(rule_index, match_offset) for every rule satisfied by
+    // `payload`; allocates nothing.
+    template <typename OnMatch>
+    void scan(const unsigned char* payload, size_t length, uint8_t protocol, uint16_t src_port,
+        uint16_t dst_port, OnMatch on_match) const {
+        uint32_t state = 0;
+        scan_stream(state, 0, payload, length, protocol, src_port, dst_port, on_match);
+    }
+
+    // Continues a scan across the pieces of a reassembled stream: `state`
+    // carries the automaton from one call to the next and `base` is the
+    // stream offset of payload[0], which offset and depth are checked against.
+    template <typename OnMatch>
+    void scan_stream(uint32_t& state, uint64_t base, const unsigned char* payload, size_t length,
+        uint8_t protocol, uint16_t src_port, uint16_t dst_port, OnMatch on_match) const {
+        if (max_depth != 0 && base >= max_depth) {
+            return;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (state == 0) {
+                i = next_candidate(payload, i, length);
+                if (i == length) {
+                    return;
+                }
+            }
+            state = transitions[(size_t)state * class_count + byte_class[payload[i]]];
+            for (uint32_t o = output_begin[state]; o < output_begin[state + 1]; ++o) {
+                const SignatureRule& rule = rules[output_rules[o]];
+                uint64_t start = base + i + 1 - rule.content.size();
+                if ((rule.protocol == 0 || rule.protocol == protocol) &&
+                    (rule.port == 0 || rule.port == src_port || rule.port == dst_port) &&
+                    start >= rule.offset && (rule.depth == 0 || base + i + 1 <= rule.depth)) {
+                    on_match(output_rules[o], start);
+                }
+            }
+        }
+    }
+
+private:
+    // On a malformed field `problem` says which; otherwise it is left empty.
+    static bool parse_rule(const std::string& line, SignatureRule& rule, std::string& problem) {
+        std::istringstream stream(line);
+        std::string protocol, port;
+        if (!(stream >> rule.id >> protocol >> port >> rule.offset >> rule.depth)) {
+            return false;
+        }
+        if (protocol != "tcp" && protocol != "udp" && protocol != "any") {
+            problem = "unknown protocol \"" + protocol + "\", expected tcp, udp or any";
+            return false;
+        }
+        rule.protocol = protocol == "tcp" ? IPPROTO_TCP : protocol == "udp" ? IPPROTO_UDP : 0;
+        if (port == "any") {
+            rule.port = 0;
+        }
+        else {
+            char* end = nullptr;
+            long value = strtol(port.c_str(), &end, 10);
+            if (port.empty() || *end != '\0' || value < 1 || value > 65535) {
+                problem = "bad port \"" + port + "\", expected 1-65535 or any";
+                return false;
+            }
+            rule.port = (uint16_t)value;
+        }
+
+        // Content between quotes; |41 42| embeds hex bytes, backslash escapes.
+        size_t open_quote = line.find('"');
+        if (open_quote == std::string::npos) {
+            return false;
+        }
+        bool hex = false;
+        size_t i = open_quote + 1;
+        for (; i < line.size() && (hex || line[i] != '"'); ++i) {
+            char c = line[i];
+            if (c == '|') {
+                hex = !hex;
+            }
+            else if (hex) {
+                if (c == ' ' || c == '\t') {
+                    continue;
+                }
+                if (!isxdigit((unsigned char)c) || i + 1 >= line.size() || !isxdigit((unsigned char)line[i + 1])) {
+                    problem = "hex bytes between | | must be pairs of hex digits";
+                    return false;
+                }
+                rule.content += (char)strtol(line.substr(i, 2).c_str(), nullptr, 16);
+                ++i;
+            }
+            else if (c == '\\' && i + 1 < line.size()) {
+                rule.content += line[++i];
+            }
+            else {
+                rule.content += c;
+            }
+        }
+        if (i >= line.size() || rule.content.empty()) {
+            return false;
+        }
+        size_t message = line.find_first_not_of(" \t", i + 1);
+        rule.message = message == std::string::npos ? "" : line.substr(message);
+        return true;
+    }
+
+    size_t next_candidate(const unsigned char* data, size_t i, size_t n) const {
+        for (;;) {
+#ifdef SNIFFER_SHUFTI
+            if (use_shufti) {
+                i = shufti_skip(data, i, n, shufti_low, shufti_high);
+            }
+#endif
+            if (i >= n || first_byte[data[i]]) {
+                return i;
+            }
+#ifdef SNIFFER_SHUFTI
+            if (use_shufti && n - i >= 16) {
+                ++i;
+                continue;
+            }
+#endif
+            while (++i < n) {
+                if (first_byte[data[i]]) {
+                    return i;
+                }
+            }
+            return n;
+        }
+    }
+
+    std::vector<SignatureRule> rules;
+    uint16_t byte_class[256] = {};
+    uint8_t first_byte[256] = {};
+    uint32_t class_count = 0;
+    uint64_t max_depth = 0;
+    std::vector<uint32_t> transitions;
+    std::vector<uint32_t> output_begin;
+    std::vector<uint32_t> output_rules;
+#ifdef SNIFFER_SHUFTI
+    alignas(16) uint8_t shufti_low[16];
+    alignas(16) uint8_t shufti_high[16];
+    bool use_shufti = false;
+#endif
+};
+
+struct Alert {
+    uint32_t rule;
+    uint32_t offset;
+    uint64_t timestamp_us;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;
+    unsigned char src_addr[16];
+    unsigned char dst_addr[16];
+};
+
+// Formats alerts a batch at a time; shared by all capture threads.
+class AlertLog {
+public:
+    explicit AlertLog(const SignatureEngine& engine, FILE* out = stdout) : engine(engine), out(out) {}
+
+    void write(const Alert* alerts, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        text.clear();
+        char line[512];
+        for (size_t i = 0; i < count; ++i) {
+            const Alert& alert = alerts[i];
+            const SignatureRule& rule = engine.rule(alert.rule);
+            char src_ip[INET6_ADDRSTRLEN + 2], dst_ip[INET6_ADDRSTRLEN + 2];
+            format_address(alert.src_addr, src_ip, sizeof(src_ip), true);
+            format_address(alert.dst_addr, dst_ip, sizeof(dst_ip), true);
+            int length = snprintf(line, sizeof(line), "Alert: [%u] %s %s %s:%u -> %s:%u offset %u\n",
+                rule.id, rule.message.c_str(), protocol_name(alert.protocol), src_ip, alert.src_port,
+                dst_ip, alert.dst_port, alert.offset);
+            text.append(line, (size_t)std::min<int>(length, (int)sizeof(line) - 1));
+        }
+        fwrite(text.data(), 1, text.size(), out);
+        fflush(out);
+        total += count;
+    }
+
+    uint64_t total = 0;
+
+private:
+    const SignatureEngine& engine;
+    FILE* out;
+    std::mutex mutex;
+    std::string text;
+};
+
+// TCP stream reassembly. Each direction of a connection is a TcpStream that
+// delivers its bytes in sequence order to a StreamConsumer. In-order data is
+// handed over straight from the packet; only segments that arrive ahead of
+// a hole are copied, into fixed-size chunks from a pool allocated once up
+// front. Stream slots are preallocated too, so memory is bounded by the
+// configured budget and nothing on the packet path allocates. When the pool
+// or the stream table runs out, the least recently used stream gives way.
+const uint32_t NO_INDEX = UINT32_MAX;
+const uint32_t CHUNK_DATA = 2036;
+
+struct SegmentChunk {
+    uint32_t seq;
+    uint32_t next;
+    uint16_t length;
+    unsigned char data[CHUNK_DATA];
+};
+
+// Chunks are handed out from the top of the block until it is used up, so
+// pages the capture never needs are never touched.
+class SegmentPool {
+public:
+    explicit SegmentPool(size_t bytes)
+        : capacity((uint32_t)std::min<size_t>(std::max<size_t>(bytes / sizeof(SegmentChunk), 1), NO_INDEX - 1)),
+        chunks(new SegmentChunk[capacity]) {}
+
+    uint32_t allocate() {
+        uint32_t index = free_head;
+        if (index != NO_INDEX) {
+            free_head = chunks[index].next;
+        }
+        else if (untouched < capacity) {
+            index = untouched++;
+        }
+        else {
+            return NO_INDEX;
+        }
+        in_use++;
+        peak = std::max(peak, in_use);
+        return index;
+    }
+
+    void release(uint32_t index) {
+        chunks[index].next = free_head;
+        free_head = index;
+        in_use--;
+    }
+
+    SegmentChunk& operator[](uint32_t index) {
+        return chunks[index];
+    }
+
+    size_t in_use = 0;
+    size_t peak = 0;
+
+private:
+    uint32_t capacity;
+    std::unique_ptr<SegmentChunk[]> chunks;
+    uint32_t free_head = NO_INDEX;
+    uint32_t untouched = 0;
+};
+
+enum StreamFlags : uint8_t {
+    STREAM_FIN = 1,
+    STREAM_DATA = 2,
+    // Fully delivered up to the FIN; kept until idle so that
+    // retransmissions are not taken for a new stream.
+    STREAM_CLOSED = 4,
+};
+
+struct TcpStream {
+    FlowKey key;
+    uint32_t next_seq;
+    uint32_t fin_seq;
+    uint32_t buffered;
+    uint32_t lru_prev;
+    uint32_t lru_next;
+    uint8_t flags;
+    // Owned by the consumer; reset to zero when the stream starts and
+    // whenever data is skipped over a hole.
+    uint32_t consumer_state;
+    uint64_t delivered;
+    uint64_t last_us;
+};
+
+class StreamConsumer {
+public:
+    virtual ~StreamConsumer() {}
+    // `stream.delivered` is the stream offset of data[0].
+    virtual void on_data(TcpStream& stream, const unsigned char* data, size_t length, uint64_t now_us) = 0;
+};
+
+struct ReassemblyStats {
+    uint64_t streams = 0;
+    uint64_t segments = 0;
+    uint64_t out_of_order = 0;
+    uint64_t delivered_bytes = 0;
+    uint64_t retransmitted_bytes = 0;
+    uint64_t gaps = 0;
+    uint64_t evicted = 0;
+    uint64_t dropped = 0;
+    uint64_t peak_bytes = 0;
+
+    void merge(const ReassemblyStats& other) {
+        streams += other.streams;
+        segments += other.segments;
+        out_of_order += other.out_of_order;
+        delivered_bytes += other.delivered_bytes;
+        retransmitted_bytes += other.retransmitted_bytes;
+        gaps += other.gaps;
+        evicted += other.evicted;
+        dropped += other.dropped;
+        peak_bytes += other.peak_bytes;
+    }
+};
+
+class TcpReassembler {
+public:
+    // An eighth of the budget goes to stream slots and their index, the
+    // rest to out-of-order chunks.
+    TcpReassembler(size_t memory_bytes, uint64_t idle_timeout_us, StreamConsumer& consumer)
+        : pool(memory_bytes / 8 * 7), idle_timeout_us(idle_timeout_us), consumer(consumer) {
+        size_t stream_count = std::max<size_t>(memory_bytes / 8 / (sizeof(TcpStream) + 2 * sizeof(uint32_t)), 16);
+        size_t slot_count = 16;
+        while (slot_count < stream_count * 2) {
+            slot_count <<= 1;
+        }
+        index.assign(slot_count, NO_INDEX);
+        mask = slot_count - 1;
+        streams.resize(stream_count);
+        for (uint32_t i = 0; i < stream_count; ++i) {
+            streams[i].lru_next = i + 1 < stream_count ? i + 1 : NO_INDEX;
+        }
+        free_streams = 0;
+    }
+
+    void segment(const FlowKey& key, uint32_t seq, uint8_t tcp_flags, const unsigned char* payload,
+        uint32_t length, uint64_t now_us) {
+        stats.segments++;
+        while (lru_tail != NO_INDEX && now_us >= streams[lru_tail].last_us + idle_timeout_us) {
+            close(lru_tail);
+        }
+
+        const uint8_t FIN = 0x01, SYN = 0x02, RST = 0x04;
+        uint32_t id = find(key);
+        if (id != NO_INDEX && (streams[id].flags & STREAM_CLOSED) && (tcp_flags & SYN)) {
+            // The port pair is being reused for a new connection.
+            close(id);
+            id = NO_INDEX;
+        }
+        if (id == NO_INDEX) {
+            // Pure ACKs and teardown of unknown streams create no state.
+            if ((tcp_flags & RST) || (length == 0 && !(tcp_flags & SYN))) {
+                return;
+            }
+            id = open(key, (tcp_flags & SYN) ? seq + 1 : seq, now_us);
+        }
+        TcpStream& stream = streams[id];
+        touch(id, now_us);
+
+        if (tcp_flags & RST) {
+            close(id);
+            return;
+        }
+        if (stream.flags & STREAM_CLOSED) {
+            stats.retransmitted_bytes += length;
+            return;
+        }
+        if (tcp_flags & SYN) {
+            // A retransmitted SYN may still move the start before any data.
+            if (!(stream.flags & STREAM_DATA)) {
+                stream.next_seq = seq + 1;
+            }
+            seq++;
+        }
+        if (tcp_flags & FIN) {
+            stream.flags |= STREAM_FIN;
+            stream.fin_seq = seq + length;
+        }
+
+        if (length > 0) {
+            stream.flags |= STREAM_DATA;
+            int32_t ahead = (int32_t)(seq - stream.next_seq);
+            if (ahead <= 0) {
+                deliver_in_order(stream, seq, payload, length, now_us);
+            }
+            else if ((uint32_t)ahead + length > max_window) {
+                stats.dropped++;
+            }
+            else {
+                stats.out_of_order++;
+                buffer(id, seq, payload, length);
+            }
+        }
+
+        if ((stream.flags & STREAM_FIN) && stream.next_seq == stream.fin_seq && stream.buffered == NO_INDEX) {
+            stream.flags |= STREAM_CLOSED;
+        }
+    }
+
+    // Delivers what every open stream has buffered, skipping holes.
+    void flush() {
+        while (lru_tail != NO_INDEX) {
+            close(lru_tail);
+        }
+        stats.peak_bytes = pool.peak * sizeof(SegmentChunk);
+    }
+
+    ReassemblyStats stats;
+
+private:
+    static const uint32_t max_window = 1 << 20;
+    static const int eviction_search = 32;
+
+    uint32_t find(const FlowKey& key) const {
+        for (size_t slot = hash_flow_key(key) & mask; index[slot] != NO_INDEX; slot = (slot + 1) & mask) {
+            if (streams[index[slot]].key == key) {
+                return index[slot];
+            }
+        }
+        return NO_INDEX;
+    }
+
+    uint32_t open(const FlowKey& key, uint32_t next_seq, uint64_t now_us) {
+        if (free_streams == NO_INDEX) {
+            if (!(streams[lru_tail].flags & STREAM_CLOSED)) {
+                stats.evicted++;
+            }
+            close(lru_tail);
+        }
+        uint32_t id = free_streams;
+        TcpStream& stream = streams[id];
+        free_streams = stream.lru_next;
+        stream.key = key;
+        stream.next_seq = next_seq;
+        stream.fin_seq = 0;
+        stream.buffered = NO_INDEX;
+        stream.flags = 0;
+        stream.consumer_state = 0;
+        stream.delivered = 0;
+        stream.last_us = now_us;
+        stream.lru_prev = NO_INDEX;
+        stream.lru_next = lru_head;
+        if (lru_head != NO_INDEX) {
+            streams[lru_head].lru_prev = id;
+        }
+        lru_head = id;
+        if (lru_tail == NO_INDEX) {
+            lru_tail = id;
+        }
+
+        size_t slot = hash_flow_key(key) & mask;
+        while (index[slot] != NO_INDEX) {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = id;
+        stats.streams++;
+        return id;
+    }
+
+    void unlink(uint32_t id) {
+        TcpStream& stream = streams[id];
+        if (stream.lru_prev != NO_INDEX) {
+            streams[stream.lru_prev].lru_next = stream.lru_next;
+        }
+        else {
+            lru_head = stream.lru_next;
+        }
+        if (stream.lru_next != NO_INDEX) {
+            streams[stream.lru_next].lru_prev = stream.lru_prev;
+        }
+        else {
+            lru_tail = stream.lru_prev;
+        }
+    }
+
+    void touch(uint32_t id, uint64_t now_us) {
+        streams[id].last_us = now_us;
+        if (lru_head == id) {
+            return;
+        }
+        unlink(id);
+        streams[id].lru_prev = NO_INDEX;
+        streams[id].lru_next = lru_head;
+        streams[lru_head].lru_prev = id;
+        lru_head = id;
+    }
+
+    // Hands over what is buffered past any holes, then frees the slot.
+    void close(uint32_t id) {
+        TcpStream& stream = streams[id];
+        while (stream.buffered != NO_INDEX) {
+            skip_gap(stream);
+            drain(stream, stream.last_us);
+        }
+        unlink(id);
+
+        size_t slot = hash_flow_key(stream.key) & mask;
+        while (index[slot] != id) {
+            slot = (slot + 1) & mask;
+        }
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & mask; index[next] != NO_INDEX; next = (next + 1) & mask) {
+            size_t home = hash_flow_key(streams[index[next]].key) & mask;
+            bool stays = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+            if (!stays) {
+                index[hole] = index[next];
+                hole = next;
+            }
+        }
+        index[hole] = NO_INDEX;
+        stream.lru_next = free_streams;
+        free_streams = id;
+    }
+
+    void deliver(TcpStream& stream, const unsigned char* data, uint32_t length, uint64_t now_us) {
+        consumer.on_data(stream, data, length, now_us);
+        stream.next_seq += length;
+        stream.delivered += length;
+        stats.delivered_bytes += length;
+    }
+
+    // Delivers a segment starting at or before next_seq. Where it overlaps
+    // buffered chunks the buffered bytes win, as they do in buffer(), so
+    // the segment is cut at each chunk and the chunk delivered in between.
+    void deliver_in_order(TcpStream& stream, uint32_t seq, const unsigned char* data, uint32_t length,
+        uint64_t now_us) {
+        for (;;) {
+            uint32_t seen = std::min<uint32_t>(stream.next_seq - seq, length);
+            stats.retransmitted_bytes += seen;
+            seq += seen;
+            data += seen;
+            length -= seen;
+            if (length == 0) {
+                break;
+            }
+            uint32_t piece = length;
+            if (stream.buffered != NO_INDEX) {
+                piece = std::min(piece, pool[stream.buffered].seq - stream.next_seq);
+            }
+            deliver(stream, data, piece, now_us);
+            seq += piece;
+            data += piece;
+            length -= piece;
+            drain(stream, now_us);
+        }
+        drain(stream, now_us);
+    }
+
+    // Delivers buffered chunks that have become contiguous.
+    void drain(TcpStream& stream, uint64_t now_us) {
+        while (stream.buffered != NO_INDEX) {
+            SegmentChunk& chunk = pool[stream.buffered];
+            int32_t ahead = (int32_t)(chunk.seq - stream.next_seq);
+            if (ahead > 0) {
+                return;
+            }
+            uint32_t seen = (uint32_t)-ahead;
+            if (seen < chunk.length) {
+                deliver(stream, chunk.data + seen, chunk.length - seen, now_us);
+            }
+            uint32_t next = chunk.next;
+            pool.release(stream.buffered);
+            stream.buffered = next;
+        }
+    }
+
+    void skip_gap(TcpStream& stream) {
+        uint32_t missing = pool[stream.buffered].seq - stream.next_seq;
+        stream.next_seq += missing;
+        stream.delivered += missing;
+        stream.consumer_state = 0;
+        stats.gaps++;
+    }
+
+    // Copies [seq, seq + length) into the stream's sorted chunk list,
+    // keeping the bytes already buffered wherever the two overlap.
+    void buffer(uint32_t id, uint32_t seq, const unsigned char* data, uint32_t length) {
+        TcpStream& stream = streams[id];
+        uint32_t* link = &stream.buffered;
+        while (length > 0) {
+            // Making room can skip this stream past a hole and up to the data.
+            if ((int32_t)(seq - stream.next_seq) <= 0) {
+                deliver_in_order(stream, seq, data, length, stream.last_us);
+                return;
+            }
+
+            uint32_t piece = std::min(length, CHUNK_DATA);
+            if (*link != NO_INDEX) {
+                SegmentChunk& chunk = pool[*link];
+                int32_t before = (int32_t)(chunk.seq - seq);
+                if (before <= 0) {
+                    int64_t overlap = (int64_t)chunk.length + before;
+                    if (overlap > 0) {
+                        uint32_t covered = (uint32_t)std::min<int64_t>(overlap, length);
+                        stats.retransmitted_bytes += covered;
+                        seq += covered;
+                        data += covered;
+                        length -= covered;
+                    }
+                    link = &chunk.next;
+                    continue;
+                }
+                piece = std::min(piece, (uint32_t)before);
+            }
+
+            uint32_t fresh = pool.allocate();
+            if (fresh == NO_INDEX) {
+                if (!make_room(id)) {
+                    stats.dropped++;
+                    return;
+                }
+                link = &stream.buffered;
+                continue;
+            }
+            SegmentChunk& chunk = pool[fresh];
+            chunk.seq = seq;
+            chunk.length = (uint16_t)piece;
+            memcpy(chunk.data, data, piece);
+            chunk.next = *link;
+            *link = fresh;
+            link = &chunk.next;
+            seq += piece;
+            data += piece;
+            length -= piece;
+        }
+    }
+
+    // Out of chunks: evict the least recently used stream that holds any,
+    // or, failing that, stop waiting for this stream's oldest hole.
+    bool make_room(uint32_t id) {
+        uint32_t victim = lru_tail;
+        for (int i = 0; i < eviction_search && victim != NO_INDEX; ++i, victim = streams[victim].lru_prev) {
+            if (victim != id && streams[victim].buffered != NO_INDEX) {
+                stats.evicted++;
+                close(victim);
+                return true;
+            }
+        }
+        TcpStream& stream = streams[id];
+        if (stream.buffered == NO_INDEX) {
+            return false;
+        }
+        skip_gap(stream);
+        drain(stream, stream.last_us);
+        return true;
+    }
+
+    SegmentPool pool;
+    std::vector<TcpStream> streams;
+    std::vector<uint32_t> index;
+    size_t mask;
+    uint32_t free_streams;
+    uint32_t lru_head = NO_INDEX;
+    uint32_t lru_tail = NO_INDEX;
+    uint64_t idle_timeout_us;
+    StreamConsumer& consumer;
+};
+
+// Passed to packet_handler through pcap's user pointer. Each capture or
+// file-reading thread owns one, so the handler never shares state. Readers
+// that own their buffers queue views here and decode them a batch at a time.
+struct CaptureContext {
+    PacketStats stats;
+    std::unique_ptr<FlowTable> flows;
+    bool print = false;
+    PacketView pending[DECODE_BATCH];
+    size_t pending_count = 0;
+    DecodedBatch decoded;
+
+    // Signature matching; rule_seen holds the last packet number each rule
+    // fired on so a rule alerts at most once per packet.
+    const SignatureEngine* signatures = nullptr;
+    AlertLog* alert_log = nullptr;
+    std::vector<Alert> alerts;
+    std::vector<uint64_t> rule_seen;
+    uint64_t scan_number = 0;
+
+    std::unique_ptr<TcpReassembler> streams;
+    std::unique_ptr<StreamConsumer> stream_consumer;
+
+    void enable_signatures(const SignatureEngine& engine, AlertLog& log) {
+        signatures = &engine;
+        alert_log = &log;
+        alerts.reserve(DECODE_BATCH);
+        rule_seen.assign(engine.rule_count(), UINT64_MAX);
+    }
+};
+
+static void print_packet(const PacketView& view, const DecodedBatch& batch, size_t i) {
+    uint8_t flags = batch.flags[i];
+    if (flags & DECODED_ARP) {
+        std::cout << "ARP packet detected" << std::endl;
+        return;
+    }
+    if (!(flags & (DECODED_IPV4 | DECODED_IPV6))) {
+        return;
+    }
+
+    char src_ip[INET6_ADDRSTRLEN], dst_ip[INET6_ADDRSTRLEN];
+    format_address(batch.src_addr[i], src_ip, sizeof(src_ip), false);
+    format_address(batch.dst_addr[i], dst_ip, sizeof(dst_ip), false);
+    std::cout << (flags & DECODED_IPV6 ? "IPv6 Packet: " : "IP Packet: ") << src_ip << " -> " << dst_ip;
+    if (flags & DECODED_VLAN) {
+        std::cout << " VLAN " << batch.vlan_id[i];
+    }
+    std::cout << " Protocol: ";
+
+    switch (batch.protocol[i]) {
+    case IPPROTO_TCP:
+    case IPPROTO_UDP:
+        std::cout << protocol_name(batch.protocol[i]) << " Ports: " << batch.src_port[i] << " -> " << batch.dst_port[i];
+        break;
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+        std::cout << protocol_name(batch.protocol[i]);
+        break;
+    default:
+        std::cout << "Other";
+    }
+    if (flags & DECODED_FRAGMENT) {
+        std::cout << " (fragment)";
+    }
+    std::cout << " " << view.len << " bytes" << std::endl;
+}
+
+static void flush_alerts(CaptureContext* context) {
+    if (!context->alerts.empty()) {
+        context->alert_log->write(context->alerts.data(), context->alerts.size());
+        context->alerts.clear();
+    }
+}
+
+static void push_alert(CaptureContext* context, const Alert& alert) {
+    if (context->alerts.size() == context->alerts.capacity()) {
+        flush_alerts(context);
+    }
+    context->alerts.push_back(alert);
+}
+
+// Each scan call is numbered so a rule alerts at most once per packet, or
+// per delivered piece of a stream.
+static void scan_payloads(CaptureContext* context, const PacketView* views, const DecodedBatch& batch) {
+    for (size_t i = 0; i < batch.count; ++i) {
+        if (!(batch.flags[i] & DECODED_L4) || batch.payload_length[i] == 0 ||
+            (batch.protocol[i] != IPPROTO_TCP && batch.protocol[i] != IPPROTO_UDP) ||
+            (batch.protocol[i] == IPPROTO_TCP && context->streams)) {
+            continue;
+        }
+        uint64_t scan_number = ++context->scan_number;
+        context->signatures->scan(views[i].data + batch.payload_offset[i], batch.payload_length[i],
+            batch.protocol[i], batch.src_port[i], batch.dst_port[i], [&](uint32_t rule, size_t offset) {
+                if (context->rule_seen[rule] == scan_number) {
+                    return;
+                }
+                context->rule_seen[rule] = scan_number;
+                Alert alert;
+                alert.rule = rule;
+                alert.offset = (uint32_t)offset;
+                alert.timestamp_us = batch.timestamp_us[i];
+                alert.src_port = batch.src_port[i];
+                alert.dst_port = batch.dst_port[i];
+                alert.protocol = batch.protocol[i];
+                memcpy(alert.src_addr, batch.src_addr[i], 16);
+                memcpy(alert.dst_addr, batch.dst_addr[i], 16);
+                push_alert(context, alert);
+            });
+    }
+}
+
+// Runs reassembled TCP data through the signature engine, carrying the
+// automaton across segments so content split between packets still matches.
+class StreamScanner : public StreamConsumer {
+public:
+    explicit StreamScanner(CaptureContext* context) : context(context) {}
+
+    void on_data(TcpStream& stream, const unsigned char* data, size_t length, uint64_t now_us) override {
+        if (!context->signatures) {
+            return;
+        }
+        uint64_t scan_number = ++context->scan_number;
+        context->signatures->scan_stream(stream.consumer_state, stream.delivered, data, length, IPPROTO_TCP,
+            stream.key.src_port, stream.key.dst_port, [&](uint32_t rule, size_t offset) {
+                if (context->rule_seen[rule] == scan_number) {
+                    return;
+                }
+                context->rule_seen[rule] = scan_number;
+                Alert alert;
+                alert.rule = rule;
+                alert.offset = (uint32_t)offset;
+                alert.timestamp_us = now_us;
+                alert.src_port = stream.key.src_port;
+                alert.dst_port = stream.key.dst_port;
+                alert.protocol = IPPROTO_TCP;
+                memcpy(alert.src_addr, stream.key.src_addr, 16);
+                memcpy(alert.dst_addr, stream.key.dst_addr, 16);
+                push_alert(context, alert);
+            });
+    }
+
+private:
+    CaptureContext* context;
+};
+
+static void reassemble(CaptureContext* context, const PacketView* views, const DecodedBatch& batch) {
+    for (size_t i = 0; i < batch.count; ++i) {
+        if (!(batch.flags[i] & DECODED_L4) || batch.protocol[i] != IPPROTO_TCP) {
+            continue;
+        }
+        FlowKey key = {};
+        memcpy(key.src_addr, batch.src_addr[i], 16);
+        memcpy(key.dst_addr, batch.dst_addr[i], 16);
+        key.src_port = batch.src_port[i];
+        key.dst_port = batch.dst_port[i];
+        key.protocol = IPPROTO_TCP;
+        context->streams->segment(key, batch.tcp_seq[i], batch.tcp_flags[i], views[i].data + batch.payload_offset[i],
+            batch.payload_length[i], batch.timestamp_us[i]);
+    }
+}
+
+// The stages of process_batch, kept separate so they can be timed apart.
+static void count_packets(PacketStats& stats, const DecodedBatch& batch) {
+    for (size_t i = 0; i < batch.count; ++i) {
+        uint8_t flags = batch.flags[i];
+        stats.packets++;
+        stats.bytes += batch.wire_length[i];
+        stats.ipv4 += (flags & DECODED_IPV4) != 0;
+        stats.ipv6 += (flags & DECODED_IPV6) != 0;
+        stats.arp += (flags & DECODED_ARP) != 0;
+        stats.vlan += (flags & DECODED_VLAN) != 0;
+        stats.fragments += (flags & DECODED_FRAGMENT) != 0;
+        stats.truncated += (flags & DECODED_TRUNCATED) != 0;
+        if (!(flags & (DECODED_IPV4 | DECODED_IPV6))) {
+            stats.other += !(flags & DECODED_ARP);
+            continue;
+        }
+        uint8_t protocol = batch.protocol[i];
+        stats.tcp += protocol == IPPROTO_TCP;
+        stats.udp += protocol == IPPROTO_UDP;
+        stats.icmp += protocol == IPPROTO_ICMP || protocol == IPPROTO_ICMPV6;
+        stats.other += protocol != IPPROTO_TCP && protocol != IPPROTO_UDP &&
+            protocol != IPPROTO_ICMP && protocol != IPPROTO_ICMPV6;
+    }
+}
+
+static void update_flows(FlowTable& flows, const DecodedBatch& batch) {
+    for (size_t i = 0; i < batch.count; ++i) {
+        if (!(batch.flags[i] & (DECODED_IPV4 | DECODED_IPV6))) {
+            continue;
+        }
+        FlowKey key = {};
+        memcpy(key.src_addr, batch.src_addr[i], 16);
+        memcpy(key.dst_addr, batch.dst_addr[i], 16);
+        key.src_port = batch.src_port[i];
+        key.dst_port = batch.dst_port[i];
+        key.protocol = batch.protocol[i];
+        flows.update(key, batch.wire_length[i], batch.timestamp_us[i]);
+    }
+}
+
+static void print_batch(const PacketView* views, const DecodedBatch& batch) {
+    for (size_t i = 0; i < batch.count; ++i) {
+        print_packet(views[i], batch, i);
+    }
+}
+
+void process_batch(CaptureContext* context, const PacketView* views, size_t count) {
+    DecodedBatch& batch = context->decoded;
+    decode_batch(views, count, batch);
+    count_packets(context->stats, batch);
+    if (context->print) {
+        print_batch(views, batch);
+    }
+    if (context->flows) {
+        update_flows(*context->flows, batch);
+    }
+    if (context->streams) {
+        reassemble(context, views, batch);
+    }
+    if (context->signatures) {
+        scan_payloads(context, views, batch);
+        flush_alerts(context);
+    }
+}
+
+static void queue_packet(CaptureContext* context, const PacketView& view) {
+    context->pending[context->pending_count++] = view;
+    if (context->pending_count == DECODE_BATCH) {
+        process_batch(context, context->pending, context->pending_count);
+        context->pending_count = 0;
+    }
+}
+
+// Must run before the buffers behind queued views are released.
+static void flush_packets(CaptureContext* context) {
+    if (context->pending_count > 0) {
+        process_batch(context, context->pending, context->pending_count);
+        context->pending_count = 0;
+    }
+}
+
+// pcap only guarantees pkt_data for the duration of the callback, so live
+// pcap capture decodes a batch of one.
+void packet_handler(u_char* param, const struct pcap_pkthdr* header, const u_char* pkt_data) {
+    PacketView view;
+    view.data = pkt_data;
+    view.caplen = header->caplen;
+    view.len = header->len;
+    view.timestamp_us = (uint64_t)header->ts.tv_sec * 1000000 + header->ts.tv_usec;
+    process_batch((CaptureContext*)param, &view, 1);
+}
+
+// Read-only view of a whole capture file. Records are decoded straight out
+// of the mapping.
+class MappedFile {
+public:
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != NULL) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+#else
+        if (data != nullptr) {
+            munmap((void*)data, size);
+        }
+#endif
+    }
+
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER file_size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+            return false;
+        }
+        size = (size_t)file_size.QuadPart;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            return false;
+        }
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        return data != nullptr;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size = (size_t)info.st_size;
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        madvise(mapped, size, MADV_WILLNEED);
+        data = (const unsigned char*)mapped;
+        return true;
+#endif
+    }
+
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+const uint32_t LINKTYPE_ETHERNET = 1;
+const uint32_t PCAPNG_SECTION_HEADER = 0x0A0D0D0A;
+const uint32_t PCAPNG_INTERFACE_DESCRIPTION = 1;
+const uint32_t PCAPNG_SIMPLE_PACKET = 3;
+const uint32_t PCAPNG_ENHANCED_PACKET = 6;
+
+static uint32_t read_u32(const unsigned char* p, bool swapped) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    if (swapped) {
+        value = (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+    }
+    return value;
+}
+
+static uint16_t read_u16(const unsigned char* p, bool swapped) {
+    uint16_t value;
+    memcpy(&value, p, 2);
+    return swapped ? (uint16_t)((value >> 8) | (value << 8)) : value;
+}
+
+struct PcapngInterface {
+    uint32_t linktype;
+    uint64_t ticks_per_second;
+};
+
+// Everything needed to interpret records from some offset onwards: the
+// classic pcap global header, or the current pcapng section's byte order
+// and interface table.
+struct CaptureFormat {
+    bool pcapng = false;
+    bool swapped = false;
+    bool nanosecond = false;
+    uint32_t snaplen = 0;
+    uint32_t linktype = 0;
+    size_t first_record = 0;
+    std::vector<PcapngInterface> interfaces;
+};
+
+static void deliver(CaptureContext* context, uint64_t seconds, uint32_t microseconds,
+    uint32_t caplen, uint32_t len, const unsigned char* packet) {
+    PacketView view;
+    view.data = packet;
+    view.caplen = caplen;
+    view.len = len;
+    view.timestamp_us = seconds * 1000000 + microseconds;
+    queue_packet(context, view);
+}
+
+static void deliver(std::vector<PacketView>* views, uint64_t seconds, uint32_t microseconds,
+    uint32_t caplen, uint32_t len, const unsigned char* packet) {
+    PacketView view;
+    view.data = packet;
+    view.caplen = caplen;
+    view.len = len;
+    view.timestamp_us = seconds * 1000000 + microseconds;
+    views->push_back(view);
+}
+
+// Applies a pcapng section header or interface description to `format`.
+static void apply_pcapng_block(const unsigned char* block, uint32_t type, uint32_t length, CaptureFormat& format) {
+    if (type == PCAPNG_SECTION_HEADER) {
+        uint32_t magic;
+        memcpy(&magic, block + 8, 4);
+        format.swapped = magic != 0x1A2B3C4D;
+        format.interfaces.clear();
+        return;
+    }
+
+    PcapngInterface iface;
+    iface.linktype = read_u16(block + 8, format.swapped);
+    iface.ticks_per_second = 1000000;
+    // Options: if_tsresol (code 9) changes the timestamp unit.
+    size_t offset = 16;
+    while (offset + 4 <= length - 4) {
+        uint16_t code = read_u16(block + offset, format.swapped);
+        uint16_t option_length = read_u16(block + offset + 2, format.swapped);
+        if (code == 0 || offset + 4 + option_length > length - 4) {
+            break;
+        }
+        if (code == 9 && option_length >= 1) {
+            uint8_t resolution = block[offset + 4];
+            uint64_t base = resolution & 0x80 ? 2 : 10;
+            iface.ticks_per_second = 1;
+            for (int i = 0; i < (resolution & 0x7F) && iface.ticks_per_second < (1ull << 60) / base; ++i) {
+                iface.ticks_per_second *= base;
+            }
+        }
+        offset += 4 + ((option_length + 3u) & ~3u);
+    }
+    format.interfaces.push_back(iface);
+}
+
+static bool read_capture_header(const MappedFile& file, CaptureFormat& format) {
+    if (file.size < 24) {
+        return false;
+    }
+    uint32_t magic;
+    memcpy(&magic, file.data, 4);
+
+    if (magic == PCAPNG_SECTION_HEADER) {
+        format.pcapng = true;
+        format.first_record = 0;
+        // Learn the interfaces declared ahead of the first packet so that
+        // parallel workers starting mid-file can interpret their records.
+        size_t offset = 0;
+        while (offset + 12 <= file.size) {
+            const unsigned char* block = file.data + offset;
+            uint32_t type = read_u32(block, format.swapped);
+            if (type == PCAPNG_SECTION_HEADER) {
+                uint32_t order;
+                memcpy(&order, block + 8, 4);
+                format.swapped = order != 0x1A2B3C4D;
+            }
+            uint32_t length = read_u32(block + 4, format.swapped);
+            if (length < 12 || length % 4 != 0 || offset + length > file.size) {
+                return offset > 0;
+            }
+            if (type != PCAPNG_SECTION_HEADER && type != PCAPNG_INTERFACE_DESCRIPTION) {
+                return true;
+            }
+            apply_pcapng_block(block, type, length, format);
+            offset += length;
+        }
+        return true;
+    }
+
+    if (magic == 0xA1B2C3D4 || magic == 0xA1B23C4D) {
+        format.swapped = false;
+    }
+    else if (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1) {
+        format.swapped = true;
+    }
+    else {
+        return false;
+    }
+    format.nanosecond = read_u32(file.data, format.swapped) == 0xA1B23C4D;
+    format.snaplen = read_u32(file.data + 16, format.swapped);
+    format.linktype = read_u32(file.data + 20, format.swapped) & 0xFFFF;
+    format.first_record = 24;
+    return true;
+}
+
+// Walks the records that start in [begin, end). `end` is a record boundary
+// or the end of the file; a truncated final record is ignored.
+template <typename Target>
+static void walk_pcap(const MappedFile& file, size_t begin, size_t end, const CaptureFormat& format,
+    Target* context) {
+    while (begin + 16 <= end) {
+        const unsigned char* record = file.data + begin;
+        uint32_t caplen = read_u32(record + 8, format.swapped);
+        if (caplen > file.size - begin - 16) {
+            break;
+        }
+        if (format.linktype == LINKTYPE_ETHERNET) {
+            uint32_t fraction = read_u32(record + 4, format.swapped);
+            deliver(context, read_u32(record, format.swapped), format.nanosecond ? fraction / 1000 : fraction,
+                caplen, read_u32(record + 12, format.swapped), record + 16);
+        }
+        begin += 16 + (size_t)caplen;
+    }
+}
+
+template <typename Target>
+static void walk_pcapng(const MappedFile& file, size_t begin, size_t end, CaptureFormat& format,
+    Target* context) {
+    while (begin + 12 <= end) {
+        const unsigned char* block = file.data + begin;
+        uint32_t type = read_u32(block, format.swapped);
+        if (type == PCAPNG_SECTION_HEADER) {
+            apply_pcapng_block(block, type, 28, format);
+        }
+        uint32_t length = read_u32(block + 4, format.swapped);
+        if (length < 12 || length % 4 != 0 || length > file.size - begin) {
+            break;
+        }
+
+        if (type == PCAPNG_INTERFACE_DESCRIPTION && length >= 20) {
+            apply_pcapng_block(block, type, length, format);
+        }
+        else if (type == PCAPNG_ENHANCED_PACKET && length >= 32) {
+            uint32_t interface_id = read_u32(block + 8, format.swapped);
+            uint32_t caplen = read_u32(block + 20, format.swapped);
+            if (interface_id < format.interfaces.size() && caplen <= length - 32 &&
+                format.interfaces[interface_id].linktype == LINKTYPE_ETHERNET) {
+                uint64_t ticks = ((uint64_t)read_u32(block + 12, format.swapped) << 32) |
+                    read_u32(block + 16, format.swapped);
+                uint64_t per_second = format.interfaces[interface_id].ticks_per_second;
+                deliver(context, ticks / per_second, (uint32_t)((ticks % per_second) * 1000000 / per_second),
+                    caplen, read_u32(block + 24, format.swapped), block + 28);
+            }
+        }
+        else if (type == PCAPNG_SIMPLE_PACKET && length >= 16) {
+            uint32_t len = read_u32(block + 8, format.swapped);
+            uint32_t caplen = std::min(len, length - 16);
+            if (!format.interfaces.empty() && format.interfaces[0].linktype == LINKTYPE_ETHERNET) {
+                deliver(context, 0, 0, caplen, len, block + 12);
+            }
+        }
+        begin += length;
+    }
+}
+
+// Record boundaries are not marked in a capture file, so a split point is
+// found by scanning forward for an offset where a run of consecutive
+// headers all check out: plausible lengths and timestamps for pcap, a
+// matching trailing length copy for pcapng.
+static bool plausible_pcap_chain(const MappedFile& file, size_t offset, const CaptureFormat& format) {
+    uint32_t snaplen = format.snaplen != 0 ? format.snaplen : 262144;
+    uint32_t fraction_limit = format.nanosecond ? 1000000000u : 1000000u;
+    uint32_t previous_seconds = 0;
+    for (int i = 0; i < 8; ++i) {
+        if (offset == file.size) {
+            return i > 0;
+        }
+        if (offset + 16 > file.size) {
+            return false;
+        }
+        const unsigned char* record = file.data + offset;
+        uint32_t seconds = read_u32(record, format.swapped);
+        uint32_t caplen = read_u32(record + 8, format.swapped);
+        uint32_t len = read_u32(record + 12, format.swapped);
+        if (read_u32(record + 4, format.swapped) >= fraction_limit || caplen > snaplen || caplen > len ||
+            len > 262144 || caplen > file.size - offset - 16 ||
+            (i > 0 && (seconds < previous_seconds || seconds - previous_seconds > 86400))) {
+            return false;
+        }
+        previous_seconds = seconds;
+        offset += 16 + (size_t)caplen;
+    }
+    return true;
+}
+
+static bool plausible_pcapng_chain(const MappedFile& file, size_t offset, const CaptureFormat& format) {
+    for (int i = 0; i < 4; ++i) {
+        if (offset == file.size) {
+            return i > 0;
+        }
+        if (offset + 12 > file.size) {
+            return false;
+        }
+        uint32_t length = read_u32(file.data + offset + 4, format.swapped);
+        if (length < 12 || length % 4 != 0 || length > file.size - offset ||
+            read_u32(file.data + offset + length - 4, format.swapped) != length) {
+            return false;
+        }
+        offset += length;
+    }
+    return true;
+}
+
+static size_t find_record_boundary(const MappedFile& file, size_t from, const CaptureFormat& format) {
+    if (format.pcapng) {
+        for (size_t offset = from & ~(size_t)3; offset < file.size; offset += 4) {
+            if (plausible_pcapng_chain(file, offset, format)) {
+                return offset;
+            }
+        }
+        return file.size;
+    }
+    for (size_t offset = from; offset < file.size; ++offset) {
+        if (plausible_pcap_chain(file, offset, format)) {
+            return offset;
+        }
+    }
+    return file.size;
+}
+
+static void print_stats(const PacketStats& stats, double elapsed) {
+    std::cout << stats.packets << " packets, " << stats.bytes << " bytes: " << stats.ipv4 << " IPv4, "
+        << stats.ipv6 << " IPv6 (" << stats.tcp << " TCP, " << stats.udp << " UDP, " << stats.icmp << " ICMP), "
+        << stats.arp << " ARP, " << stats.other << " other; " << stats.vlan << " VLAN-tagged, "
+        << stats.fragments << " fragments, " << stats.truncated << " truncated" << std::endl;
+    if (elapsed > 0) {
+        std::cout << "Processed in " << elapsed << " s (" << stats.packets / elapsed / 1e6 << " Mpps)" << std::endl;
+    }
+}
+
+// Writes classic pcap with microsecond timestamps in host byte order.
+class PcapWriter {
+public:
+    ~PcapWriter() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        out = fopen(path.c_str(), "wb");
+        if (out == nullptr) {
+            return false;
+        }
+        setvbuf(out, nullptr, _IOFBF, 1 << 20);
+        const uint32_t header[6] = { 0xA1B2C3D4, 0x00040002, 0, 0, 65535, LINKTYPE_ETHERNET };
+        return fwrite(header, sizeof(header), 1, out) == 1;
+    }
+
+    bool write(uint64_t timestamp_us, const unsigned char* frame, uint32_t length) {
+        const uint32_t record[4] = { (uint32_t)(timestamp_us / 1000000), (uint32_t)(timestamp_us % 1000000),
+            length, length };
+        return fwrite(record, sizeof(record), 1, out) == 1 && fwrite(frame, 1, length, out) == length;
+    }
+
+    bool close() {
+        bool ok = true;
+        if (out != nullptr) {
+            ok = fclose(out) == 0;
+            out = nullptr;
+        }
+        return ok;
+    }
+
+private:
+    FILE* out = nullptr;
+};
+
+static bool open_capture(const std::string& path, MappedFile& file, CaptureFormat& format) {
+    if (!file.open(path)) {
+        std::cerr << "Error opening capture file " << path << std::endl;
+        return false;
+    }
+    if (!read_capture_header(file, format)) {
+        std::cerr << "Not a pcap or pcapng file: " << path << std::endl;
+        return false;
+    }
+    if (!format.pcapng && format.linktype != LINKTYPE_ETHERNET) {
+        std::cerr << "Unsupported link type " << format.linktype << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Lists every Ethernet frame in a capture; the views point into `file`.
+static bool load_packets(const std::string& path, MappedFile& file, std::vector<PacketView>& views) {
+    CaptureFormat format;
+    if (!open_capture(path, file, format)) {
+        return false;
+    }
+    if (format.pcapng) {
+        walk_pcapng(file, format.first_record, file.size, format, &views);
+    }
+    else {
+        walk_pcap(file, format.first_record, file.size, format, &views);
+    }
+    return true;
+}
+
+struct AnalysisSettings {
+    size_t capacity = 1 << 18;
+    uint64_t idle_timeout_us = 15 * 1000000ull;
+    uint64_t active_timeout_us = 1800 * 1000000ull;
+    // Shared by all threads; zero leaves TCP reassembly off.
+    size_t reassembly_bytes = 0;
+    uint64_t stream_timeout_us = 120 * 1000000ull;
+};
+
+static void configure_context(CaptureContext& context, const AnalysisSettings& settings, int threads, bool print,
+    FlowExporter& exporter, const SignatureEngine* signatures, AlertLog* alert_log) {
+    context.print = print;
+    context.flows.reset(new FlowTable(settings.capacity, settings.idle_timeout_us,
+        settings.active_timeout_us, exporter));
+    if (signatures) {
+        context.enable_signatures(*signatures, *alert_log);
+    }
+    if (settings.reassembly_bytes > 0) {
+        context.stream_consumer.reset(new StreamScanner(&context));
+        context.streams.reset(new TcpReassembler(settings.reassembly_bytes / threads, settings.stream_timeout_us,
+            *context.stream_consumer));
+    }
+}
+
+// Flushes everything a context still holds once its input has ended.
+static void finish_context(CaptureContext& context) {
+    flush_packets(&context);
+    if (context.streams) {
+        context.streams->flush();
+    }
+    if (context.signatures) {
+        flush_alerts(&context);
+    }
+    context.flows->flush();
+}
+
+static void print_analysis(const std::vector<CaptureContext>& contexts, const AlertLog* alert_log) {
+    if (contexts[0].streams) {
+        ReassemblyStats total;
+        for (const CaptureContext& context : contexts) {
+            total.merge(context.streams->stats);
+        }
+        std::cout << "Reassembled " << total.streams << " TCP streams: " << total.delivered_bytes << " bytes delivered, "
+            << total.out_of_order << " segments out of order, " << total.retransmitted_bytes << " bytes retransmitted, "
+            << total.gaps << " gaps skipped, " << total.evicted << " streams evicted, " << total.dropped
+            << " segments dropped, " << total.peak_bytes / 1e6 << " MB peak buffer" << std::endl;
+    }
+    if (alert_log) {
+        std::cout << alert_log->total << " signature alerts" << std::endl;
+    }
+}
+
+// Orders held flows by key, and the pieces of one key by start time.
+static bool flow_before(const FlowRecord& a, const FlowRecord& b) {
+    int order = memcmp(&a.key, &b.key, sizeof(FlowKey));
+    return order != 0 ? order < 0 : a.first_us < b.first_us;
+}
+
+// The earliest held piece of `key`, or null.
+static FlowRecord* first_piece(std::vector<FlowRecord>& pieces, const FlowKey& key) {
+    FlowRecord probe;
+    probe.key = key;
+    probe.first_us = 0;
+    auto it = std::lower_bound(pieces.begin(), pieces.end(), probe, flow_before);
+    return it != pieces.end() && it->key == key ? &*it : nullptr;
+}
+
+// Joins the flows the per-chunk tables held back and exports them, so that
+// a split file exports the same flows as one read on a single thread: a
+// flow still open at the end of a chunk continues in the next chunk that
+// has the key, when that piece starts within the idle timeout.
+static void merge_split_flows(std::vector<CaptureContext>& contexts, FlowExporter& exporter) {
+    std::vector<FlowRecord> done;
+    std::vector<FlowRecord> open;
+    std::vector<FlowRecord> absent;
+    for (CaptureContext& context : contexts) {
+        FlowTable& flows = *context.flows;
+        std::sort(flows.head.begin(), flows.head.end(), flow_before);
+        std::sort(flows.tail.begin(), flows.tail.end(), flow_before);
+        for (const FlowRecord& before : open) {
+            FlowRecord* next = first_piece(flows.head, before.key);
+            FlowRecord* next_open = first_piece(flows.tail, before.key);
+            if (next == nullptr || (next_open != nullptr && next_open->first_us < next->first_us)) {
+                next = next_open;
+            }
+            if (next == nullptr) {
+                absent.push_back(before);
+                continue;
+            }
+            if (next->first_us - std::min(before.last_us, next->first_us) >= flows.idle_timeout()) {
+                done.push_back(before);
+                continue;
+            }
+            next->packets += before.packets;
+            next->bytes += before.bytes;
+            next->first_us = before.first_us;
+            next->last_us = std::max(next->last_us, before.last_us);
+        }
+        done.insert(done.end(), flows.head.begin(), flows.head.end());
+        open.swap(flows.tail);
+        open.insert(open.end(), absent.begin(), absent.end());
+        absent.clear();
+    }
+    done.insert(done.end(), open.begin(), open.end());
+    const size_t batch = 4096;
+    for (size_t i = 0; i < done.size(); i += batch) {
+        exporter.export_batch(done.data() + i, std::min(batch, done.size() - i));
+    }
+}
+
+// Flow records go to `flow_out`.
+int read_capture_file(const std::string& path, int threads, bool print, const AnalysisSettings& settings,
+    const SignatureEngine* signatures, FILE* flow_out) {
+    MappedFile file;
+    CaptureFormat format;
+    if (!open_capture(path, file, format)) {
+        return 1;
+    }
+
+    // Per-packet printing is only meaningful in file order.
+    if (threads < 1 || print) {
+        threads = 1;
+    }
+    size_t min_chunk = 1 << 20;
+    threads = (int)std::min<size_t>((size_t)threads, std::max<size_t>(file.size / min_chunk, 1));
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<size_t> boundaries(1, format.first_record);
+    for (int i = 1; i < threads; ++i) {
+        size_t split = find_record_boundary(file, std::max(file.size / threads * i, boundaries.back()), format);
+        boundaries.push_back(split);
+    }
+    boundaries.push_back(file.size);
+
+    FlowExporter exporter(flow_out);
+    std::unique_ptr<AlertLog> alert_log(signatures ? new AlertLog(*signatures) : nullptr);
+    std::vector<CaptureContext> contexts(threads);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        configure_context(contexts[i], settings, threads, print, exporter, signatures, alert_log.get());
+        if (threads > 1) {
+            contexts[i].flows->hold_split_flows();
+        }
+        workers.emplace_back([&, i]() {
+            CaptureFormat local = format;
+            if (format.pcapng) {
+                walk_pcapng(file, boundaries[i], boundaries[i + 1], local, &contexts[i]);
+            }
+            else {
+                walk_pcap(file, boundaries[i], boundaries[i + 1], local, &contexts[i]);
+            }
+            finish_context(contexts[i]);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (threads > 1) {
+        merge_split_flows(contexts, exporter);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
 
-#pragma comment(lib, "wpcap.lib")
-#pragma comment(lib, "Packet.lib")
-#pragma comment(lib, "Ws2_32.lib")
+    PacketStats total;
+    uint64_t evictions = 0;
+    for (const CaptureContext& context : contexts) {
+        total.merge(context.stats);
+        evictions += context.flows->evictions;
+    }
+    print_stats(total, elapsed);
+    std::cout << exporter.exported << " flows exported";
+    if (evictions > 0) {
+        std::cout << " (" << evictions << " early, flow table full)";
+    }
+    std::cout << std::endl;
+    print_analysis(contexts, alert_log.get());
+    std::cout << "Read " << file.size / 1e6 << " MB with " << threads << " threads ("
+        << file.size / elapsed / 1e9 << " GB/s)" << std::endl;
+    return 0;
+}
 
-void packet_handler(u_char* param, const struct pcap_pkthdr* header, const u_char* pkt_data) {
-    ether_header* eth_hdr = (ether_header*)pkt_data;
+#ifdef __linux__
+// Linux capture backend: one AF_PACKET socket per worker, each with its own
+// memory-mapped TPACKET_V3 block ring, joined into a PACKET_FANOUT group so
+// the kernel hashes flows across workers. Workers walk retired blocks in
+// place and decode their frames in batches with a private context.
+std::atomic<bool> capture_running(true);
 
-    if (ntohs(eth_hdr->ether_type) == ETHERTYPE_IP) {
-        iphdr* ip_hdr = (iphdr*)(pkt_data + sizeof(ether_header));
+void stop_capture(int) {
+    capture_running = false;
+}
 
-        char src_ip[16], dst_ip[16];
-        inet_ntop(AF_INET, &(ip_hdr->saddr), src_ip, sizeof(src_ip));
-        inet_ntop(AF_INET, &(ip_hdr->daddr), dst_ip, sizeof(dst_ip));
+struct RingCounters {
+    std::atomic<uint64_t> packets{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> drops{ 0 };
+};
 
-        std::cout << "IP Packet: " << src_ip << " -> " << dst_ip << " Protocol: ";
+class PacketRing {
+public:
+    ~PacketRing() {
+        if (ring != nullptr) {
+            munmap(ring, request.tp_block_size * request.tp_block_nr);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
 
-        switch (ip_hdr->protocol) {
-        case IPPROTO_TCP: {
-            tcphdr* tcp_hdr = (tcphdr*)(pkt_data + sizeof(ether_header) + sizeof(iphdr));
-            std::cout << "TCP Ports: " << ntohs(tcp_hdr->th_sport) << " -> " << ntohs(tcp_hdr->th_dport);
-            break;
+    bool open(int ifindex, int fanout_group) {
+        fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+        if (fd < 0) {
+            return false;
         }
-        case IPPROTO_UDP: {
-            udphdr* udp_hdr = (udphdr*)(pkt_data + sizeof(ether_header) + sizeof(iphdr));
-            std::cout << "UDP Ports: " << ntohs(udp_hdr->uh_sport) << " -> " << ntohs(udp_hdr->uh_dport);
-            break;
+        int version = TPACKET_V3;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+            return false;
         }
-        case IPPROTO_ICMP:
-            std::cout << "ICMP";
-            break;
-        default:
-            std::cout << "Other";
+
+        request = {};
+        request.tp_block_size = 1 << 20;
+        request.tp_block_nr = 32;
+        request.tp_frame_size = 2048;
+        request.tp_frame_nr = request.tp_block_size / request.tp_frame_size * request.tp_block_nr;
+        request.tp_retire_blk_tov = 50;
+        if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) != 0) {
+            return false;
+        }
+        void* mapped = mmap(nullptr, request.tp_block_size * request.tp_block_nr, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_LOCKED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            mapped = mmap(nullptr, request.tp_block_size * request.tp_block_nr, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        }
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        ring = (unsigned char*)mapped;
+
+        sockaddr_ll addr = {};
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = ifindex;
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            return false;
         }
-        std::cout << std::endl;
+
+        int fanout = (fanout_group & 0xFFFF) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        return setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == 0;
     }
-    else if (ntohs(eth_hdr->ether_type) == ETHERTYPE_ARP) {
-        std::cout << "ARP packet detected" << std::endl;
+
+    void run(CaptureContext& context, RingCounters& counters, bool skip_outgoing) {
+        pollfd pfd = { fd, POLLIN | POLLERR, 0 };
+        unsigned int block_index = 0;
+        while (capture_running.load(std::memory_order_relaxed)) {
+            tpacket_block_desc* block = (tpacket_block_desc*)(ring + (size_t)block_index * request.tp_block_size);
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+                poll(&pfd, 1, 100);
+                continue;
+            }
+
+            uint64_t bytes = 0;
+            tpacket3_hdr* frame = (tpacket3_hdr*)((unsigned char*)block + block->hdr.bh1.offset_to_first_pkt);
+            for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; ++i) {
+                const sockaddr_ll* link = (const sockaddr_ll*)((unsigned char*)frame + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+                // Loopback shows every packet twice: once sent, once received.
+                if (!skip_outgoing || link->sll_pkttype != PACKET_OUTGOING) {
+                    PacketView view;
+                    view.data = (const unsigned char*)frame + frame->tp_mac;
+                    view.caplen = frame->tp_snaplen;
+                    view.len = frame->tp_len;
+                    view.timestamp_us = (uint64_t)frame->tp_sec * 1000000 + frame->tp_nsec / 1000;
+                    queue_packet(&context, view);
+                    bytes += frame->tp_len;
+                }
+                frame = (tpacket3_hdr*)((unsigned char*)frame + frame->tp_next_offset);
+            }
+            flush_packets(&context);
+            counters.packets.store(context.stats.packets, std::memory_order_relaxed);
+            counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+            __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            block_index = (block_index + 1) % request.tp_block_nr;
+        }
+    }
+
+    // Drops since the previous call; the kernel resets its counters on read.
+    uint64_t take_drops() {
+        tpacket_stats_v3 stats = {};
+        socklen_t length = sizeof(stats);
+        if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &length) != 0) {
+            return 0;
+        }
+        return stats.tp_drops;
+    }
+
+private:
+    int fd = -1;
+    unsigned char* ring = nullptr;
+    tpacket_req3 request = {};
+};
+
+int capture_interface(const std::string& interface_name, int workers, int duration_s, bool print,
+    const AnalysisSettings& settings, const SignatureEngine* signatures) {
+    int ifindex = (int)if_nametoindex(interface_name.c_str());
+    if (ifindex == 0) {
+        std::cerr << "Unknown interface " << interface_name << std::endl;
+        return 1;
+    }
+    ifreq request = {};
+    strncpy(request.ifr_name, interface_name.c_str(), IFNAMSIZ - 1);
+    int probe = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    bool loopback = probe >= 0 && ioctl(probe, SIOCGIFFLAGS, &request) == 0 && (request.ifr_flags & IFF_LOOPBACK);
+    if (probe >= 0) {
+        close(probe);
+    }
+
+    if (workers < 1 || print) {
+        workers = 1;
+    }
+    int fanout_group = (int)(getpid() & 0xFFFF);
+    std::vector<std::unique_ptr<PacketRing>> rings;
+    for (int i = 0; i < workers; ++i) {
+        rings.emplace_back(new PacketRing());
+        if (!rings.back()->open(ifindex, fanout_group)) {
+            std::cerr << "Error opening packet ring on " << interface_name << ": " << strerror(errno)
+                << " (needs CAP_NET_RAW)" << std::endl;
+            return 1;
+        }
+    }
+
+    signal(SIGINT, stop_capture);
+    signal(SIGTERM, stop_capture);
+
+    FlowExporter exporter;
+    std::unique_ptr<AlertLog> alert_log(signatures ? new AlertLog(*signatures) : nullptr);
+    std::vector<CaptureContext> contexts(workers);
+    std::vector<RingCounters> counters(workers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; ++i) {
+        configure_context(contexts[i], settings, workers, print, exporter, signatures, alert_log.get());
+        threads.emplace_back([&, i]() {
+            rings[i]->run(contexts[i], counters[i], loopback);
+            finish_context(contexts[i]);
+        });
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<uint64_t> last_packets(workers, 0);
+    std::vector<uint64_t> last_bytes(workers, 0);
+    while (capture_running) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        for (int i = 0; i < workers; ++i) {
+            uint64_t packets = counters[i].packets.load();
+            uint64_t bytes = counters[i].bytes.load();
+            counters[i].drops += rings[i]->take_drops();
+            std::cerr << "ring " << i << ": " << packets - last_packets[i] << " pps, "
+                << (bytes - last_bytes[i]) * 8 / 1e6 << " Mbit/s, " << counters[i].drops.load()
+                << " dropped" << std::endl;
+            last_packets[i] = packets;
+            last_bytes[i] = bytes;
+        }
+        if (duration_s > 0 && std::chrono::steady_clock::now() - started >= std::chrono::seconds(duration_s)) {
+            capture_running = false;
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    PacketStats total;
+    uint64_t drops = 0;
+    for (int i = 0; i < workers; ++i) {
+        total.merge(contexts[i].stats);
+        drops += counters[i].drops.load() + rings[i]->take_drops();
+    }
+    print_stats(total, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    std::cout << exporter.exported << " flows exported, " << drops << " packets dropped by the kernel" << std::endl;
+    print_analysis(contexts, alert_log.get());
+    return 0;
+}
+#endif
+
+// Synthetic frames covering each decoder path, with the ports the decoder
+// is expected to report.
+struct DecoderSample {
+    std::vector<unsigned char> frame;
+    uint8_t flags;
+    uint8_t protocol;
+    uint16_t src_port;
+    uint16_t dst_port;
+};
+
+static std::vector<DecoderSample> decoder_samples() {
+    auto ethernet = [](std::vector<unsigned char>& frame, std::initializer_list<uint16_t> types) {
+        frame.assign(12, 0x02);
+        for (uint16_t type : types) {
+            frame.push_back((unsigned char)(type >> 8));
+            frame.push_back((unsigned char)type);
+        }
+    };
+    auto append = [](std::vector<unsigned char>& frame, std::initializer_list<unsigned char> bytes) {
+        frame.insert(frame.end(), bytes);
+    };
+    auto ipv4 = [&](std::vector<unsigned char>& frame, uint8_t protocol, uint16_t total, bool options, bool fragment) {
+        append(frame, { (unsigned char)(options ? 0x46 : 0x45), 0, (unsigned char)(total >> 8), (unsigned char)total,
+            0, 1, (unsigned char)(fragment ? 0x00 : 0x40), (unsigned char)(fragment ? 0x20 : 0x00), 64, protocol, 0, 0,
+            10, 0, 0, 1, 10, 0, 0, 2 });
+        if (options) {
+            append(frame, { 1, 1, 1, 0 });
+        }
+    };
+    auto ipv6 = [&](std::vector<unsigned char>& frame, uint8_t next, uint16_t payload) {
+        append(frame, { 0x60, 0, 0, 0, (unsigned char)(payload >> 8), (unsigned char)payload, next, 64 });
+        for (int i = 0; i < 2; ++i) {
+            append(frame, { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, (unsigned char)(i + 1) });
+        }
+    };
+    auto tcp = [&](std::vector<unsigned char>& frame, uint16_t src, uint16_t dst) {
+        append(frame, { (unsigned char)(src >> 8), (unsigned char)src, (unsigned char)(dst >> 8), (unsigned char)dst,
+            0, 0, 0, 1, 0, 0, 0, 0, 0x50, 0x18, 0xFF, 0xFF, 0, 0, 0, 0 });
+    };
+    auto udp = [&](std::vector<unsigned char>& frame, uint16_t src, uint16_t dst, uint16_t length) {
+        append(frame, { (unsigned char)(src >> 8), (unsigned char)src, (unsigned char)(dst >> 8), (unsigned char)dst,
+            (unsigned char)(length >> 8), (unsigned char)length, 0, 0 });
+    };
+    auto payload = [](std::vector<unsigned char>& frame, size_t length) {
+        frame.insert(frame.end(), length, 'x');
+    };
+
+    std::vector<DecoderSample> samples;
+    DecoderSample sample;
+
+    ethernet(sample.frame, { 0x0800 });
+    ipv4(sample.frame, IPPROTO_TCP, 24 + 20 + 64, true, false);
+    tcp(sample.frame, 40000, 443);
+    payload(sample.frame, 64);
+    sample.flags = DECODED_IPV4 | DECODED_L4;
+    sample.protocol = IPPROTO_TCP;
+    sample.src_port = 40000;
+    sample.dst_port = 443;
+    samples.push_back(sample);
+
+    sample.frame = std::vector<unsigned char>(12, 0x02);
+    append(sample.frame, { 0x81, 0x00, 0x00, 0x2A, 0x08, 0x00 });
+    ipv4(sample.frame, IPPROTO_UDP, 20 + 8 + 32, false, false);
+    udp(sample.frame, 5353, 53, 8 + 32);
+    payload(sample.frame, 32);
+    sample.flags = DECODED_VLAN | DECODED_IPV4 | DECODED_L4;
+    sample.protocol = IPPROTO_UDP;
+    sample.src_port = 5353;
+    sample.dst_port = 53;
+    samples.push_back(sample);
+
+    sample.frame = std::vector<unsigned char>(12, 0x02);
+    append(sample.frame, { 0x88, 0xA8, 0x00, 0x64, 0x81, 0x00, 0x00, 0x0A, 0x86, 0xDD });
+    ipv6(sample.frame, IPPROTO_TCP, 20 + 128);
+    tcp(sample.frame, 51000, 80);
+    payload(sample.frame, 128);
+    sample.flags = DECODED_VLAN | DECODED_IPV6 | DECODED_L4;
+    sample.protocol = IPPROTO_TCP;
+    sample.src_port = 51000;
+    sample.dst_port = 80;
+    samples.push_back(sample);
+
+    ethernet(sample.frame, { 0x86DD });
+    ipv6(sample.frame, 0, 8 + 8 + 16);
+    append(sample.frame, { IPPROTO_UDP, 0, 5, 2, 0, 0, 1, 0 });
+    udp(sample.frame, 546, 547, 8 + 16);
+    payload(sample.frame, 16);
+    sample.flags = DECODED_IPV6 | DECODED_L4;
+    sample.protocol = IPPROTO_UDP;
+    sample.src_port = 546;
+    sample.dst_port = 547;
+    samples.push_back(sample);
+
+    ethernet(sample.frame, { 0x0800 });
+    ipv4(sample.frame, IPPROTO_ICMP, 20 + 8 + 56, false, false);
+    append(sample.frame, { 8, 0, 0, 0, 0, 1, 0, 1 });
+    payload(sample.frame, 56);
+    sample.flags = DECODED_IPV4 | DECODED_L4;
+    sample.protocol = IPPROTO_ICMP;
+    sample.src_port = 0;
+    sample.dst_port = 8 << 8;
+    samples.push_back(sample);
+
+    ethernet(sample.frame, { 0x0800 });
+    ipv4(sample.frame, IPPROTO_UDP, 20 + 400, false, true);
+    payload(sample.frame, 400);
+    sample.flags = DECODED_IPV4 | DECODED_FRAGMENT;
+    sample.protocol = IPPROTO_UDP;
+    sample.src_port = 0;
+    sample.dst_port = 0;
+    samples.push_back(sample);
+
+    ethernet(sample.frame, { 0x0806 });
+    payload(sample.frame, 28);
+    sample.flags = DECODED_ARP;
+    sample.protocol = 0;
+    samples.push_back(sample);
+
+    ethernet(sample.frame, { 0x0800 });
+    append(sample.frame, { 0x45, 0, 0, 60, 0, 0 });
+    sample.flags = DECODED_TRUNCATED;
+    samples.push_back(sample);
+
+    ethernet(sample.frame, { 0x0800 });
+    sample.flags = DECODED_TRUNCATED;
+    samples.push_back(sample);
+
+    return samples;
+}
+
+// Checks each sample's decode, then decodes a shuffled mix of them for about
+// a second on one core.
+int benchmark_decoder() {
+    std::vector<DecoderSample> samples = decoder_samples();
+    std::vector<PacketView> views;
+    for (const DecoderSample& sample : samples) {
+        PacketView view = { sample.frame.data(), (uint32_t)sample.frame.size(), (uint32_t)sample.frame.size(), 0 };
+        views.push_back(view);
+    }
+
+    DecodedBatch batch;
+    decode_batch(views.data(), views.size(), batch);
+    bool correct = true;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (batch.flags[i] != samples[i].flags || (batch.flags[i] & DECODED_L4 &&
+            (batch.protocol[i] != samples[i].protocol || batch.src_port[i] != samples[i].src_port ||
+            batch.dst_port[i] != samples[i].dst_port))) {
+            std::cerr << "Decoder mismatch on sample " << i << std::endl;
+            correct = false;
+        }
+    }
+
+    std::vector<PacketView> mix;
+    uint32_t state = 1;
+    for (int i = 0; i < 64 * (int)DECODE_BATCH; ++i) {
+        state = state * 1664525 + 1013904223;
+        mix.push_back(views[(state >> 16) % views.size()]);
+    }
+
+    uint64_t packets = 0;
+    uint64_t checksum = 0;
+    auto started = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < 1.0) {
+        for (size_t offset = 0; offset < mix.size(); offset += DECODE_BATCH) {
+            decode_batch(mix.data() + offset, DECODE_BATCH, batch);
+            checksum += batch.dst_port[0] + batch.payload_length[DECODE_BATCH - 1];
+        }
+        packets += mix.size();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    std::cout << "Decoded " << packets << " packets in " << elapsed << " s: " << packets / elapsed / 1e6
+        << " Mpps per core, " << elapsed * 1e9 / packets << " ns/packet (checksum " << checksum << ")" << std::endl;
+    return correct ? 0 : 1;
+}
+
+// Compiles `rule_count` random signatures plus two planted ones, writes a
+// capture of HTTP-like TCP traffic to a temporary pcap, maps it back in and
+// times matching over every payload for about a second on one core.
+int benchmark_signatures(int rule_count) {
+    const char* marker = "X-Planted-Marker";
+    const int packet_count = 20000;
+    const size_t marker_offset = 40;
+    uint32_t state = 12345;
+    auto next = [&]() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+
+    SignatureEngine engine;
+    for (int i = 0; i < rule_count; ++i) {
+        SignatureRule rule = { (uint32_t)i + 1, 0, 0, 0, 0, std::string(), "random" };
+        size_t length = 6 + next() % 11;
+        for (size_t c = 0; c < length; ++c) {
+            rule.content += (char)(' ' + next() % 95);
+        }
+        engine.add(rule);
+    }
+    SignatureRule planted = { 1000001, IPPROTO_TCP, 80, 0, 0, marker, "planted" };
+    engine.add(planted);
+    SignatureRule shallow = { 1000002, IPPROTO_TCP, 80, 0, (uint32_t)marker_offset, marker, "beyond depth" };
+    engine.add(shallow);
+    auto compile_started = std::chrono::steady_clock::now();
+    engine.compile();
+    double compile_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - compile_started).count();
+
+    std::string path = (std::filesystem::temp_directory_path() /
+        ("sniffer-bench-" + std::to_string(getpid()) + ".pcap")).string();
+    PcapWriter writer;
+    if (!writer.open(path)) {
+        std::cerr << "Cannot create " << path << std::endl;
+        return 1;
+    }
+    const char* words[] = { "GET ", "/index.html ", "HTTP/1.1\r\n", "Host: example.com\r\n", "Accept: */*\r\n",
+        "User-Agent: curl/8.0\r\n", "Cookie: session=", "Content-Length: 0\r\n", "\r\n" };
+    int expected = 0;
+    std::vector<unsigned char> frame;
+    for (int p = 0; p < packet_count; ++p) {
+        std::string payload;
+        size_t target = 200 + next() % 1200;
+        while (payload.size() < target) {
+            payload += words[next() % (sizeof(words) / sizeof(words[0]))];
+        }
+        payload.resize(target);
+        if (p % 16 == 0) {
+            payload.replace(marker_offset, strlen(marker), marker);
+            expected++;
+        }
+        frame.assign(12, 0x02);
+        frame.push_back(0x08);
+        frame.push_back(0x00);
+        uint16_t ip_length = (uint16_t)(20 + 20 + payload.size());
+        const unsigned char ip[20] = { 0x45, 0, (unsigned char)(ip_length >> 8), (unsigned char)ip_length, 0, 0,
+            0x40, 0, 64, IPPROTO_TCP, 0, 0, 10, 0, 0, (unsigned char)(p & 0xFF), 10, 0, 1, 1 };
+        frame.insert(frame.end(), ip, ip + 20);
+        uint16_t src_port = (uint16_t)(40000 + p % 1000);
+        const unsigned char tcp[20] = { (unsigned char)(src_port >> 8), (unsigned char)src_port, 0, 80,
+            0, 0, 0, 1, 0, 0, 0, 0, 0x50, 0x18, 0xFF, 0xFF, 0, 0, 0, 0 };
+        frame.insert(frame.end(), tcp, tcp + 20);
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        writer.write((uint64_t)p * 1000000, frame.data(), (uint32_t)frame.size());
+    }
+    writer.close();
+
+    MappedFile file;
+    bool opened = file.open(path);
+    std::filesystem::remove(path);
+    if (!opened) {
+        std::cerr << "Cannot map " << path << std::endl;
+        return 1;
+    }
+
+    // Decode once; the timed loop measures matching alone.
+    std::vector<PacketView> views;
+    for (size_t offset = 24; offset + 16 <= file.size;) {
+        uint32_t caplen = read_u32(file.data + offset + 8, false);
+        PacketView view = { file.data + offset + 16, caplen, caplen, 0 };
+        views.push_back(view);
+        offset += 16 + (size_t)caplen;
+    }
+    struct Payload {
+        const unsigned char* data;
+        uint32_t length;
+        uint16_t src_port;
+        uint16_t dst_port;
+    };
+    std::vector<Payload> payloads;
+    uint64_t wire_bytes = 0;
+    DecodedBatch batch;
+    for (size_t offset = 0; offset < views.size(); offset += DECODE_BATCH) {
+        decode_batch(views.data() + offset, std::min<size_t>(DECODE_BATCH, views.size() - offset), batch);
+        for (size_t i = 0; i < batch.count; ++i) {
+            Payload payload = { views[offset + i].data + batch.payload_offset[i], batch.payload_length[i],
+                batch.src_port[i], batch.dst_port[i] };
+            payloads.push_back(payload);
+            wire_bytes += batch.wire_length[i];
+        }
+    }
+
+    uint64_t planted_hits = 0;
+    uint64_t shallow_hits = 0;
+    uint64_t other_hits = 0;
+    uint64_t passes = 0;
+    auto started = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < 1.0) {
+        for (const Payload& payload : payloads) {
+            engine.scan(payload.data, payload.length, IPPROTO_TCP, payload.src_port, payload.dst_port,
+                [&](uint32_t rule, size_t) {
+                    uint32_t id = engine.rule(rule).id;
+                    planted_hits += id == planted.id;
+                    shallow_hits += id == shallow.id;
+                    other_hits += id != planted.id && id != shallow.id;
+                });
+        }
+        passes++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    bool correct = planted_hits == (uint64_t)expected * passes && shallow_hits == 0;
+    std::cout << engine.rule_count() << " rules, " << engine.state_count() << " states, compiled in "
+        << compile_s * 1e3 << " ms" << std::endl;
+    std::cout << "Scanned " << passes * payloads.size() << " packets in " << elapsed << " s: "
+        << passes * wire_bytes * 8 / elapsed / 1e9 << " Gbit/s per core, "
+        << passes * payloads.size() / elapsed / 1e6 << " Mpps" << std::endl;
+    std::cout << "Planted matches " << planted_hits / passes << "/" << expected << ", depth-limited "
+        << shallow_hits / passes << "/0, random " << other_hits / passes << " per pass" << std::endl;
+    if (!correct) {
+        std::cerr << "Signature matches differ from what was planted" << std::endl;
+    }
+    return correct ? 0 : 1;
+}
+
+// A deterministic synthetic traffic mix for --generate. Protocol weights
+// are relative; VLAN and IPv6 shares are percentages of flows.
+struct TrafficMix {
+    uint64_t packets = 1000000;
+    uint32_t flows = 10000;
+    uint32_t tcp = 60;
+    uint32_t udp = 30;
+    uint32_t icmp = 5;
+    uint32_t arp = 5;
+    uint32_t vlan = 0;
+    uint32_t ipv6 = 0;
+    std::string size = "imix";
+    uint64_t rate = 1000000;
+    uint32_t seed = 1;
+};
+
+static bool parse_traffic_mix(const std::string& spec, TrafficMix& mix) {
+    std::istringstream stream(spec);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        size_t equals = item.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        std::string key = item.substr(0, equals);
+        std::string value = item.substr(equals + 1);
+        uint64_t number = strtoull(value.c_str(), nullptr, 10);
+        if (key == "packets") {
+            mix.packets = number;
+        }
+        else if (key == "flows") {
+            mix.flows = (uint32_t)std::max<uint64_t>(number, 1);
+        }
+        else if (key == "tcp") {
+            mix.tcp = (uint32_t)number;
+        }
+        else if (key == "udp") {
+            mix.udp = (uint32_t)number;
+        }
+        else if (key == "icmp") {
+            mix.icmp = (uint32_t)number;
+        }
+        else if (key == "arp") {
+            mix.arp = (uint32_t)number;
+        }
+        else if (key == "vlan") {
+            mix.vlan = (uint32_t)std::min<uint64_t>(number, 100);
+        }
+        else if (key == "ipv6") {
+            mix.ipv6 = (uint32_t)std::min<uint64_t>(number, 100);
+        }
+        else if (key == "size") {
+            mix.size = value;
+        }
+        else if (key == "rate") {
+            mix.rate = std::max<uint64_t>(number, 1);
+        }
+        else if (key == "seed") {
+            mix.seed = (uint32_t)number;
+        }
+        else {
+            return false;
+        }
+    }
+    if (mix.size != "imix" && mix.size != "uniform" && atoi(mix.size.c_str()) <= 0) {
+        return false;
+    }
+    return mix.tcp + mix.udp + mix.icmp + mix.arp > 0;
+}
+
+static inline uint32_t mix32(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x7FEB352D;
+    value ^= value >> 15;
+    value *= 0x846CA68B;
+    value ^= value >> 16;
+    return value;
+}
+
+// Builds one frame of the mix into `frame` (at least 9018 bytes) and
+// returns its length. Frame sizes exclude the FCS; IMIX is 7:4:1 of 60, 590
+// and 1514 bytes. ARP frames are drawn per packet; every other packet picks
+// a flow, whose protocol, like its addresses, ports, VLAN and IP version, is
+// fixed by its index, so `flows` is the number of distinct 5-tuples. TCP
+// sequence numbers advance per flow, so the streams reassemble cleanly.
+static uint32_t build_frame(const TrafficMix& mix, uint32_t& state, std::vector<uint32_t>& tcp_seq,
+    unsigned char* frame) {
+    auto next = [&]() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+
+    uint32_t size;
+    if (mix.size == "imix") {
+        uint32_t pick = next() % 12;
+        size = pick < 7 ? 60 : pick < 11 ? 590 : 1514;
+    }
+    else if (mix.size == "uniform") {
+        size = 60 + next() % (1514 - 60 + 1);
+    }
+    else {
+        size = (uint32_t)std::min(std::max(atoi(mix.size.c_str()), 60), 9014);
+    }
+
+    static const unsigned char dst_mac[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+    static const unsigned char src_mac[6] = { 0x02, 0, 0, 0, 0, 0x02 };
+    memcpy(frame, dst_mac, 6);
+    memcpy(frame + 6, src_mac, 6);
+
+    uint32_t kind = next() % (mix.tcp + mix.udp + mix.icmp + mix.arp);
+    if (kind >= mix.tcp + mix.udp + mix.icmp) {
+        static const unsigned char arp[30] = { 0x08, 0x06, 0, 1, 0x08, 0, 6, 4, 0, 1,
+            0x02, 0, 0, 0, 0, 0x02, 10, 0, 0, 1, 0, 0, 0, 0, 0, 0, 10, 0, 0, 2 };
+        memset(frame, 0xFF, 6);
+        memcpy(frame + 12, arp, sizeof(arp));
+        memset(frame + 42, 0, 18);
+        return 60;
+    }
+    uint32_t flow = next() % mix.flows;
+    uint32_t traits = mix32(flow ^ mix.seed * 0x9E3779B9);
+    uint32_t ip_kind = mix32(traits) % (mix.tcp + mix.udp + mix.icmp);
+    uint8_t protocol = ip_kind < mix.tcp ? IPPROTO_TCP : ip_kind < mix.tcp + mix.udp ? IPPROTO_UDP : IPPROTO_ICMP;
+    bool ipv6 = traits % 100 < mix.ipv6;
+    bool vlan = (traits >> 8) % 100 < mix.vlan;
+
+    uint32_t offset = 12;
+    if (vlan) {
+        uint16_t vlan_id = (uint16_t)(1 + (traits >> 16) % 4094);
+        frame[offset++] = 0x81;
+        frame[offset++] = 0x00;
+        frame[offset++] = (unsigned char)(vlan_id >> 8);
+        frame[offset++] = (unsigned char)vlan_id;
+    }
+    frame[offset++] = ipv6 ? 0x86 : 0x08;
+    frame[offset++] = ipv6 ? 0xDD : 0x00;
+
+    uint32_t l3 = offset;
+    uint32_t l3_length = ipv6 ? 40 : 20;
+    uint32_t l4_length = protocol == IPPROTO_TCP ? 20 : 8;
+    uint32_t payload = size > l3 + l3_length + l4_length ? size - l3 - l3_length - l4_length : 0;
+    uint32_t l4 = l3 + l3_length;
+    if (ipv6) {
+        uint16_t payload_length = (uint16_t)(l4_length + payload);
+        uint8_t next_header = protocol == IPPROTO_ICMP ? (uint8_t)IPPROTO_ICMPV6 : protocol;
+        const unsigned char header[8] = { 0x60, 0, 0, 0, (unsigned char)(payload_length >> 8),
+            (unsigned char)payload_length, next_header, 64 };
+        memcpy(frame + l3, header, 8);
+        const unsigned char prefix[8] = { 0xFD, 0, 0, 0, 0, 0, 0, 0 };
+        memcpy(frame + l3 + 8, prefix, 8);
+        memset(frame + l3 + 16, 0, 4);
+        frame[l3 + 20] = (unsigned char)(flow >> 24);
+        frame[l3 + 21] = (unsigned char)(flow >> 16);
+        frame[l3 + 22] = (unsigned char)(flow >> 8);
+        frame[l3 + 23] = (unsigned char)flow;
+        memcpy(frame + l3 + 24, prefix, 8);
+        memset(frame + l3 + 32, 0, 4);
+        memcpy(frame + l3 + 36, &traits, 4);
+        frame[l3 + 39] |= 1;
+    }
+    else {
+        uint16_t total_length = (uint16_t)(20 + l4_length + payload);
+        const unsigned char header[20] = { 0x45, 0, (unsigned char)(total_length >> 8), (unsigned char)total_length,
+            0, 0, 0x40, 0, 64, protocol, 0, 0,
+            10, (unsigned char)(flow >> 16), (unsigned char)(flow >> 8), (unsigned char)flow,
+            192, 168, (unsigned char)(traits >> 16), (unsigned char)(traits >> 24 | 1) };
+        memcpy(frame + l3, header, 20);
+        uint32_t sum = 0;
+        for (int i = 0; i < 20; i += 2) {
+            sum += (uint32_t)header[i] << 8 | header[i + 1];
+        }
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        frame[l3 + 10] = (unsigned char)(~sum >> 8);
+        frame[l3 + 11] = (unsigned char)~sum;
+    }
+
+    static const uint16_t tcp_ports[] = { 80, 443, 22, 25, 8080, 3306 };
+    static const uint16_t udp_ports[] = { 53, 123, 443, 161, 514, 5353 };
+    uint16_t src_port = (uint16_t)(1024 + traits % 60000);
+    if (protocol == IPPROTO_TCP) {
+        uint16_t dst_port = tcp_ports[(traits >> 4) % 6];
+        uint32_t seq = tcp_seq[flow];
+        tcp_seq[flow] = seq + payload;
+        const unsigned char header[20] = { (unsigned char)(src_port >> 8), (unsigned char)src_port,
+            (unsigned char)(dst_port >> 8), (unsigned char)dst_port,
+            (unsigned char)(seq >> 24), (unsigned char)(seq >> 16), (unsigned char)(seq >> 8), (unsigned char)seq,
+            0, 0, 0, 1, 0x50, 0x18, 0xFF, 0xFF, 0, 0, 0, 0 };
+        memcpy(frame + l4, header, 20);
+    }
+    else if (protocol == IPPROTO_UDP) {
+        uint16_t dst_port = udp_ports[(traits >> 4) % 6];
+        uint16_t length = (uint16_t)(8 + payload);
+        const unsigned char header[8] = { (unsigned char)(src_port >> 8), (unsigned char)src_port,
+            (unsigned char)(dst_port >> 8), (unsigned char)dst_port, (unsigned char)(length >> 8),
+            (unsigned char)length, 0, 0 };
+        memcpy(frame + l4, header, 8);
+    }
+    else {
+        const unsigned char header[8] = { (unsigned char)(ipv6 ? 128 : 8), 0, 0, 0,
+            (unsigned char)(flow >> 8), (unsigned char)flow, 0, 1 };
+        memcpy(frame + l4, header, 8);
+    }
+
+    unsigned char* data = frame + l4 + l4_length;
+    for (uint32_t i = 0; i < payload; ++i) {
+        data[i] = (unsigned char)('a' + (i + flow) % 26);
+    }
+    uint32_t length = l4 + l4_length + payload;
+    if (length < 60) {
+        memset(frame + length, 0, 60 - length);
+        length = 60;
+    }
+    return length;
+}
+
+int generate_traffic(const std::string& path, const TrafficMix& mix) {
+    PcapWriter writer;
+    if (!writer.open(path)) {
+        std::cerr << "Cannot create " << path << std::endl;
+        return 1;
+    }
+    std::vector<uint32_t> tcp_seq(mix.flows);
+    for (uint32_t flow = 0; flow < mix.flows; ++flow) {
+        tcp_seq[flow] = mix32(flow + mix.seed);
+    }
+    std::vector<unsigned char> frame(9018);
+    uint32_t state = mix.seed * 2654435761u + 1;
+    uint64_t bytes = 0;
+    for (uint64_t i = 0; i < mix.packets; ++i) {
+        uint32_t length = build_frame(mix, state, tcp_seq, frame.data());
+        if (!writer.write(i * 1000000 / mix.rate, frame.data(), length)) {
+            std::cerr << "Error writing " << path << std::endl;
+            return 1;
+        }
+        bytes += length;
+    }
+    if (!writer.close()) {
+        std::cerr << "Error writing " << path << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << mix.packets << " packets, " << bytes << " bytes across " << mix.flows
+        << " flows to " << path << std::endl;
+    return 0;
+}
+
+// Discards everything; per-packet printing is timed without a terminal.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+};
+
+static FlowKey self_test_key(uint32_t n) {
+    FlowKey key;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.src_addr + 12, &n, sizeof(n));
+    key.src_port = 1024;
+    key.dst_port = 80;
+    key.protocol = IPPROTO_TCP;
+    return key;
+}
+
+// Reads back what a FlowExporter wrote to `out` and counts the records, and
+// the records with no packets, which only an export of an empty slot makes.
+static void count_exported(FILE* out, size_t& records, size_t& empty) {
+    records = 0;
+    empty = 0;
+    rewind(out);
+    char line[256];
+    while (fgets(line, sizeof(line), out)) {
+        records++;
+        if (strstr(line, " packets=0 ")) {
+            empty++;
+        }
+    }
+}
+
+class CollectingConsumer : public StreamConsumer {
+public:
+    void on_data(TcpStream&, const unsigned char* data, size_t length, uint64_t) override {
+        text.append((const char*)data, length);
+    }
+
+    std::string text;
+};
+
+// The flow records a FlowExporter wrote to `out`, sorted.
+static std::vector<std::string> exported_flows(FILE* out) {
+    std::vector<std::string> lines;
+    rewind(out);
+    char line[256];
+    while (fgets(line, sizeof(line), out)) {
+        lines.push_back(line);
+    }
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
+
+// Regression checks for the flow table and TCP reassembler.
+int run_self_tests() {
+    bool correct = true;
+
+    // Ten times more flows than fit: each insert past the load limit must
+    // evict a live flow, and every flow must come out exactly once.
+    {
+        FILE* out = tmpfile();
+        FlowExporter exporter(out);
+        const uint32_t keys = 160;
+        {
+            FlowTable flows(16, 15000000, 1800000000, exporter);
+            for (uint32_t n = 0; n < keys; ++n) {
+                flows.update(self_test_key(n), 100, 1000 + n);
+            }
+            flows.flush();
+        }
+        size_t records, empty;
+        count_exported(out, records, empty);
+        if (records != keys || empty != 0) {
+            std::cerr << "Flow table eviction: " << records << " records, " << empty << " empty, expected "
+                << keys << std::endl;
+            correct = false;
+        }
+        fclose(out);
+    }
+
+    // A packet older than a live flow must not make that flow look idle.
+    {
+        FILE* out = tmpfile();
+        FlowExporter exporter(out);
+        FlowTable flows(16, 15000000, 1800000000, exporter);
+        flows.update(self_test_key(0), 100, 100000000);
+        for (int i = 0; i < 8; ++i) {
+            flows.update(self_test_key(1), 100, 99000000);
+        }
+        size_t records, empty;
+        count_exported(out, records, empty);
+        if (records != 0) {
+            std::cerr << "Flow table expired " << records << " flows on an out-of-order timestamp" << std::endl;
+            correct = false;
+        }
+        flows.flush();
+        fclose(out);
+    }
+
+    // Buffered bytes win over an in-order segment that overlaps them, and a
+    // retransmission after the FIN is not delivered as a new stream.
+    {
+        CollectingConsumer consumer;
+        TcpReassembler reassembler(1 << 20, 15000000, consumer);
+        const uint8_t FIN = 0x01;
+        FlowKey key = self_test_key(0);
+        reassembler.segment(key, 1001, 0, (const unsigned char*)"abc", 3, 1);
+        reassembler.segment(key, 1007, 0, (const unsigned char*)"ghi", 3, 2);
+        reassembler.segment(key, 1004, 0, (const unsigned char*)"deXYZ", 5, 3);
+        reassembler.segment(key, 1010, FIN, (const unsigned char*)"jkl", 3, 4);
+        reassembler.segment(key, 1010, FIN, (const unsigned char*)"jkl", 3, 5);
+        reassembler.flush();
+        if (consumer.text != "abcdeXghijkl") {
+            std::cerr << "Reassembly delivered \"" << consumer.text << "\", expected \"abcdeXghijkl\"" << std::endl;
+            correct = false;
+        }
+    }
+
+    // A capture file read on several threads exports the same flows as on
+    // one, including flows whose packets fall into more than one chunk.
+    {
+        std::string path = (std::filesystem::temp_directory_path() /
+            ("sniffer-self-test-" + std::to_string(getpid()) + ".pcap")).string();
+        TrafficMix mix;
+        mix.packets = 40000;
+        mix.flows = 2000;
+        mix.vlan = 20;
+        mix.ipv6 = 30;
+        NullBuffer null_buffer;
+        std::streambuf* console = std::cout.rdbuf(&null_buffer);
+        FILE* single = tmpfile();
+        FILE* split = tmpfile();
+        AnalysisSettings settings;
+        bool ran = generate_traffic(path, mix) == 0 &&
+            read_capture_file(path, 1, false, settings, nullptr, single) == 0 &&
+            read_capture_file(path, 4, false, settings, nullptr, split) == 0;
+        std::cout.rdbuf(console);
+        std::filesystem::remove(path);
+        std::vector<std::string> single_flows = exported_flows(single);
+        std::vector<std::string> split_flows = exported_flows(split);
+        if (!ran || single_flows.size() != mix.flows || split_flows != single_flows) {
+            std::cerr << "Split capture exported " << split_flows.size() << " flows, one thread "
+                << single_flows.size() << ", expected the same " << mix.flows << std::endl;
+            correct = false;
+        }
+        fclose(single);
+        fclose(split);
+    }
+
+    std::cout << (correct ? "Self-test passed" : "Self-test FAILED") << std::endl;
+    return correct ? 0 : 1;
+}
+
+// Times each stage of process_batch on its own over a capture file: every
+// stage runs over the whole file repeatedly for at least half a second,
+// stateful stages with fresh state each pass. Output goes to the null
+// device so the terminal is not what gets measured.
+int benchmark_pipeline(const std::string& path, const AnalysisSettings& settings, const SignatureEngine* signatures) {
+    MappedFile file;
+    std::vector<PacketView> views;
+    if (!load_packets(path, file, views)) {
+        return 1;
+    }
+    if (views.empty()) {
+        std::cerr << "No packets in " << path << std::endl;
+        return 1;
+    }
+#ifdef _WIN32
+    FILE* null_device = fopen("NUL", "w");
+#else
+    FILE* null_device = fopen("/dev/null", "w");
+#endif
+    if (null_device == nullptr) {
+        std::cerr << "Cannot open the null device" << std::endl;
+        return 1;
+    }
+
+    std::vector<DecodedBatch> batches((views.size() + DECODE_BATCH - 1) / DECODE_BATCH);
+    for (size_t b = 0; b < batches.size(); ++b) {
+        decode_batch(views.data() + b * DECODE_BATCH, std::min(DECODE_BATCH, views.size() - b * DECODE_BATCH),
+            batches[b]);
+    }
+
+    std::cout << views.size() << " packets from " << path << std::endl;
+    double total_ns = 0;
+    auto time_stage = [&](const char* name, const std::function<void()>& setup,
+        const std::function<void(size_t)>& run, const std::function<void()>& teardown) {
+        double elapsed = 0;
+        uint64_t passes = 0;
+        while (elapsed < 0.5) {
+            setup();
+            auto started = std::chrono::steady_clock::now();
+            for (size_t b = 0; b < batches.size(); ++b) {
+                run(b);
+            }
+            teardown();
+            elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            passes++;
+        }
+        double packets = (double)passes * views.size();
+        total_ns += elapsed * 1e9 / packets;
+        printf("  %-12s %8.1f ns/packet %10.3f Mpps\n", name, elapsed * 1e9 / packets, packets / elapsed / 1e6);
+    };
+    auto nothing = []() {};
+
+    DecodedBatch scratch;
+    time_stage("decode", nothing, [&](size_t b) {
+        decode_batch(views.data() + b * DECODE_BATCH, batches[b].count, scratch);
+    }, nothing);
+
+    PacketStats stats;
+    time_stage("stats", nothing, [&](size_t b) {
+        count_packets(stats, batches[b]);
+    }, nothing);
+
+    FlowExporter exporter(null_device);
+    std::unique_ptr<FlowTable> flows;
+    time_stage("flows", [&]() {
+        flows.reset(new FlowTable(settings.capacity, settings.idle_timeout_us, settings.active_timeout_us, exporter));
+    }, [&](size_t b) {
+        update_flows(*flows, batches[b]);
+    }, [&]() {
+        flows->flush();
+    });
+
+    if (settings.reassembly_bytes > 0 || signatures) {
+        std::unique_ptr<AlertLog> alert_log(signatures ? new AlertLog(*signatures, null_device) : nullptr);
+        std::unique_ptr<CaptureContext> context;
+        time_stage(settings.reassembly_bytes > 0 ? "reassembly" : "signatures", [&]() {
+            context.reset(new CaptureContext());
+            configure_context(*context, settings, 1, false, exporter, signatures, alert_log.get());
+        }, [&](size_t b) {
+            if (context->streams) {
+                reassemble(context.get(), views.data() + b * DECODE_BATCH, batches[b]);
+            }
+            if (context->signatures) {
+                scan_payloads(context.get(), views.data() + b * DECODE_BATCH, batches[b]);
+                flush_alerts(context.get());
+            }
+        }, [&]() {
+            if (context->streams) {
+                context->streams->flush();
+            }
+            if (context->signatures) {
+                flush_alerts(context.get());
+            }
+        });
+    }
+
+    NullBuffer null_buffer;
+    std::streambuf* console = std::cout.rdbuf(&null_buffer);
+    time_stage("print", nothing, [&](size_t b) {
+        print_batch(views.data() + b * DECODE_BATCH, batches[b]);
+    }, nothing);
+    std::cout.rdbuf(console);
+
+    printf("  %-12s %8.1f ns/packet %10.3f Mpps (print included)\n", "total", total_ns, 1e3 / total_ns);
+    fclose(null_device);
+    return 0;
+}
+
+#ifdef __linux__
+// Sends the frames of a capture out of an interface through a raw packet
+// socket, sendmmsg batches paced to `pps` (0 sends as fast as the socket
+// takes them). Frames the kernel refuses are counted as dropped.
+int replay_capture(const std::string& path, const std::string& interface_name, uint64_t pps) {
+    MappedFile file;
+    std::vector<PacketView> views;
+    if (!load_packets(path, file, views)) {
+        return 1;
+    }
+    int ifindex = (int)if_nametoindex(interface_name.c_str());
+    if (ifindex == 0) {
+        std::cerr << "Unknown interface " << interface_name << std::endl;
+        return 1;
+    }
+    int fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    sockaddr_ll addr = {};
+    addr.sll_family = AF_PACKET;
+    addr.sll_ifindex = ifindex;
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        std::cerr << "Error opening packet socket on " << interface_name << ": " << strerror(errno)
+            << " (needs CAP_NET_RAW)" << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    const size_t max_batch = 64;
+    size_t batch_size = pps == 0 ? max_batch : (size_t)std::min<uint64_t>(std::max<uint64_t>(pps / 1000, 1), max_batch);
+    mmsghdr messages[max_batch];
+    iovec vectors[max_batch];
+    uint64_t sent = 0;
+    uint64_t dropped = 0;
+    uint64_t bytes = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < views.size();) {
+        if (pps != 0) {
+            std::this_thread::sleep_until(started + std::chrono::nanoseconds((sent + dropped) * 1000000000ull / pps));
+        }
+        size_t count = std::min(batch_size, views.size() - i);
+        for (size_t m = 0; m < count; ++m) {
+            vectors[m].iov_base = (void*)views[i + m].data;
+            vectors[m].iov_len = views[i + m].caplen;
+            messages[m] = {};
+            messages[m].msg_hdr.msg_iov = &vectors[m];
+            messages[m].msg_hdr.msg_iovlen = 1;
+        }
+        int result = sendmmsg(fd, messages, (unsigned int)count, 0);
+        if (result < 0) {
+            if (errno != ENOBUFS && errno != EAGAIN && errno != EMSGSIZE) {
+                std::cerr << "Error sending on " << interface_name << ": " << strerror(errno) << std::endl;
+                break;
+            }
+            // The first frame failed; skip it and retry the rest.
+            result = 0;
+            dropped++;
+            i++;
+        }
+        for (int m = 0; m < result; ++m) {
+            bytes += views[i + m].caplen;
+        }
+        sent += (uint64_t)result;
+        i += (size_t)result;
     }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    close(fd);
+
+    std::cout << "Sent " << sent << " packets (" << dropped << " dropped) in " << elapsed << " s: "
+        << sent / elapsed << " pps, " << bytes * 8 / elapsed / 1e6 << " Mbit/s" << std::endl;
+    return 0;
+}
+#endif
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [-r <file.pcap|file.pcapng> | -i <interface>] [options]\n"
+        << "  without -r or -i capture live from an interface chosen interactively\n"
+        << "  -r <file>        analyse a capture file instead\n"
+        << "  -i <interface>   capture on a TPACKET_V3 ring per thread with PACKET_FANOUT (Linux)\n"
+        << "  -d <seconds>     stop a -i capture after this long (default: until Ctrl+C)\n"
+        << "  -j <threads>     file split or capture threads (default: all cores)\n"
+        << "  -v               print every packet (single-threaded)\n"
+        << "  -F <flows>       flow table slots per thread (default 262144)\n"
+        << "  -I <seconds>     export flows idle this long (default 15)\n"
+        << "  -A <seconds>     export flows active this long (default 1800)\n"
+        << "  -R <MB>          reassemble TCP streams within this much memory; signatures then match\n"
+        << "                   across segments\n"
+        << "  -s <rules>       alert on payload signatures, one per line:\n"
+        << "                   id tcp|udp|any port|any offset depth \"content|0d 0a|\" message\n"
+        << "  --bench-decode   check and time the packet decoder on synthetic frames\n"
+        << "  --self-test      run regression checks on the flow table and TCP reassembler\n"
+        << "  --bench-signatures [rules]  time signature matching over a generated capture\n"
+        << "  --generate <file> [key=value,...]  write a synthetic capture; keys: packets, flows,\n"
+        << "                   tcp, udp, icmp, arp (weights), vlan, ipv6 (percent of flows),\n"
+        << "                   size (imix, uniform or bytes), rate (pps of timestamps), seed\n"
+        << "  --replay <file> <interface> [pps]  send a capture's frames out of an interface (Linux)\n"
+        << "  --bench-pipeline <file>  time decode, stats, flows, reassembly/signatures (with -R/-s)\n"
+        << "                   and print separately over a capture" << std::endl;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    std::string path;
+    std::string interface_name;
+    int duration_s = 0;
+    int threads = (int)std::thread::hardware_concurrency();
+    bool print = false;
+    AnalysisSettings settings;
+    std::string rules_path;
+    std::string pipeline_path;
+    for (int arg = 1; arg < argc; ++arg) {
+        std::string option = argv[arg];
+        if (option == "-v") {
+            print = true;
+        }
+        else if (option == "--bench-decode") {
+            return benchmark_decoder();
+        }
+        else if (option == "--self-test") {
+            return run_self_tests();
+        }
+        else if (option == "--bench-signatures") {
+            int rules = arg + 1 < argc ? atoi(argv[arg + 1]) : 0;
+            return benchmark_signatures(rules > 0 ? rules : 5000);
+        }
+        else if (option == "-s" && arg + 1 < argc) {
+            rules_path = argv[++arg];
+        }
+        else if (option == "--generate" && arg + 1 < argc) {
+            TrafficMix mix;
+            std::string target = argv[++arg];
+            if (arg + 1 < argc && argv[arg + 1][0] != '-' && !parse_traffic_mix(argv[++arg], mix)) {
+                std::cerr << "Bad traffic mix: " << argv[arg] << std::endl;
+                return 1;
+            }
+            return generate_traffic(target, mix);
+        }
+        else if (option == "--replay" && arg + 2 < argc) {
+#ifdef __linux__
+            std::string source = argv[++arg];
+            std::string target = argv[++arg];
+            uint64_t pps = arg + 1 < argc ? strtoull(argv[arg + 1], nullptr, 10) : 0;
+            return replay_capture(source, target, pps);
+#else
+            std::cerr << "--replay requires Linux." << std::endl;
+            return 1;
+#endif
+        }
+        else if (option == "--bench-pipeline" && arg + 1 < argc) {
+            pipeline_path = argv[++arg];
+        }
+        else if (option == "-r" && arg + 1 < argc) {
+            path = argv[++arg];
+        }
+        else if (option == "-i" && arg + 1 < argc) {
+            interface_name = argv[++arg];
+        }
+        else if (option == "-d" && arg + 1 < argc) {
+            duration_s = atoi(argv[++arg]);
+        }
+        else if (option == "-j" && arg + 1 < argc) {
+            threads = atoi(argv[++arg]);
+        }
+        else if (option == "-F" && arg + 1 < argc) {
+            settings.capacity = (size_t)std::max(atol(argv[++arg]), 16L);
+        }
+        else if (option == "-I" && arg + 1 < argc) {
+            settings.idle_timeout_us = (uint64_t)std::max(atol(argv[++arg]), 1L) * 1000000;
+        }
+        else if (option == "-A" && arg + 1 < argc) {
+            settings.active_timeout_us = (uint64_t)std::max(atol(argv[++arg]), 1L) * 1000000;
+        }
+        else if (option == "-R" && arg + 1 < argc) {
+            settings.reassembly_bytes = (size_t)std::max(atol(argv[++arg]), 1L) << 20;
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    SignatureEngine engine;
+    const SignatureEngine* signatures = nullptr;
+    if (!rules_path.empty()) {
+        std::string error;
+        if (!engine.load(rules_path, error)) {
+            std::cerr << "Error loading rules: " << error << std::endl;
+            return 1;
+        }
+        engine.compile();
+        signatures = &engine;
+        std::cerr << "Loaded " << engine.rule_count() << " signatures (" << engine.state_count()
+            << " automaton states)" << std::endl;
+    }
+    if (!pipeline_path.empty()) {
+        return benchmark_pipeline(pipeline_path, settings, signatures);
+    }
+    if (!path.empty()) {
+        return read_capture_file(path, threads, print, settings, signatures, stdout);
+    }
+    if (!interface_name.empty()) {
+#ifdef __linux__
+        return capture_interface(interface_name, threads, duration_s, print, settings, signatures);
+#else
+        std::cerr << "-i requires Linux; run without options to pick an interface." << std::endl;
+        return 1;
+#endif
+    }
+
     pcap_if_t* alldevs;
     pcap_if_t* d;
     char errbuf[PCAP_ERRBUF_SIZE];
@@ -100,7 +3576,19 @@ int main() {
         return 1;
     }
 
-    pcap_loop(fp, 0, packet_handler, NULL);
+    // pcap_dispatch returns at least once per read timeout, so idle flows
+    // are exported even when traffic stops.
+    FlowExporter exporter;
+    std::unique_ptr<AlertLog> alert_log(signatures ? new AlertLog(*signatures) : nullptr);
+    std::vector<CaptureContext> contexts(1);
+    CaptureContext& context = contexts[0];
+    configure_context(context, settings, 1, print, exporter, signatures, alert_log.get());
+    while (pcap_dispatch(fp, -1, packet_handler, (u_char*)&context) >= 0) {
+        context.flows->expire(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+    finish_context(context);
+    print_analysis(contexts, alert_log.get());
 
     pcap_freealldevs(alldevs);
     return 0;
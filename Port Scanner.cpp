@@ -1,217 +1,3259 @@
 #include <iostream>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <regex>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <iphlpapi.h>
 #include <icmpapi.h>
-#include <algorithm>
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "iphlpapi.lib")
 #pragma comment(lib, "Iphlpapi.lib")
+#else
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+
+typedef int SOCKET;
+typedef sockaddr SOCKADDR;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket close
+#define InetPtonA inet_pton
+#define InetNtopA inet_ntop
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <ifaddrs.h>
+#endif
+
+std::mutex cout_mutex;
+std::atomic<int> threads_completed(0);
+
+struct TargetRange {
+    uint32_t first;
+    uint64_t count;
+};
+
+// Targets are kept as host-order address ranges and expanded one index at a
+// time, so a /16 costs a few bytes until its hosts are actually probed.
+class TargetSet {
+public:
+    bool add_list(const std::string& specs) {
+        std::stringstream stream(specs);
+        std::string spec;
+        while (std::getline(stream, spec, ',')) {
+            if (!spec.empty() && !add(spec)) {
+                return false;
+            }
+        }
+        return total > 0;
+    }
+
+    bool add(const std::string& spec) {
+        if (spec[0] == '@') {
+            return add_file(spec.substr(1));
+        }
+
+        size_t slash = spec.find('/');
+        if (slash != std::string::npos) {
+            uint32_t addr;
+            long prefix;
+            if (!parse_ipv4(spec.substr(0, slash), addr) || !parse_number(spec.substr(slash + 1), 32, prefix)) {
+                return false;
+            }
+            uint32_t mask = prefix == 0 ? 0 : 0xFFFFFFFFu << (32 - prefix);
+            add_range(addr & mask, 1ull << (32 - prefix));
+            return true;
+        }
+
+        size_t dash = spec.find('-');
+        uint32_t first;
+        if (dash != std::string::npos && parse_ipv4(spec.substr(0, dash), first)) {
+            std::string upper = spec.substr(dash + 1);
+            uint32_t last;
+            if (upper.find('.') == std::string::npos) {
+                long octet;
+                if (!parse_number(upper, 255, octet)) {
+                    return false;
+                }
+                last = (first & 0xFFFFFF00u) | (uint32_t)octet;
+            }
+            else if (!parse_ipv4(upper, last)) {
+                return false;
+            }
+            if (last < first) {
+                return false;
+            }
+            add_range(first, (uint64_t)last - first + 1);
+            return true;
+        }
+
+        if (parse_ipv4(spec, first)) {
+            add_range(first, 1);
+            return true;
+        }
+
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(spec.c_str(), nullptr, &hints, &result) != 0) {
+            return false;
+        }
+        add_range(ntohl(((sockaddr_in*)result->ai_addr)->sin_addr.s_addr), 1);
+        freeaddrinfo(result);
+        return true;
+    }
+
+    uint64_t size() const {
+        return total;
+    }
+
+    // Appends one address in network byte order, extending the previous
+    // range when hosts arrive in ascending order.
+    void add_host(uint32_t addr) {
+        uint32_t host = ntohl(addr);
+        if (!ranges.empty() && ranges.back().first + ranges.back().count == host &&
+            sorted.back().first == ranges.back().first) {
+            ranges.back().count++;
+            sorted.back().count++;
+            total++;
+            return;
+        }
+        add_range(host, 1);
+    }
+
+    // Address of the index-th host, in network byte order.
+    uint32_t host_at(uint64_t index) const {
+        size_t range = std::upper_bound(offsets.begin(), offsets.end(), index) - offsets.begin() - 1;
+        return htonl(ranges[range].first + (uint32_t)(index - offsets[range]));
+    }
+
+    // Reverse of host_at, for matching replies back to work items.
+    bool index_of(uint32_t addr, uint64_t& index) const {
+        uint32_t host = ntohl(addr);
+        auto it = std::upper_bound(sorted.begin(), sorted.end(), host,
+            [](uint32_t value, const SortedRange& range) { return value < range.first; });
+        if (it == sorted.begin()) {
+            return false;
+        }
+        --it;
+        if (host - it->first >= it->count) {
+            return false;
+        }
+        index = it->offset + (host - it->first);
+        return true;
+    }
+
+private:
+    // Plain decimal digits only, so that "", "abc" or " 24" are rejected
+    // rather than read as 0; a /0 prefix is the whole address space.
+    static bool parse_number(const std::string& text, long max, long& value) {
+        if (text.empty() || text.size() > 3 || text.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        char* end = nullptr;
+        value = strtol(text.c_str(), &end, 10);
+        return *end == '\0' && value <= max;
+    }
+
+    static bool parse_ipv4(const std::string& text, uint32_t& addr) {
+        in_addr parsed;
+        if (InetPtonA(AF_INET, text.c_str(), &parsed) != 1) {
+            return false;
+        }
+        addr = ntohl(parsed.s_addr);
+        return true;
+    }
+
+    bool add_file(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+            line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+            if (!line.empty() && !add(line)) {
+                std::cerr << "Invalid target in " << path << ": " << line << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void add_range(uint32_t first, uint64_t count) {
+        ranges.push_back({ first, count });
+        offsets.push_back(total);
+
+        SortedRange entry = { first, count, total };
+        sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), entry,
+            [](const SortedRange& a, const SortedRange& b) { return a.first < b.first; }), entry);
+        total += count;
+    }
+
+    struct SortedRange {
+        uint32_t first;
+        uint64_t count;
+        uint64_t offset;
+    };
+
+    std::vector<TargetRange> ranges;
+    std::vector<uint64_t> offsets;
+    std::vector<SortedRange> sorted;
+    uint64_t total = 0;
+};
+
+enum OutputFormat {
+    OUTPUT_TEXT,
+    OUTPUT_JSONL,
+    OUTPUT_CSV,
+    OUTPUT_BINARY
+};
+
+struct ScanParams {
+    std::string target;
+    TargetSet targets;
+    unsigned short start_port;
+    unsigned short end_port;
+    int scan_type;
+    int timeout_ms;
+    int min_timeout_ms;
+    int max_retries;
+    int max_threads;
+    int max_inflight;
+    int max_rate;
+    OutputFormat output_format;
+    std::string output_path;
+    bool report_all;
+    bool skip_discovery;
+    bool detect_services;
+    bool bench;
+};
+
+enum PortState {
+    PORT_OPEN,
+    PORT_CLOSED,
+    PORT_FILTERED,
+    PORT_OPEN_FILTERED
+};
+
+static uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void set_nonblocking(SOCKET sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket(sock, FIONBIO, &mode);
+#else
+    int mode = 1;
+    ioctl(sock, FIONBIO, &mode);
+#endif
+}
+
+struct ScanResult {
+    uint64_t timestamp_us;
+    uint32_t addr;
+    uint32_t rtt_us;
+    uint16_t port;
+    uint8_t protocol;
+    uint8_t state;
+    char service[64];
+};
+
+// Bounded multi-producer, single-consumer ring (Vyukov's sequence-numbered
+// cells). Producers claim a cell with one CAS on the enqueue position and
+// never wait on each other; the single consumer needs no atomics of its own.
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1) {
+        for (size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_push(const T& value) {
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        Cell& cell = cells[dequeue_position & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if ((intptr_t)sequence - (intptr_t)(dequeue_position + 1) < 0) {
+            return false;
+        }
+        value = cell.value;
+        cell.sequence.store(dequeue_position + mask + 1, std::memory_order_release);
+        dequeue_position++;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_position{ 0 };
+    alignas(64) size_t dequeue_position = 0;
+};
+
+// Scan workers push results without taking a lock; one writer thread drains
+// the queue, formats records into a large buffer and writes it out in
+// blocks, flushing whenever the queue runs dry so output stays live.
+class ResultWriter {
+public:
+    ResultWriter() : queue(1 << 16) {}
+
+    bool open(OutputFormat output_format, const std::string& path, bool show_host) {
+        format = output_format;
+        multi_host = show_host;
+        if (path.empty() || path == "-") {
+            out = stdout;
+        }
+        else {
+            out = fopen(path.c_str(), format == OUTPUT_BINARY ? "wb" : "w");
+            if (out == nullptr) {
+                return false;
+            }
+        }
+
+        if (format == OUTPUT_CSV) {
+            buffer += "timestamp_us,ip,port,proto,state,rtt_ms,service\n";
+        }
+        else if (format == OUTPUT_BINARY) {
+            // "PSR1" magic, then fixed 20-byte little-endian records:
+            // u64 timestamp_us, u32 IPv4 (network order), u32 rtt_us,
+            // u16 port, u8 IP protocol, u8 state. Service names are not
+            // carried in binary output.
+            buffer.append("PSR1", 4);
+        }
+
+        running = true;
+        writer = std::thread(&ResultWriter::drain_loop, this);
+        return true;
+    }
+
+    void push(const ScanResult& result) {
+        while (!queue.try_push(result)) {
+            std::this_thread::yield();
+        }
+        pushed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Waits until everything pushed so far has been written out.
+    void sync() {
+        while (running && written.load() < pushed.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void close() {
+        if (!running) {
+            return;
+        }
+        running = false;
+        writer.join();
+        if (out != stdout) {
+            fclose(out);
+        }
+    }
+
+private:
+    static const char* state_name(uint8_t state) {
+        static const char* names[] = { "open", "closed", "filtered", "open|filtered" };
+        return names[state];
+    }
+
+    void format_result(const ScanResult& result) {
+        char ip_str[INET_ADDRSTRLEN];
+        InetNtopA(AF_INET, &result.addr, ip_str, INET_ADDRSTRLEN);
+        const char* protocol = result.protocol == IPPROTO_UDP ? "udp" : "tcp";
+        char line[256];
+        int length = 0;
+
+        switch (format) {
+        case OUTPUT_TEXT:
+            length = snprintf(line, sizeof(line), multi_host ? "Port %u is %s on %s" : "Port %u is %s",
+                result.port, state_name(result.state), ip_str);
+            if (result.service[0] != '\0') {
+                length += snprintf(line + length, sizeof(line) - length, " (%s)", result.service);
+            }
+            line[length++] = '\n';
+            break;
+        case OUTPUT_JSONL:
+            length = snprintf(line, sizeof(line),
+                "{\"ts\":%llu,\"ip\":\"%s\",\"port\":%u,\"proto\":\"%s\",\"state\":\"%s\",\"rtt_ms\":%.3f",
+                (unsigned long long)result.timestamp_us, ip_str, result.port, protocol,
+                state_name(result.state), result.rtt_us / 1000.0);
+            if (result.service[0] != '\0') {
+                length += snprintf(line + length, sizeof(line) - length, ",\"service\":\"%s\"", result.service);
+            }
+            line[length++] = '}';
+            line[length++] = '\n';
+            break;
+        case OUTPUT_CSV:
+            length = snprintf(line, sizeof(line), "%llu,%s,%u,%s,%s,%.3f,%s\n",
+                (unsigned long long)result.timestamp_us, ip_str, result.port, protocol,
+                state_name(result.state), result.rtt_us / 1000.0, result.service);
+            break;
+        case OUTPUT_BINARY: {
+            unsigned char* record = (unsigned char*)line;
+            for (int i = 0; i < 8; ++i) {
+                record[i] = (unsigned char)(result.timestamp_us >> (8 * i));
+            }
+            memcpy(record + 8, &result.addr, 4);
+            for (int i = 0; i < 4; ++i) {
+                record[12 + i] = (unsigned char)(result.rtt_us >> (8 * i));
+            }
+            record[16] = (unsigned char)result.port;
+            record[17] = (unsigned char)(result.port >> 8);
+            record[18] = result.protocol;
+            record[19] = result.state;
+            length = 20;
+            break;
+        }
+        }
+        buffer.append(line, (size_t)length);
+    }
+
+    void write_buffer() {
+        if (!buffer.empty()) {
+            fwrite(buffer.data(), 1, buffer.size(), out);
+            fflush(out);
+            buffer.clear();
+        }
+        written.store(formatted);
+    }
+
+    void drain_loop() {
+        const size_t block_size = 1 << 20;
+        buffer.reserve(block_size + 256);
+        ScanResult result;
+        for (;;) {
+            bool stopping = !running.load();
+            bool drained = false;
+            while (queue.try_pop(result)) {
+                format_result(result);
+                formatted++;
+                drained = true;
+                if (buffer.size() >= block_size) {
+                    write_buffer();
+                }
+            }
+            if (stopping) {
+                break;
+            }
+            if (!drained) {
+                write_buffer();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        write_buffer();
+    }
+
+    MpscQueue<ScanResult> queue;
+    OutputFormat format = OUTPUT_TEXT;
+    bool multi_host = false;
+    FILE* out = nullptr;
+    std::string buffer;
+    std::atomic<bool> running{ false };
+    std::atomic<uint64_t> pushed{ 0 };
+    std::atomic<uint64_t> written{ 0 };
+    uint64_t formatted = 0;
+    std::thread writer;
+};
+
+ResultWriter result_writer;
+std::ostream* info_out = &std::cout;
+
+void scan_completed() {
+    result_writer.sync();
+    *info_out << "Scan completed." << std::endl;
+}
+
+void report_result(const ScanParams& params, uint32_t addr, unsigned short port,
+    PortState state, double rtt_ms, const std::string& service = std::string()) {
+    if (state != PORT_OPEN && !params.report_all) {
+        return;
+    }
+    ScanResult result;
+    result.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    result.addr = addr;
+    result.rtt_us = (uint32_t)(rtt_ms * 1000);
+    result.port = port;
+    result.protocol = params.scan_type == 2 ? IPPROTO_UDP : IPPROTO_TCP;
+    result.state = (uint8_t)state;
+    snprintf(result.service, sizeof(result.service), "%s", service.c_str());
+    result_writer.push(result);
+}
+
+// Pseudo-random bijection on [0, size): a four-round Feistel network over the
+// next even power of two, cycle-walked back into range. Consecutive positions
+// land on unrelated (host, port) pairs, so no single target is hammered.
+class ProbePermutation {
+public:
+    ProbePermutation(uint64_t size, uint64_t seed) : size(size) {
+        int bits = 2;
+        while (bits < 64 && (1ull << bits) < size) {
+            bits += 2;
+        }
+        half_bits = bits / 2;
+        half_mask = (1ull << half_bits) - 1;
+
+        std::mt19937_64 gen(seed);
+        for (uint64_t& key : keys) {
+            key = gen();
+        }
+    }
+
+    uint64_t at(uint64_t position) const {
+        uint64_t value = position;
+        do {
+            value = encrypt(value);
+        } while (value >= size);
+        return value;
+    }
+
+private:
+    uint64_t encrypt(uint64_t value) const {
+        uint64_t left = value >> half_bits;
+        uint64_t right = value & half_mask;
+        for (uint64_t key : keys) {
+            uint64_t mixed = (right ^ key) * 0x9E3779B97F4A7C15ull;
+            mixed ^= mixed >> 29;
+            uint64_t next = left ^ (mixed & half_mask);
+            left = right;
+            right = next;
+        }
+        return (left << half_bits) | right;
+    }
+
+    uint64_t size;
+    int half_bits;
+    uint64_t half_mask;
+    uint64_t keys[4];
+};
+
+// Hands out batches of permutation positions. Every worker starts with an
+// equal share; a worker that runs dry steals the back half of the largest
+// remaining share, so a slow region never leaves the other threads idle.
+class WorkScheduler {
+public:
+    WorkScheduler(uint64_t total, int workers) {
+        for (int i = 0; i < workers; ++i) {
+            std::unique_ptr<Queue> queue(new Queue);
+            queue->next = total * i / workers;
+            queue->end = total * (i + 1) / workers;
+            queues.push_back(std::move(queue));
+        }
+    }
+
+    bool next_batch(int worker, uint64_t& begin, uint64_t& end) {
+        Queue& own = *queues[worker];
+        {
+            std::lock_guard<std::mutex> lock(own.lock);
+            if (own.next < own.end) {
+                begin = own.next;
+                end = std::min(own.end, own.next + batch_size);
+                own.next = end;
+                return true;
+            }
+        }
+
+        for (;;) {
+            Queue* victim = nullptr;
+            uint64_t largest = 0;
+            for (auto& queue : queues) {
+                std::lock_guard<std::mutex> lock(queue->lock);
+                if (queue->end - queue->next > largest) {
+                    largest = queue->end - queue->next;
+                    victim = queue.get();
+                }
+            }
+            if (victim == nullptr) {
+                return false;
+            }
+
+            uint64_t stolen_begin, stolen_end;
+            {
+                std::lock_guard<std::mutex> lock(victim->lock);
+                uint64_t remaining = victim->end - victim->next;
+                if (remaining == 0) {
+                    continue;
+                }
+                uint64_t take = remaining > 2 * batch_size ? remaining / 2 : remaining;
+                stolen_end = victim->end;
+                stolen_begin = stolen_end - take;
+                victim->end = stolen_begin;
+            }
+
+            std::lock_guard<std::mutex> lock(own.lock);
+            begin = stolen_begin;
+            end = std::min(stolen_end, stolen_begin + batch_size);
+            own.next = end;
+            own.end = stolen_end;
+            return true;
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        uint64_t next;
+        uint64_t end;
+    };
+
+    static const uint64_t batch_size = 64;
+    std::vector<std::unique_ptr<Queue>> queues;
+};
+
+// Lazily expands scheduler positions into (host, port) work items. The host
+// is the fastest-varying part of an item index so that even before the
+// permutation neighbouring items hit different targets.
+class ProbeSource {
+public:
+    ProbeSource(const ScanParams& params, const ProbePermutation& permutation,
+        WorkScheduler& scheduler, int worker)
+        : params(params), permutation(permutation), scheduler(scheduler), worker(worker) {}
+
+    bool next(uint32_t& addr, unsigned short& port) {
+        if (position == end && !scheduler.next_batch(worker, position, end)) {
+            return false;
+        }
+        uint64_t item = permutation.at(position++);
+        uint64_t hosts = params.targets.size();
+        addr = params.targets.host_at(item % hosts);
+        port = (unsigned short)(params.start_port + item / hosts);
+        return true;
+    }
+
+private:
+    const ScanParams& params;
+    const ProbePermutation& permutation;
+    WorkScheduler& scheduler;
+    int worker;
+    uint64_t position = 0;
+    uint64_t end = 0;
+};
+
+// Smoothed RTT and variance as in TCP's retransmission timer (RFC 6298).
+struct RttEstimator {
+    double srtt = 0;
+    double rttvar = 0;
+    bool sampled = false;
+
+    void sample(double rtt_ms) {
+        if (!sampled) {
+            srtt = rtt_ms;
+            rttvar = rtt_ms / 2;
+            sampled = true;
+            return;
+        }
+        rttvar = 0.75 * rttvar + 0.25 * std::fabs(srtt - rtt_ms);
+        srtt = 0.875 * srtt + 0.125 * rtt_ms;
+    }
+
+    double rto() const {
+        return srtt + 4 * rttvar;
+    }
+};
+
+// Per-host RTT estimates shared by all workers, striped by address so that
+// completions on different hosts rarely contend. Hosts without samples of
+// their own use the scan-wide estimate; the user's timeout is the ceiling.
+class HostTimingTable {
+public:
+    HostTimingTable(int min_timeout_ms, int max_timeout_ms)
+        : min_timeout_ms(min_timeout_ms), max_timeout_ms(max_timeout_ms) {}
+
+    int timeout_for(uint32_t addr, int attempt) {
+        RttEstimator estimate;
+        {
+            Stripe& stripe = stripes[stripe_of(addr)];
+            std::lock_guard<std::mutex> lock(stripe.lock);
+            auto it = stripe.hosts.find(addr);
+            if (it != stripe.hosts.end()) {
+                estimate = it->second;
+            }
+        }
+        if (!estimate.sampled) {
+            std::lock_guard<std::mutex> lock(global_lock);
+            estimate = global;
+        }
+        return backoff(estimate, attempt);
+    }
+
+    int scan_timeout(int attempt) {
+        std::lock_guard<std::mutex> lock(global_lock);
+        return backoff(global, attempt);
+    }
+
+    void record_rtt(uint32_t addr, double rtt_ms) {
+        {
+            Stripe& stripe = stripes[stripe_of(addr)];
+            std::lock_guard<std::mutex> lock(stripe.lock);
+            stripe.hosts[addr].sample(rtt_ms);
+        }
+        std::lock_guard<std::mutex> lock(global_lock);
+        global.sample(rtt_ms);
+    }
+
+    // Replies to retransmissions carry no RTT sample (Karn's rule) but still
+    // show that the host answers.
+    void record_reply(uint32_t addr) {
+        Stripe& stripe = stripes[stripe_of(addr)];
+        std::lock_guard<std::mutex> lock(stripe.lock);
+        stripe.hosts[addr];
+    }
+
+    bool has_answered(uint32_t addr) {
+        Stripe& stripe = stripes[stripe_of(addr)];
+        std::lock_guard<std::mutex> lock(stripe.lock);
+        return stripe.hosts.count(addr) != 0;
+    }
+
+    double smoothed_rtt() {
+        std::lock_guard<std::mutex> lock(global_lock);
+        return global.srtt;
+    }
+
+private:
+    struct Stripe {
+        std::mutex lock;
+        std::unordered_map<uint32_t, RttEstimator> hosts;
+    };
+
+    static size_t stripe_of(uint32_t addr) {
+        return (addr * 0x9E3779B1u) >> 26;
+    }
+
+    int backoff(const RttEstimator& estimate, int attempt) const {
+        double timeout = estimate.sampled ? std::max(estimate.rto(), (double)min_timeout_ms) : max_timeout_ms;
+        timeout *= (double)(1 << std::min(attempt, 8));
+        return (int)std::min(timeout, (double)max_timeout_ms);
+    }
+
+    int min_timeout_ms;
+    int max_timeout_ms;
+    Stripe stripes[64];
+    std::mutex global_lock;
+    RttEstimator global;
+};
+
+// Congestion-style limit on probes in flight: slow start until the first
+// loss, one probe per window of replies afterwards, and at most one halving
+// per smoothed RTT. ICMP errors count as loss, and so do timeouts on hosts
+// that have answered before. A timeout on a host that never answered says
+// nothing about congestion and completes like a reply, so filtered sweeps
+// still open the window.
+class CongestionWindow {
+public:
+    CongestionWindow(int min_window, int max_window)
+        : window(std::min(max_window, 16)), threshold(max_window),
+        min_window(min_window), max_window(max_window) {}
+
+    int limit() const {
+        return (int)window;
+    }
+
+    void on_reply() {
+        window += window < threshold ? 1.0 : 1.0 / window;
+        window = std::min(window, (double)max_window);
+    }
+
+    void on_loss(uint64_t now, double srtt_ms) {
+        if (now < recovery_until) {
+            return;
+        }
+        threshold = std::max(window / 2, (double)min_window);
+        window = threshold;
+        recovery_until = now + (uint64_t)std::max(srtt_ms, 1.0);
+    }
+
+private:
+    double window;
+    double threshold;
+    int min_window;
+    int max_window;
+    uint64_t recovery_until = 0;
+};
+
+#ifdef _WIN32
+bool is_host_alive(uint32_t addr) {
+    HANDLE hIcmpFile = IcmpCreateFile();
+    if (hIcmpFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    IPAddr ip_addr = addr;
+
+    char send_data[32] = "Echo Request";
+    char reply_buffer[sizeof(ICMP_ECHO_REPLY) + 32];
+    DWORD reply_size = sizeof(reply_buffer);
+
+    DWORD result = IcmpSendEcho(hIcmpFile, ip_addr, send_data, 32,
+        NULL, reply_buffer, reply_size, 1000);
+
+    IcmpCloseHandle(hIcmpFile);
+    return result > 0;
+}
+#else
+bool is_host_alive(uint32_t target) {
+    // Unprivileged ICMP datagram socket first, raw socket when running as root.
+    bool raw = false;
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+    if (sock == INVALID_SOCKET) {
+        sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+        raw = true;
+    }
+    if (sock == INVALID_SOCKET) {
+        return true;
+    }
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = target;
+
+    unsigned char packet[sizeof(icmphdr) + 32] = {};
+    icmphdr* icmp = (icmphdr*)packet;
+    icmp->type = ICMP_ECHO;
+    icmp->un.echo.id = htons((uint16_t)getpid());
+    icmp->un.echo.sequence = htons(1);
+    memcpy(packet + sizeof(icmphdr), "Echo Request", 12);
+
+    uint32_t sum = 0;
+    for (size_t i = 0; i < sizeof(packet); i += 2) {
+        sum += (packet[i] << 8) | packet[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    icmp->checksum = htons((uint16_t)~sum);
+
+    if (sendto(sock, packet, sizeof(packet), 0, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return false;
+    }
+
+    uint64_t deadline = now_ms() + 1000;
+    char reply[1500];
+    for (uint64_t now = now_ms(); now < deadline; now = now_ms()) {
+        pollfd pfd = { sock, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)(deadline - now)) <= 0) {
+            break;
+        }
+
+        sockaddr_in from = {};
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(sock, reply, sizeof(reply), 0, (SOCKADDR*)&from, &from_len);
+        if (len <= 0 || from.sin_addr.s_addr != addr.sin_addr.s_addr) {
+            continue;
+        }
+
+        size_t offset = raw ? (size_t)(reply[0] & 0x0F) * 4 : 0;
+        if ((size_t)len >= offset + sizeof(icmphdr) &&
+            ((icmphdr*)(reply + offset))->type == ICMP_ECHOREPLY) {
+            closesocket(sock);
+            return true;
+        }
+    }
+
+    closesocket(sock);
+    return false;
+}
+#endif
+
+// Service detection. Probes are sent on an open connection only when the
+// service does not volunteer a banner on its own; replies are matched
+// against a signature table compiled once at startup. Soft signatures
+// identify a protocol family and keep reading in case a more specific
+// signature matches once more of the reply has arrived.
+struct ServiceProbe {
+    const char* data;
+    size_t length;
+    const unsigned short* ports;
+    size_t port_count;
+};
+
+static const char http_probe[] = "GET / HTTP/1.0\r\n\r\n";
+static const char redis_probe[] = "*1\r\n$4\r\nPING\r\n";
+static const char memcached_probe[] = "version\r\n";
+static const char rtsp_probe[] = "OPTIONS / RTSP/1.0\r\nCSeq: 1\r\n\r\n";
+
+static const unsigned short http_ports[] = { 80, 81, 443, 591, 3000, 5000, 8000, 8008, 8080, 8081, 8443, 8888, 9200 };
+static const unsigned short redis_ports[] = { 6379 };
+static const unsigned short memcached_ports[] = { 11211 };
+static const unsigned short rtsp_ports[] = { 554, 8554 };
+
+static const ServiceProbe service_probes[] = {
+    { http_probe, sizeof(http_probe) - 1, http_ports, sizeof(http_ports) / sizeof(http_ports[0]) },
+    { redis_probe, sizeof(redis_probe) - 1, redis_ports, 1 },
+    { memcached_probe, sizeof(memcached_probe) - 1, memcached_ports, 1 },
+    { rtsp_probe, sizeof(rtsp_probe) - 1, rtsp_ports, 2 },
+};
+
+// Probe sent straight after connecting, or nullptr to wait for a banner first.
+static const ServiceProbe* service_probe_for(unsigned short port) {
+    for (const ServiceProbe& probe : service_probes) {
+        if (std::find(probe.ports, probe.ports + probe.port_count, port) != probe.ports + probe.port_count) {
+            return &probe;
+        }
+    }
+    return nullptr;
+}
+
+// Sent to silent services once the banner wait has run out.
+static const ServiceProbe& fallback_service_probe() {
+    return service_probes[0];
+}
+
+struct ServiceSignature {
+    const char* service;
+    const char* prefix;
+    const char* pattern;
+    bool soft;
+    bool icase;
+};
+
+// Capture group 1, when present, is reported as the product/version string.
+// The prefix is a literal the banner must start with; it is checked before
+// the regex runs, so most signatures cost a memcmp.
+static const ServiceSignature service_signatures[] = {
+    { "ssh", "SSH-", "^SSH-[\\d.]+-([^\\r\\n]+)", false, false },
+    { "smtp", "220", "^220[ -]([^\\r\\n]*(?:E?SMTP|Postfix|Exim|Sendmail)[^\\r\\n]*)", false, true },
+    { "ftp", "220", "^220[ -]([^\\r\\n]*FTP[^\\r\\n]*)", false, true },
+    { "ftp", "220", "^220[ -]([^\\r\\n]*)", true, false },
+    { "pop3", "+OK ", "^\\+OK ([^\\r\\n]*)", false, false },
+    { "imap", "* OK ", "^\\* OK ([^\\r\\n]*)", false, false },
+    { "http", "HTTP/1.", "^HTTP/1\\.[01] \\d{3}[\\s\\S]*?\\r\\nServer: *([^\\r\\n]+)", false, true },
+    { "http", "HTTP/1.", "^HTTP/1\\.[01] \\d{3}", true, false },
+    { "rtsp", "RTSP/1.0 ", "^RTSP/1\\.0 \\d{3}", false, false },
+    { "ssl", "", "^(?:\\x15|\\x16)\\x03(?:\\x00|\\x01|\\x02|\\x03|\\x04)", false, false },
+    { "mysql", "", "^[\\s\\S]\\x00\\x00\\x00\\x0a([0-9][^\\x00]*)\\x00", false, false },
+    { "redis", "", "^(?:\\+PONG|-NOAUTH)", false, false },
+    { "memcached", "VERSION ", "^VERSION ([^\\r\\n]+)", false, false },
+    { "vnc", "RFB ", "^RFB (\\d{3}\\.\\d{3})", false, false },
+    { "telnet", "\xff", "^\\xff(?:\\xfb|\\xfc|\\xfd|\\xfe)", false, false },
+};
+
+class ServiceMatcher {
+public:
+    static const size_t banner_size = 1024;
+    // std::regex backtracks; bounding its input bounds the work a hostile
+    // banner can cause. Every signature is anchored well inside this.
+    static const size_t match_limit = 512;
+
+    ServiceMatcher() {
+        for (const ServiceSignature& signature : service_signatures) {
+            std::regex::flag_type flags = std::regex::ECMAScript | std::regex::optimize;
+            if (signature.icase) {
+                flags |= std::regex::icase;
+            }
+            compiled.push_back({ &signature, strlen(signature.prefix), std::regex(signature.pattern, flags) });
+        }
+    }
+
+    // Sets `service` to the first matching signature ("name version") and
+    // returns true when that match is final. Unmatched data yields "unknown".
+    // Reusing one `service` string across calls avoids allocating per read.
+    bool identify(const char* data, size_t length, std::string& service) const {
+        service.clear();
+        if (length == 0) {
+            return false;
+        }
+        length = std::min(length, match_limit);
+        thread_local std::cmatch match;
+        for (const Compiled& entry : compiled) {
+            if (length < entry.prefix_length || memcmp(data, entry.signature->prefix, entry.prefix_length) != 0 ||
+                !std::regex_search(data, data + length, match, entry.regex)) {
+                continue;
+            }
+            service = entry.signature->service;
+            if (match.size() > 1 && match[1].length() > 0) {
+                service += ' ';
+                const char* version_end = match[1].first + std::min<ptrdiff_t>(match[1].length(), 48);
+                for (const char* c = match[1].first; c < version_end; ++c) {
+                    // Versions end up in JSON and CSV output unescaped.
+                    service += isprint((unsigned char)*c) && *c != '"' && *c != '\\' && *c != ',' ? *c : '_';
+                }
+            }
+            return !entry.signature->soft;
+        }
+        service = "unknown";
+        return false;
+    }
+
+private:
+    struct Compiled {
+        const ServiceSignature* signature;
+        size_t prefix_length;
+        std::regex regex;
+    };
+
+    std::vector<Compiled> compiled;
+};
+
+static const ServiceMatcher& service_matcher() {
+    static const ServiceMatcher matcher;
+    return matcher;
+}
+
+// Blocking detection on an already connected non-blocking socket, used by
+// the thread-per-probe connect scan. Half the budget waits for a banner.
+static std::string grab_service(SOCKET sock, unsigned short port, int timeout_ms) {
+    char banner[ServiceMatcher::banner_size];
+    size_t received = 0;
+    std::string service;
+
+    const ServiceProbe* probe = service_probe_for(port);
+    if (probe != nullptr) {
+        send(sock, probe->data, (int)probe->length, 0);
+    }
+    uint64_t deadline = now_ms() + (probe != nullptr ? timeout_ms : timeout_ms / 2);
+
+    for (;;) {
+        uint64_t now = now_ms();
+        if (now >= deadline) {
+            if (probe != nullptr || received > 0) {
+                break;
+            }
+            probe = &fallback_service_probe();
+            send(sock, probe->data, (int)probe->length, 0);
+            deadline = now + timeout_ms / 2;
+            continue;
+        }
+
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(sock, &readfds);
+        timeval timeout;
+        timeout.tv_sec = (long)((deadline - now) / 1000);
+        timeout.tv_usec = (long)((deadline - now) % 1000) * 1000;
+        if (select((int)sock + 1, &readfds, NULL, NULL, &timeout) <= 0) {
+            continue;
+        }
+
+        int length = recv(sock, banner + received, (int)(sizeof(banner) - received), 0);
+        if (length <= 0) {
+            break;
+        }
+        received += (size_t)length;
+        if (service_matcher().identify(banner, received, service) || received == sizeof(banner)) {
+            return service;
+        }
+    }
+
+    service_matcher().identify(banner, received, service);
+    return service;
+}
+
+PortState tcp_connect_scan(uint32_t target, unsigned short port, int timeout_ms, double& rtt_ms,
+    std::string* banner_service = nullptr, int banner_timeout_ms = 0) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) {
+        return PORT_FILTERED;
+    }
+
+    sockaddr_in service;
+    service.sin_family = AF_INET;
+    service.sin_addr.s_addr = target;
+    service.sin_port = htons(port);
+
+    set_nonblocking(sock);
+
+    uint64_t started = now_us();
+    connect(sock, (SOCKADDR*)&service, sizeof(service));
+
+    fd_set writefds;
+    FD_ZERO(&writefds);
+    FD_SET(sock, &writefds);
+
+    timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int result = select((int)sock + 1, NULL, &writefds, NULL, &timeout);
+    rtt_ms = (now_us() - started) / 1000.0;
+    if (result <= 0) {
+        closesocket(sock);
+        return PORT_FILTERED;
+    }
+
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&error, &error_len);
+
+    if (error == 0 && banner_service != nullptr) {
+        *banner_service = grab_service(sock, port, banner_timeout_ms);
+    }
+    closesocket(sock);
+#ifdef _WIN32
+    return error == 0 ? PORT_OPEN : error == WSAECONNREFUSED ? PORT_CLOSED : PORT_FILTERED;
+#else
+    return error == 0 ? PORT_OPEN : error == ECONNREFUSED ? PORT_CLOSED : PORT_FILTERED;
+#endif
+}
+
+struct UdpPayload {
+    unsigned short port;
+    const unsigned char* data;
+    size_t length;
+};
+
+static const unsigned char dns_payload[] = {
+    0x13, 0x37, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x07, 'v', 'e', 'r', 's', 'i', 'o', 'n', 0x04, 'b', 'i', 'n', 'd', 0x00,
+    0x00, 0x10, 0x00, 0x03
+};
+
+static const unsigned char tftp_payload[] = {
+    0x00, 0x01, 'r', '.', 't', 'x', 't', 0x00, 'o', 'c', 't', 'e', 't', 0x00
+};
+
+static const unsigned char portmap_payload[] = {
+    0x72, 0xFE, 0x1D, 0x13, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x01, 0x86, 0xA0, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char ntp_payload[48] = { 0xE3, 0x00, 0x04, 0xFA };
+
+static const unsigned char netbios_payload[] = {
+    0x80, 0xF0, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x20, 'C', 'K', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A',
+    'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A',
+    'A', 'A', 'A', 'A', 'A', 0x00, 0x00, 0x21, 0x00, 0x01
+};
+
+static const unsigned char snmp_payload[] = {
+    0x30, 0x29, 0x02, 0x01, 0x00, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+    0xA0, 0x1C, 0x02, 0x04, 0x12, 0x34, 0x56, 0x78, 0x02, 0x01, 0x00, 0x02,
+    0x01, 0x00, 0x30, 0x0E, 0x30, 0x0C, 0x06, 0x08, 0x2B, 0x06, 0x01, 0x02,
+    0x01, 0x01, 0x01, 0x00, 0x05, 0x00
+};
+
+static const unsigned char ssdp_payload[] =
+    "M-SEARCH * HTTP/1.1\r\nHOST: 239.255.255.250:1900\r\n"
+    "MAN: \"ssdp:discover\"\r\nMX: 1\r\nST: ssdp:all\r\n\r\n";
+
+static const unsigned char nat_pmp_payload[] = { 0x00, 0x00 };
+
+static const unsigned char sip_payload[] =
+    "OPTIONS sip:nm SIP/2.0\r\nVia: SIP/2.0/UDP nm;branch=z9hG4bK;rport\r\n"
+    "From: <sip:nm@nm>;tag=root\r\nTo: <sip:nm2@nm2>\r\nCall-ID: 50000\r\n"
+    "CSeq: 42 OPTIONS\r\nMax-Forwards: 70\r\nContent-Length: 0\r\n\r\n";
+
+static const unsigned char mdns_payload[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x09, '_', 's', 'e', 'r', 'v', 'i', 'c', 'e', 's', 0x07, '_', 'd', 'n',
+    's', '-', 's', 'd', 0x04, '_', 'u', 'd', 'p', 0x05, 'l', 'o', 'c', 'a',
+    'l', 0x00, 0x00, 0x0C, 0x00, 0x01
+};
+
+static const unsigned char memcached_payload[] = {
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 's', 't', 'a', 't', 's', '\r', '\n'
+};
+
+// Sorted by port. Services that ignore an empty datagram answer these, so a
+// reply (not just the absence of an ICMP error) marks the port open.
+static const UdpPayload udp_payloads[] = {
+    { 53, dns_payload, sizeof(dns_payload) },
+    { 69, tftp_payload, sizeof(tftp_payload) },
+    { 111, portmap_payload, sizeof(portmap_payload) },
+    { 123, ntp_payload, sizeof(ntp_payload) },
+    { 137, netbios_payload, sizeof(netbios_payload) },
+    { 161, snmp_payload, sizeof(snmp_payload) },
+    { 1900, ssdp_payload, sizeof(ssdp_payload) - 1 },
+    { 5060, sip_payload, sizeof(sip_payload) - 1 },
+    { 5351, nat_pmp_payload, sizeof(nat_pmp_payload) },
+    { 5353, mdns_payload, sizeof(mdns_payload) },
+    { 11211, memcached_payload, sizeof(memcached_payload) },
+};
+
+static const UdpPayload* udp_payload_for(unsigned short port) {
+    static const UdpPayload empty = { 0, nullptr, 0 };
+    for (const UdpPayload& payload : udp_payloads) {
+        if (payload.port == port) {
+            return &payload;
+        }
+    }
+    return &empty;
+}
+
+// A connected UDP socket reports the ICMP port unreachable of a closed port
+// as a connection-refused error on the next receive.
+PortState udp_scan(uint32_t target, unsigned short port, int timeout_ms) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+        return PORT_FILTERED;
+    }
+
+    sockaddr_in service;
+    service.sin_family = AF_INET;
+    service.sin_addr.s_addr = target;
+    service.sin_port = htons(port);
+
+    if (connect(sock, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return PORT_FILTERED;
+    }
+
+    const UdpPayload* payload = udp_payload_for(port);
+    int sent = send(sock, (const char*)payload->data, (int)payload->length, 0);
+    if (sent == SOCKET_ERROR) {
+        closesocket(sock);
+        return PORT_FILTERED;
+    }
+
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(sock, &readfds);
+
+    timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int result = select((int)sock + 1, &readfds, NULL, NULL, &timeout);
+    if (result <= 0) {
+        closesocket(sock);
+        return PORT_OPEN_FILTERED;
+    }
+
+    char recv_buf[256];
+    int received = recv(sock, recv_buf, sizeof(recv_buf), 0);
+
+    closesocket(sock);
+    if (received != SOCKET_ERROR) {
+        return PORT_OPEN;
+    }
+#ifdef _WIN32
+    return WSAGetLastError() == WSAECONNRESET ? PORT_CLOSED : PORT_FILTERED;
+#else
+    return errno == ECONNREFUSED ? PORT_CLOSED : PORT_FILTERED;
+#endif
+}
+
+#ifdef __linux__
+// Hashed timer wheel with 1 ms ticks. Entries carry the probe generation so
+// a slot that was completed and reused before its old deadline is ignored;
+// deadlines further out than one revolution are re-armed when they come up.
+class TimerWheel {
+public:
+    struct Entry {
+        uint32_t slot;
+        uint32_t generation;
+        uint64_t deadline;
+    };
+
+    explicit TimerWheel(size_t bucket_count = 4096)
+        : buckets(bucket_count), mask(bucket_count - 1), current(now_ms()) {}
+
+    void schedule(uint32_t slot, uint32_t generation, uint64_t deadline) {
+        if (deadline < current) {
+            deadline = current;
+        }
+        buckets[deadline & mask].push_back({ slot, generation, deadline });
+    }
+
+    int ms_until_next(uint64_t now, int cap_ms) const {
+        uint64_t limit = std::min<uint64_t>((uint64_t)cap_ms, mask + 1);
+        for (uint64_t tick = std::max(current, now), steps = 0; steps < limit; ++tick, ++steps) {
+            if (!buckets[tick & mask].empty()) {
+                return (int)steps;
+            }
+        }
+        return cap_ms;
+    }
+
+    template <typename Expire>
+    void advance(uint64_t now, Expire expire) {
+        if (now < current) {
+            return;
+        }
+        if (now - current > mask) {
+            current = now - mask;
+        }
+        for (; current <= now; ++current) {
+            std::vector<Entry>& bucket = buckets[current & mask];
+            if (bucket.empty()) {
+                continue;
+            }
+            pending.swap(bucket);
+            for (const Entry& entry : pending) {
+                if (entry.deadline > now) {
+                    buckets[entry.deadline & mask].push_back(entry);
+                }
+                else {
+                    expire(entry);
+                }
+            }
+            pending.clear();
+        }
+    }
+
+private:
+    std::vector<std::vector<Entry>> buckets;
+    std::vector<Entry> pending;
+    uint64_t mask;
+    uint64_t current;
+};
+
+// Fixed-size receive buffers carved from one slab, handed out and returned
+// by a single event loop without touching the heap per connection.
+class BufferPool {
+public:
+    BufferPool(size_t block_size, size_t count) : block_size(block_size), storage(block_size * count) {
+        free_blocks.reserve(count);
+        for (size_t i = count; i-- > 0;) {
+            free_blocks.push_back(storage.data() + i * block_size);
+        }
+    }
+
+    char* acquire() {
+        if (free_blocks.empty()) {
+            return nullptr;
+        }
+        char* block = free_blocks.back();
+        free_blocks.pop_back();
+        return block;
+    }
+
+    void release(char* block) {
+        free_blocks.push_back(block);
+    }
+
+    size_t block() const {
+        return block_size;
+    }
+
+private:
+    size_t block_size;
+    std::vector<char> storage;
+    std::vector<char*> free_blocks;
+};
+
+struct ConnectProbe {
+    uint32_t addr;
+    unsigned short port;
+    int attempt;
+};
+
+// Keeps up to `window` non-blocking connects outstanding from one epoll loop.
+// The scan time of a filtered range is bounded by window and timeout rather
+// than by how many threads are available. Within the window the number of
+// probes actually in flight follows a congestion window, and each probe's
+// deadline comes from its host's RTT estimate.
+//
+// With service detection on, an open connection stays in its slot and moves
+// to a read phase on the same loop: port probing carries on around it, and
+// detecting slots do not count against the congestion window.
+class EpollConnectEngine {
+public:
+    EpollConnectEngine(int window, HostTimingTable& timing, int max_retries, int banner_timeout_ms = 0)
+        : timing(timing), max_retries(max_retries), banner_timeout_ms(banner_timeout_ms),
+          congestion(std::min(window, 4), window), slots(window),
+          banners(ServiceMatcher::banner_size, banner_timeout_ms > 0 ? (size_t)window : 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        free_slots.reserve(window);
+        for (int i = window - 1; i >= 0; --i) {
+            free_slots.push_back((uint32_t)i);
+        }
+    }
+
+    ~EpollConnectEngine() {
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+    }
+
+    bool valid() const {
+        return epoll_fd >= 0;
+    }
+
+    template <typename Source, typename Sink>
+    void run(Source next_probe, Sink on_result) {
+        std::vector<epoll_event> events(1024);
+        std::vector<ConnectProbe> deferred;
+        bool source_done = false;
+
+        for (;;) {
+            bool backoff = false;
+            while (!backoff && !free_slots.empty() && inflight < congestion.limit()) {
+                ConnectProbe probe;
+                if (!deferred.empty()) {
+                    probe = deferred.back();
+                    deferred.pop_back();
+                }
+                else if (source_done || !next_probe(probe)) {
+                    source_done = true;
+                    break;
+                }
+                backoff = !launch(probe, on_result, deferred);
+            }
+
+            if (inflight == 0 && detecting == 0 && deferred.empty() && source_done) {
+                break;
+            }
+
+            uint64_t now = now_ms();
+            int wait_ms = wheel.ms_until_next(now, 1000);
+            if (backoff && wait_ms > 1) {
+                wait_ms = 1;
+            }
+
+            int count = epoll_wait(epoll_fd, events.data(), (int)events.size(), wait_ms);
+            now = now_ms();
+            for (int i = 0; i < count; ++i) {
+                uint32_t index = events[i].data.u32;
+                Slot& slot = slots[index];
+                if (slot.banner != nullptr) {
+                    read_banner(index, on_result);
+                    continue;
+                }
+
+                int error = 0;
+                socklen_t error_len = sizeof(error);
+                getsockopt(slot.fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+
+                PortState state = PORT_FILTERED;
+                if (error == 0 && (events[i].events & EPOLLOUT)) {
+                    state = PORT_OPEN;
+                }
+                else if (error == ECONNREFUSED) {
+                    state = PORT_CLOSED;
+                }
+
+                double rtt_ms = (now_us() - slot.started_us) / 1000.0;
+                if (state == PORT_FILTERED) {
+                    // Host or network unreachable: an ICMP error, possibly rate limited.
+                    congestion.on_loss(now, timing.smoothed_rtt());
+                }
+                else {
+                    congestion.on_reply();
+                    if (slot.probe.attempt == 0) {
+                        timing.record_rtt(slot.probe.addr, rtt_ms);
+                    }
+                    else {
+                        timing.record_reply(slot.probe.addr);
+                    }
+                }
+                if (state == PORT_OPEN && banner_timeout_ms > 0 && begin_detection(index, rtt_ms, now)) {
+                    continue;
+                }
+                finish(index, state, rtt_ms, on_result);
+            }
+
+            wheel.advance(now, [&](const TimerWheel::Entry& entry) {
+                Slot& slot = slots[entry.slot];
+                if (slot.fd < 0 || slot.generation != entry.generation) {
+                    return;
+                }
+                if (slot.banner != nullptr) {
+                    banner_timeout(entry.slot, now, on_result);
+                    return;
+                }
+                if (timing.has_answered(slot.probe.addr)) {
+                    congestion.on_loss(now, timing.smoothed_rtt());
+                }
+                else {
+                    congestion.on_reply();
+                }
+                if (slot.probe.attempt < max_retries) {
+                    ConnectProbe retry = slot.probe;
+                    retry.attempt++;
+                    deferred.push_back(retry);
+                    release(entry.slot);
+                }
+                else {
+                    finish(entry.slot, PORT_FILTERED, (now_us() - slot.started_us) / 1000.0, on_result);
+                }
+            });
+        }
+    }
+
+private:
+    struct Slot {
+        int fd = -1;
+        uint32_t generation = 0;
+        uint64_t started_us = 0;
+        ConnectProbe probe = {};
+        char* banner = nullptr;
+        size_t received = 0;
+        bool probe_sent = false;
+        double rtt_ms = 0;
+    };
+
+    template <typename Sink>
+    bool launch(const ConnectProbe& probe, Sink& on_result, std::vector<ConnectProbe>& deferred) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (fd < 0) {
+            deferred.push_back(probe);
+            return false;
+        }
+
+        // Abortive close: no FIN handshake and no TIME_WAIT entry per probe.
+        linger abort_close = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = probe.addr;
+        addr.sin_port = htons(probe.port);
+
+        uint64_t started = now_ms();
+        bool connected = connect(fd, (SOCKADDR*)&addr, sizeof(addr)) == 0;
+        if (connected && banner_timeout_ms == 0) {
+            close(fd);
+            on_result(probe, PORT_OPEN, 0.0, std::string());
+            return true;
+        }
+
+        if (!connected && errno != EINPROGRESS) {
+            int error = errno;
+            close(fd);
+            if (error == EAGAIN || error == EADDRNOTAVAIL || error == ENOBUFS) {
+                deferred.push_back(probe);
+                return false;
+            }
+            on_result(probe, error == ECONNREFUSED ? PORT_CLOSED : PORT_FILTERED, 0.0, std::string());
+            return true;
+        }
+
+        uint32_t index = free_slots.back();
+        free_slots.pop_back();
+        Slot& slot = slots[index];
+        slot.fd = fd;
+        slot.probe = probe;
+        slot.started_us = now_us();
+        slot.generation++;
+
+        epoll_event event = {};
+        event.events = EPOLLOUT | EPOLLERR | EPOLLHUP;
+        event.data.u32 = index;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+        wheel.schedule(index, slot.generation, started + timing.timeout_for(probe.addr, probe.attempt));
+        inflight++;
+
+        if (connected && !begin_detection(index, 0.0, started)) {
+            finish(index, PORT_OPEN, 0.0, on_result);
+        }
+        return true;
+    }
+
+    void release(uint32_t index) {
+        Slot& slot = slots[index];
+        close(slot.fd);
+        slot.fd = -1;
+        slot.generation++;
+        free_slots.push_back(index);
+        if (slot.banner != nullptr) {
+            banners.release(slot.banner);
+            slot.banner = nullptr;
+            detecting--;
+        }
+        else {
+            inflight--;
+        }
+    }
+
+    bool begin_detection(uint32_t index, double rtt_ms, uint64_t now) {
+        Slot& slot = slots[index];
+        slot.banner = banners.acquire();
+        if (slot.banner == nullptr) {
+            return false;
+        }
+        slot.received = 0;
+        slot.rtt_ms = rtt_ms;
+        slot.generation++;
+        inflight--;
+        detecting++;
+
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u32 = index;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, slot.fd, &event);
+
+        // Services that talk first get half the budget to do so before the
+        // fallback probe goes out.
+        const ServiceProbe* probe = service_probe_for(slot.probe.port);
+        slot.probe_sent = probe != nullptr;
+        if (probe != nullptr) {
+            send(slot.fd, probe->data, probe->length, MSG_NOSIGNAL);
+        }
+        wheel.schedule(index, slot.generation, now + (probe != nullptr ? banner_timeout_ms : banner_timeout_ms / 2));
+        return true;
+    }
+
+    template <typename Sink>
+    void read_banner(uint32_t index, Sink& on_result) {
+        Slot& slot = slots[index];
+        for (;;) {
+            ssize_t length = recv(slot.fd, slot.banner + slot.received, banners.block() - slot.received, MSG_DONTWAIT);
+            if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (length <= 0) {
+                break;
+            }
+            slot.received += (size_t)length;
+            if (service_matcher().identify(slot.banner, slot.received, scratch_service) || slot.received == banners.block()) {
+                break;
+            }
+        }
+        finish_detection(index, on_result);
+    }
+
+    template <typename Sink>
+    void banner_timeout(uint32_t index, uint64_t now, Sink& on_result) {
+        Slot& slot = slots[index];
+        if (slot.probe_sent || slot.received > 0) {
+            finish_detection(index, on_result);
+            return;
+        }
+        const ServiceProbe& probe = fallback_service_probe();
+        send(slot.fd, probe.data, probe.length, MSG_NOSIGNAL);
+        slot.probe_sent = true;
+        slot.generation++;
+        wheel.schedule(index, slot.generation, now + banner_timeout_ms / 2);
+    }
+
+    template <typename Sink>
+    void finish_detection(uint32_t index, Sink& on_result) {
+        Slot& slot = slots[index];
+        std::string service;
+        service_matcher().identify(slot.banner, slot.received, service);
+        double rtt_ms = slot.rtt_ms;
+        release(index);
+        on_result(slot.probe, PORT_OPEN, rtt_ms, service);
+    }
+
+    template <typename Sink>
+    void finish(uint32_t index, PortState state, double rtt_ms, Sink& on_result) {
+        release(index);
+        on_result(slots[index].probe, state, rtt_ms, std::string());
+    }
+
+    HostTimingTable& timing;
+    int max_retries;
+    int banner_timeout_ms;
+    CongestionWindow congestion;
+    int epoll_fd = -1;
+    int inflight = 0;
+    int detecting = 0;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    BufferPool banners;
+    TimerWheel wheel;
+    std::string scratch_service;
+};
+
+// Each in-flight connect holds a descriptor, so the window is capped by
+// RLIMIT_NOFILE after raising the soft limit as far as the hard limit allows.
+static int clamp_inflight_window(int requested) {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return std::min(requested, 1000);
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const rlim_t reserved = 64;
+    rlim_t available = limit.rlim_cur > reserved ? limit.rlim_cur - reserved : 1;
+    return (int)std::min<rlim_t>((rlim_t)requested, available);
+}
+
+void epoll_connect_worker(const ScanParams& params, ProbeSource& source, HostTimingTable& timing, int window) {
+    EpollConnectEngine engine(window, timing, params.max_retries, params.detect_services ? params.timeout_ms : 0);
+    if (!engine.valid()) {
+        std::cerr << "epoll_create1 failed." << std::endl;
+        return;
+    }
+
+    engine.run(
+        [&](ConnectProbe& probe) {
+            probe.attempt = 0;
+            return source.next(probe.addr, probe.port);
+        },
+        [&](const ConnectProbe& probe, PortState state, double rtt_ms, const std::string& service) {
+            report_result(params, probe.addr, probe.port, state, rtt_ms, service);
+        });
+}
+
+struct ReplyCounters {
+    std::atomic<uint64_t> replies{ 0 };
+    std::atomic<uint64_t> icmp_errors{ 0 };
+    std::atomic<uint32_t> min_rtt_ms{ UINT32_MAX };
+};
+
+// Token-bucket pacing for the raw and batched engines. The rate starts at
+// the configured maximum (-R) and halves when ICMP errors arrive or the
+// smoothed RTT climbs well above the best seen (queues building up); every
+// 100 ms window of sending without such signs grows it back by half, replies
+// or not, so a sparse or dead range is not crawled at the backed-off rate.
+class AdaptiveRate {
+public:
+    AdaptiveRate(double max_rate, const ReplyCounters& counters, HostTimingTable& timing)
+        : rate(max_rate), min_rate(std::min(100.0, max_rate)), max_rate(max_rate),
+        counters(counters), timing(timing) {
+        last_refill = now_ms();
+        next_adjust = last_refill + 100;
+    }
+
+    double current() const {
+        return rate;
+    }
+
+    int batch_limit(int max_batch) const {
+        return (int)std::min<double>(max_batch, std::max(rate / 100, 1.0));
+    }
+
+    void halve() {
+        rate = std::max(rate / 2, min_rate);
+    }
+
+    void acquire(int count) {
+        while (tokens < count) {
+            uint64_t now = now_ms();
+            tokens = std::min(tokens + rate * (now - last_refill) / 1000.0, std::max((double)count, rate / 100));
+            last_refill = now;
+
+            if (now >= next_adjust) {
+                uint64_t new_replies = counters.replies.load() - last_replies;
+                uint64_t new_errors = counters.icmp_errors.load() - last_errors;
+                last_replies += new_replies;
+                last_errors += new_errors;
+                uint32_t best = counters.min_rtt_ms.load();
+                if (new_errors > 0 || (best != UINT32_MAX && timing.smoothed_rtt() > 2.0 * best + 10)) {
+                    halve();
+                }
+                else {
+                    rate = std::min(rate * 1.5, max_rate);
+                }
+                next_adjust = now + 100;
+            }
+            if (tokens < count) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        tokens -= count;
+    }
+
+private:
+    double rate;
+    double min_rate;
+    double max_rate;
+    const ReplyCounters& counters;
+    HostTimingTable& timing;
+    double tokens = 0;
+    uint64_t last_refill;
+    uint64_t next_adjust;
+    uint64_t last_replies = 0;
+    uint64_t last_errors = 0;
+};
+
+// One bit per (host, port) work item, set by a receiver thread when the
+// probe is answered. Retransmission passes resend only clear bits. Past 2^31
+// probes the map is not allocated rather than spending gigabytes on it;
+// answers are then deduplicated in a hash set, which grows with replies
+// instead of probes.
+class AnswerBitmap {
+public:
+    explicit AnswerBitmap(const ScanParams& params) : params(params) {
+        items = params.targets.size() * (uint64_t)(params.end_port - params.start_port + 1);
+    }
+
+    bool allocate() {
+        if (items > (1ull << 31)) {
+            return false;
+        }
+        words = std::vector<std::atomic<uint64_t>>((size_t)((items + 63) / 64));
+        return true;
+    }
+
+    bool enabled() const {
+        return !words.empty();
+    }
+
+    uint64_t size() const {
+        return items;
+    }
+
+    bool item_of(uint32_t addr, uint16_t port, uint64_t& item) const {
+        uint64_t host;
+        if (port < params.start_port || port > params.end_port || !params.targets.index_of(addr, host)) {
+            return false;
+        }
+        item = host + params.targets.size() * (uint64_t)(port - params.start_port);
+        return true;
+    }
+
+    bool is_set(uint64_t item) const {
+        return (words[item / 64].load(std::memory_order_relaxed) >> (item % 64)) & 1;
+    }
+
+    // True only for the first answer, so duplicate replies are reported once.
+    bool mark(uint64_t item) {
+        if (!enabled()) {
+            std::lock_guard<std::mutex> lock(overflow_lock);
+            return overflow.insert(item).second;
+        }
+        uint64_t bit = 1ull << (item % 64);
+        return !(words[item / 64].fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+
+    // Replies from outside the probe set are dropped, not reported.
+    bool mark(uint32_t addr, uint16_t port) {
+        uint64_t item;
+        return item_of(addr, port, item) && mark(item);
+    }
+
+    template <typename Visit>
+    void for_each_unanswered(Visit visit) const {
+        uint64_t hosts = params.targets.size();
+        for (uint64_t item = 0; item < items && enabled(); ++item) {
+            if (!is_set(item)) {
+                visit(params.targets.host_at(item % hosts), (uint16_t)(params.start_port + item / hosts));
+            }
+        }
+    }
+
+private:
+    const ScanParams& params;
+    uint64_t items;
+    std::vector<std::atomic<uint64_t>> words;
+    std::mutex overflow_lock;
+    std::unordered_set<uint64_t> overflow;
+};
+
+// Ones-complement sum over raw 16-bit words; the result can be stored into
+// a header field without byte swapping.
+static uint16_t internet_checksum(const void* data, size_t length, uint32_t sum = 0) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        uint16_t word;
+        memcpy(&word, bytes + i, 2);
+        sum += word;
+    }
+    if (length & 1) {
+        uint16_t word = 0;
+        memcpy(&word, bytes + length - 1, 1);
+        sum += word;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static bool route_source_address(uint32_t target, uint32_t& source) {
+    int probe = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (probe < 0) {
+        return false;
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = target;
+    addr.sin_port = htons(53);
+    socklen_t addr_len = sizeof(addr);
+    bool found = connect(probe, (SOCKADDR*)&addr, sizeof(addr)) == 0 &&
+        getsockname(probe, (SOCKADDR*)&addr, &addr_len) == 0;
+    close(probe);
+    source = addr.sin_addr.s_addr;
+    return found;
+}
+
+
+// Stateless SYN prober. Every probe carries its send time in the low 10 bits
+// of the sequence number and a keyed hash of target, port and that time in
+// the upper 22; the receiver accepts a SYN-ACK or RST only if it acknowledges
+// a valid cookie + 1 and reads the RTT back out of it. Nothing is remembered
+// per probe beyond one "answered" bit, which drives retransmission passes.
+class SynScanner {
+    static const PortState UNANSWERED_STATE = PORT_FILTERED;
+
+public:
+    SynScanner(const ScanParams& params, HostTimingTable& timing)
+        : params(params), timing(timing), answered(params), rate(params.max_rate, counters, timing) {
+        std::random_device rd;
+        secret = ((uint64_t)rd() << 32) | rd();
+        src_port = (uint16_t)(40000 + rd() % 20000);
+    }
+
+    ~SynScanner() {
+        if (tx_sock >= 0) {
+            close(tx_sock);
+        }
+        if (rx_sock >= 0) {
+            close(rx_sock);
+        }
+        if (icmp_sock >= 0) {
+            close(icmp_sock);
+        }
+    }
+
+    bool open() {
+        tx_sock = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+        rx_sock = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_TCP);
+        icmp_sock = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMP);
+        if (tx_sock < 0 || rx_sock < 0) {
+            std::cerr << "SYN scan requires root or CAP_NET_RAW." << std::endl;
+            return false;
+        }
+
+        int buffer_size = 64 * 1024 * 1024;
+        if (setsockopt(rx_sock, SOL_SOCKET, SO_RCVBUFFORCE, &buffer_size, sizeof(buffer_size)) != 0) {
+            setsockopt(rx_sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        }
+        if (setsockopt(tx_sock, SOL_SOCKET, SO_SNDBUFFORCE, &buffer_size, sizeof(buffer_size)) != 0) {
+            setsockopt(tx_sock, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+        }
+
+        if (!route_source_address(params.targets.host_at(0), src_addr)) {
+            std::cerr << "No route to " << params.target << "." << std::endl;
+            return false;
+        }
+        build_template();
+
+        if (!answered.allocate() && params.max_retries > 0) {
+            std::cerr << "Too many probes to track; retransmission disabled." << std::endl;
+        }
+        return true;
+    }
+
+    void run(const ProbePermutation& permutation) {
+        std::atomic<uint64_t> stop_at(UINT64_MAX);
+        std::thread receiver(&SynScanner::receive_loop, this, std::ref(stop_at));
+
+        auto started = std::chrono::steady_clock::now();
+        uint64_t sent = 0;
+        int passes = answered.enabled() ? params.max_retries + 1 : 1;
+        for (int pass = 0; pass < passes; ++pass) {
+            uint64_t recovered_before = counters.replies.load();
+            uint64_t pass_sent = transmit_pass(permutation, pass > 0);
+            sent += pass_sent;
+            if (pass_sent == 0) {
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(timing.scan_timeout(pass)));
+            if (pass > 0 && counters.replies.load() > recovered_before) {
+                // Retransmissions were answered, so the previous pass lost
+                // probes: start the next one at half the rate.
+                rate.halve();
+            }
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        stop_at = now_ms();
+        receiver.join();
+        if (params.report_all) {
+            answered.for_each_unanswered([&](uint32_t addr, uint16_t port) {
+                report_result(params, addr, port, UNANSWERED_STATE, 0);
+            });
+        }
+
+        std::lock_guard<std::mutex> lock(cout_mutex);
+        *info_out << "Sent " << sent << " SYN probes in " << elapsed << " s ("
+            << (uint64_t)(sent / std::max(elapsed, 1e-6)) << " probes/sec, final rate "
+            << (uint64_t)rate.current() << " pps, srtt " << timing.smoothed_rtt() << " ms)" << std::endl;
+    }
+
+private:
+    static const int batch_size = 64;
+    static const size_t packet_size = sizeof(iphdr) + sizeof(tcphdr) + 4;
+    static const uint32_t time_mask = 0x3FF;
+
+    uint32_t cookie(uint32_t addr, uint16_t port, uint32_t stamp) const {
+        uint64_t value = ((uint64_t)addr << 26 | (uint64_t)port << 10 | stamp) ^ secret;
+        value *= 0xFF51AFD7ED558CCDull;
+        value ^= value >> 33;
+        value *= 0xC4CEB9FE1A85EC53ull;
+        value ^= value >> 33;
+        return (uint32_t)value & ~time_mask;
+    }
+
+    // The kernel fills in the IP checksum, total length and ID for IP_HDRINCL
+    // sockets. The TCP checksum is precomputed over every constant word and
+    // only the destination address, port and cookie are added per packet.
+    void build_template() {
+        memset(packet_template, 0, sizeof(packet_template));
+        iphdr* ip = (iphdr*)packet_template;
+        ip->version = 4;
+        ip->ihl = 5;
+        ip->ttl = 64;
+        ip->protocol = IPPROTO_TCP;
+        ip->saddr = src_addr;
+
+        tcphdr* tcp = (tcphdr*)(packet_template + sizeof(iphdr));
+        tcp->source = htons(src_port);
+        tcp->doff = (sizeof(tcphdr) + 4) / 4;
+        tcp->syn = 1;
+        tcp->window = htons(1024);
+        unsigned char* options = (unsigned char*)(tcp + 1);
+        options[0] = 2;
+        options[1] = 4;
+        options[2] = 1460 >> 8;
+        options[3] = 1460 & 0xFF;
+
+        uint16_t tcp_len = htons(sizeof(tcphdr) + 4);
+        uint32_t sum = (src_addr & 0xFFFF) + (src_addr >> 16) + htons(IPPROTO_TCP) + tcp_len;
+        const uint16_t* words = (const uint16_t*)tcp;
+        for (size_t i = 0; i < (sizeof(tcphdr) + 4) / 2; ++i) {
+            sum += words[i];
+        }
+        checksum_base = sum;
+    }
+
+    void fill_packet(unsigned char* packet, uint32_t addr, uint16_t port, uint32_t stamp) const {
+        memcpy(packet, packet_template, packet_size);
+        ((iphdr*)packet)->daddr = addr;
+
+        tcphdr* tcp = (tcphdr*)(packet + sizeof(iphdr));
+        uint32_t seq = htonl(cookie(addr, port, stamp) | stamp);
+        tcp->dest = htons(port);
+        tcp->seq = seq;
+
+        uint32_t sum = checksum_base + (addr & 0xFFFF) + (addr >> 16) +
+            tcp->dest + (seq & 0xFFFF) + (seq >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        tcp->check = (uint16_t)~sum;
+    }
+
+    uint64_t transmit_pass(const ProbePermutation& permutation, bool retransmit) {
+        unsigned char packets[batch_size][packet_size];
+        sockaddr_in addrs[batch_size] = {};
+        iovec iovecs[batch_size];
+        mmsghdr messages[batch_size] = {};
+
+        for (int i = 0; i < batch_size; ++i) {
+            addrs[i].sin_family = AF_INET;
+            iovecs[i].iov_base = packets[i];
+            iovecs[i].iov_len = packet_size;
+            messages[i].msg_hdr.msg_name = &addrs[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        uint64_t hosts = params.targets.size();
+        uint64_t sent = 0;
+        uint64_t position = 0;
+
+        while (position < answered.size()) {
+            int limit = rate.batch_limit(batch_size);
+            rate.acquire(limit);
+
+            uint32_t stamp = (uint32_t)now_ms() & time_mask;
+            int count = 0;
+            while (count < limit && position < answered.size()) {
+                uint64_t item = permutation.at(position++);
+                if (retransmit && answered.is_set(item)) {
+                    continue;
+                }
+                uint32_t addr = params.targets.host_at(item % hosts);
+                uint16_t port = (uint16_t)(params.start_port + item / hosts);
+                addrs[count].sin_addr.s_addr = addr;
+                fill_packet(packets[count], addr, port, stamp);
+                count++;
+            }
+
+            for (int done = 0; done < count;) {
+                int result = sendmmsg(tx_sock, messages + done, count - done, 0);
+                if (result > 0) {
+                    done += result;
+                }
+                else if (errno == ENOBUFS || errno == EAGAIN || errno == EINTR) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                else {
+                    // Unroutable destinations fail individually; skip that probe.
+                    done++;
+                }
+            }
+            sent += count;
+        }
+        return sent;
+    }
+
+    void handle_tcp(const unsigned char* frame, size_t len) {
+        const iphdr* ip = (const iphdr*)frame;
+        size_t ip_len = (size_t)ip->ihl * 4;
+        if (len < ip_len + sizeof(tcphdr) || ip->protocol != IPPROTO_TCP) {
+            return;
+        }
+
+        const tcphdr* tcp = (const tcphdr*)(frame + ip_len);
+        uint16_t port = ntohs(tcp->source);
+        uint32_t ack = ntohl(tcp->ack_seq) - 1;
+        uint32_t stamp = ack & time_mask;
+        if (ntohs(tcp->dest) != src_port || !tcp->ack ||
+            (ack & ~time_mask) != cookie(ip->saddr, port, stamp)) {
+            return;
+        }
+
+        uint32_t rtt = ((uint32_t)now_ms() - stamp) & time_mask;
+        timing.record_rtt(ip->saddr, rtt);
+        if (rtt < counters.min_rtt_ms.load()) {
+            counters.min_rtt_ms = rtt;
+        }
+        counters.replies++;
+
+        if (answered.mark(ip->saddr, port)) {
+            report_result(params, ip->saddr, port, tcp->syn && !tcp->rst ? PORT_OPEN : PORT_CLOSED, rtt);
+        }
+    }
+
+    // Destination unreachable quoting one of our probes: the port is
+    // filtered, and the router is telling us to slow down.
+    void handle_icmp(const unsigned char* frame, size_t len) {
+        const iphdr* ip = (const iphdr*)frame;
+        size_t ip_len = (size_t)ip->ihl * 4;
+        if (len < ip_len + sizeof(icmphdr) + sizeof(iphdr) + 8) {
+            return;
+        }
+        const icmphdr* icmp = (const icmphdr*)(frame + ip_len);
+        const iphdr* quoted = (const iphdr*)(icmp + 1);
+        size_t quoted_len = (size_t)quoted->ihl * 4;
+        if (icmp->type != ICMP_DEST_UNREACH || quoted->protocol != IPPROTO_TCP ||
+            len < ip_len + sizeof(icmphdr) + quoted_len + 8) {
+            return;
+        }
+        const tcphdr* tcp = (const tcphdr*)((const unsigned char*)quoted + quoted_len);
+        if (ntohs(tcp->source) != src_port) {
+            return;
+        }
+
+        counters.icmp_errors++;
+        if (answered.mark(quoted->daddr, ntohs(tcp->dest))) {
+            report_result(params, quoted->daddr, ntohs(tcp->dest), PORT_FILTERED, 0);
+        }
+    }
+
+    void receive_loop(std::atomic<uint64_t>& stop_at) {
+        const size_t frame_size = 128;
+        std::vector<unsigned char> frames(batch_size * frame_size);
+        iovec iovecs[batch_size];
+        mmsghdr messages[batch_size] = {};
+        for (int i = 0; i < batch_size; ++i) {
+            iovecs[i].iov_base = &frames[i * frame_size];
+            iovecs[i].iov_len = frame_size;
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        pollfd pfds[2] = { { rx_sock, POLLIN, 0 }, { icmp_sock, POLLIN, 0 } };
+        int pfd_count = icmp_sock >= 0 ? 2 : 1;
+        while (now_ms() < stop_at.load()) {
+            if (poll(pfds, pfd_count, 50) <= 0) {
+                continue;
+            }
+
+            for (int source = 0; source < pfd_count; ++source) {
+                if (!(pfds[source].revents & POLLIN)) {
+                    continue;
+                }
+                int count = recvmmsg(pfds[source].fd, messages, batch_size, MSG_DONTWAIT, nullptr);
+                for (int i = 0; i < count; ++i) {
+                    if (source == 0) {
+                        handle_tcp(&frames[i * frame_size], messages[i].msg_len);
+                    }
+                    else {
+                        handle_icmp(&frames[i * frame_size], messages[i].msg_len);
+                    }
+                }
+            }
+        }
+    }
+
+    const ScanParams& params;
+    HostTimingTable& timing;
+    uint64_t secret;
+    uint16_t src_port;
+    uint32_t src_addr = 0;
+    uint32_t checksum_base = 0;
+    int tx_sock = -1;
+    int rx_sock = -1;
+    int icmp_sock = -1;
+    unsigned char packet_template[packet_size];
+    AnswerBitmap answered;
+    ReplyCounters counters;
+    AdaptiveRate rate;
+};
+
+// Batched UDP prober. Datagrams carrying the per-port payloads go out with
+// sendmmsg from a small pool of bound sockets and replies come back with
+// recvmmsg. A raw ICMP socket picks up the port-unreachable errors that
+// quote our pool ports, which is what separates closed from open|filtered.
+class UdpScanner {
+    static const PortState UNANSWERED_STATE = PORT_OPEN_FILTERED;
+
+public:
+    UdpScanner(const ScanParams& params, HostTimingTable& timing)
+        : params(params), timing(timing), answered(params), rate(params.max_rate, counters, timing) {}
+
+    ~UdpScanner() {
+        for (int sock : pool) {
+            close(sock);
+        }
+        if (icmp_sock >= 0) {
+            close(icmp_sock);
+        }
+    }
+
+    bool open() {
+        int buffer_size = 8 * 1024 * 1024;
+        for (int i = 0; i < pool_size; ++i) {
+            int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            socklen_t addr_len = sizeof(addr);
+            if (sock < 0 || bind(sock, (SOCKADDR*)&addr, sizeof(addr)) != 0 ||
+                getsockname(sock, (SOCKADDR*)&addr, &addr_len) != 0) {
+                std::cerr << "Failed to create UDP socket pool." << std::endl;
+                if (sock >= 0) {
+                    close(sock);
+                }
+                return false;
+            }
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+            setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+            pool.push_back(sock);
+            pool_ports.push_back(ntohs(addr.sin_port));
+        }
+
+        icmp_sock = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMP);
+        if (icmp_sock < 0) {
+            std::cerr << "No raw ICMP socket (needs CAP_NET_RAW); closed ports will show as open|filtered." << std::endl;
+        }
+
+        if (!answered.allocate() && params.max_retries > 0) {
+            std::cerr << "Too many probes to track; retransmission disabled." << std::endl;
+        }
+        return true;
+    }
+
+    void run(const ProbePermutation& permutation) {
+        std::atomic<uint64_t> stop_at(UINT64_MAX);
+        std::thread receiver(&UdpScanner::receive_loop, this, std::ref(stop_at));
+
+        auto started = std::chrono::steady_clock::now();
+        uint64_t sent = 0;
+        int passes = answered.enabled() ? params.max_retries + 1 : 1;
+        for (int pass = 0; pass < passes; ++pass) {
+            uint64_t answered_before = counters.replies.load();
+            uint64_t pass_sent = transmit_pass(permutation, pass > 0);
+            sent += pass_sent;
+            if (pass_sent == 0) {
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(timing.scan_timeout(pass)));
+            if (pass > 0 && counters.replies.load() > answered_before) {
+                // Answers to retransmissions mean the target's ICMP rate limit
+                // (or the path) dropped replies last pass.
+                rate.halve();
+            }
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        stop_at = now_ms();
+        receiver.join();
+        if (params.report_all) {
+            answered.for_each_unanswered([&](uint32_t addr, uint16_t port) {
+                report_result(params, addr, port, UNANSWERED_STATE, 0);
+            });
+        }
+
+        uint64_t answered_total = open_count + closed_count + filtered_count;
+        std::lock_guard<std::mutex> lock(cout_mutex);
+        *info_out << "Sent " << sent << " UDP probes in " << elapsed << " s ("
+            << (uint64_t)(sent / std::max(elapsed, 1e-6)) << " probes/sec, final rate "
+            << (uint64_t)rate.current() << " pps)" << std::endl;
+        *info_out << open_count << " open, " << closed_count << " closed, " << filtered_count
+            << " filtered, " << answered.size() - std::min(answered_total, answered.size())
+            << " open|filtered" << std::endl;
+    }
+
+private:
+    static const int pool_size = 8;
+    static const int batch_size = 64;
+
+    uint64_t transmit_pass(const ProbePermutation& permutation, bool retransmit) {
+        sockaddr_in addrs[batch_size] = {};
+        iovec iovecs[batch_size];
+        mmsghdr messages[batch_size] = {};
+
+        for (int i = 0; i < batch_size; ++i) {
+            addrs[i].sin_family = AF_INET;
+            messages[i].msg_hdr.msg_name = &addrs[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        uint64_t hosts = params.targets.size();
+        uint64_t sent = 0;
+        uint64_t position = 0;
+        size_t next_socket = 0;
+
+        while (position < answered.size()) {
+            int limit = rate.batch_limit(batch_size);
+            rate.acquire(limit);
+
+            int count = 0;
+            while (count < limit && position < answered.size()) {
+                uint64_t item = permutation.at(position++);
+                if (retransmit && answered.is_set(item)) {
+                    continue;
+                }
+                unsigned short port = (unsigned short)(params.start_port + item / hosts);
+                const UdpPayload* payload = udp_payload_for(port);
+                addrs[count].sin_addr.s_addr = params.targets.host_at(item % hosts);
+                addrs[count].sin_port = htons(port);
+                iovecs[count].iov_base = (void*)payload->data;
+                iovecs[count].iov_len = payload->length;
+                count++;
+            }
+
+            int sock = pool[next_socket++ % pool.size()];
+            for (int done = 0; done < count;) {
+                int result = sendmmsg(sock, messages + done, count - done, 0);
+                if (result > 0) {
+                    done += result;
+                }
+                else if (errno == ENOBUFS || errno == EAGAIN || errno == EINTR) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                else {
+                    done++;
+                }
+            }
+            sent += count;
+        }
+        return sent;
+    }
+
+    void handle_icmp(const unsigned char* frame, size_t len) {
+        const iphdr* ip = (const iphdr*)frame;
+        size_t ip_len = (size_t)ip->ihl * 4;
+        if (len < ip_len + sizeof(icmphdr) + sizeof(iphdr) + 8) {
+            return;
+        }
+        const icmphdr* icmp = (const icmphdr*)(frame + ip_len);
+        const iphdr* quoted = (const iphdr*)(icmp + 1);
+        size_t quoted_len = (size_t)quoted->ihl * 4;
+        if (icmp->type != ICMP_DEST_UNREACH || quoted->protocol != IPPROTO_UDP ||
+            len < ip_len + sizeof(icmphdr) + quoted_len + 8) {
+            return;
+        }
+        const udphdr* udp = (const udphdr*)((const unsigned char*)quoted + quoted_len);
+        if (std::find(pool_ports.begin(), pool_ports.end(), ntohs(udp->source)) == pool_ports.end()) {
+            return;
+        }
+
+        bool closed = icmp->code == ICMP_PORT_UNREACH;
+        if (closed) {
+            counters.replies++;
+        }
+        else {
+            counters.icmp_errors++;
+        }
+        if (answered.mark(quoted->daddr, ntohs(udp->dest))) {
+            (closed ? closed_count : filtered_count)++;
+            report_result(params, quoted->daddr, ntohs(udp->dest), closed ? PORT_CLOSED : PORT_FILTERED, 0);
+        }
+    }
+
+    void receive_loop(std::atomic<uint64_t>& stop_at) {
+        const size_t frame_size = 1500;
+        std::vector<unsigned char> frames(batch_size * frame_size);
+        sockaddr_in from[batch_size];
+        iovec iovecs[batch_size];
+        mmsghdr messages[batch_size] = {};
+        for (int i = 0; i < batch_size; ++i) {
+            iovecs[i].iov_base = &frames[i * frame_size];
+            iovecs[i].iov_len = frame_size;
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        std::vector<pollfd> pfds;
+        for (int sock : pool) {
+            pfds.push_back({ sock, POLLIN, 0 });
+        }
+        if (icmp_sock >= 0) {
+            pfds.push_back({ icmp_sock, POLLIN, 0 });
+        }
 
-std::mutex cout_mutex;
-std::atomic<int> threads_completed(0);
+        while (now_ms() < stop_at.load()) {
+            if (poll(pfds.data(), pfds.size(), 50) <= 0) {
+                continue;
+            }
 
-struct ScanParams {
-    std::string target;
-    unsigned short start_port;
-    unsigned short end_port;
-    int scan_type;
-    int timeout_ms;
-    int max_threads;
+            for (const pollfd& pfd : pfds) {
+                if (!(pfd.revents & POLLIN)) {
+                    continue;
+                }
+                for (int i = 0; i < batch_size; ++i) {
+                    messages[i].msg_hdr.msg_name = &from[i];
+                    messages[i].msg_hdr.msg_namelen = sizeof(from[i]);
+                }
+                int count = recvmmsg(pfd.fd, messages, batch_size, MSG_DONTWAIT, nullptr);
+                for (int i = 0; i < count; ++i) {
+                    if (pfd.fd == icmp_sock) {
+                        handle_icmp(&frames[i * frame_size], messages[i].msg_len);
+                        continue;
+                    }
+                    counters.replies++;
+                    if (answered.mark(from[i].sin_addr.s_addr, ntohs(from[i].sin_port))) {
+                        open_count++;
+                        report_result(params, from[i].sin_addr.s_addr, ntohs(from[i].sin_port), PORT_OPEN, 0);
+                    }
+                }
+            }
+        }
+    }
+
+    const ScanParams& params;
+    HostTimingTable& timing;
+    std::vector<int> pool;
+    std::vector<unsigned short> pool_ports;
+    int icmp_sock = -1;
+    AnswerBitmap answered;
+    ReplyCounters counters;
+    AdaptiveRate rate;
+    std::atomic<uint64_t> open_count{ 0 };
+    std::atomic<uint64_t> closed_count{ 0 };
+    std::atomic<uint64_t> filtered_count{ 0 };
 };
 
-bool is_host_alive(const std::string& target) {
-    HANDLE hIcmpFile = IcmpCreateFile();
-    if (hIcmpFile == INVALID_HANDLE_VALUE) {
-        return false;
+// Concurrent liveness sweep run before the port scan. One transmit loop
+// sends, per host, an ICMP echo (datagram ICMP socket when unprivileged, raw
+// otherwise), a TCP SYN to 443 and a TCP ACK to 80 from a raw socket, and an
+// ARP request when the host sits on a directly attached subnet. A single
+// receiver thread polls every reply socket and marks the host live on the
+// first answer of any kind.
+class HostDiscovery {
+public:
+    HostDiscovery(const ScanParams& params, HostTimingTable& timing)
+        : params(params), timing(timing), rate(params.max_rate > 0 ? params.max_rate : 10000, counters, timing) {
+        std::random_device rd;
+        secret = ((uint64_t)rd() << 32) | rd();
+        src_port = (uint16_t)(40000 + rd() % 20000);
+        echo_id = (uint16_t)rd();
+        live = std::vector<std::atomic<uint64_t>>((size_t)((params.targets.size() + 63) / 64));
     }
 
-    IPAddr ip_addr;
-    InetPtonA(AF_INET, target.c_str(), &ip_addr);
+    ~HostDiscovery() {
+        for (int sock : { icmp_sock, tcp_tx_sock, tcp_rx_sock }) {
+            if (sock >= 0) {
+                close(sock);
+            }
+        }
+        for (const ArpInterface& arp : arp_interfaces) {
+            close(arp.sock);
+        }
+    }
 
-    char send_data[32] = "Echo Request";
-    char reply_buffer[sizeof(ICMP_ECHO_REPLY) + 32];
-    DWORD reply_size = sizeof(reply_buffer);
+    // False when no probe socket at all could be opened.
+    bool open() {
+        icmp_sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_ICMP);
+        if (icmp_sock < 0) {
+            icmp_sock = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMP);
+            icmp_raw = icmp_sock >= 0;
+        }
 
-    DWORD result = IcmpSendEcho(hIcmpFile, ip_addr, send_data, 32,
-        NULL, reply_buffer, reply_size, 1000);
+        tcp_tx_sock = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+        tcp_rx_sock = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (tcp_tx_sock < 0 || tcp_rx_sock < 0 || !route_source_address(params.targets.host_at(0), src_addr)) {
+            if (tcp_tx_sock >= 0) {
+                close(tcp_tx_sock);
+            }
+            if (tcp_rx_sock >= 0) {
+                close(tcp_rx_sock);
+            }
+            tcp_tx_sock = tcp_rx_sock = -1;
+        }
 
-    IcmpCloseHandle(hIcmpFile);
-    return result > 0;
-}
+        open_arp_interfaces();
+        return icmp_sock >= 0 || tcp_tx_sock >= 0 || !arp_interfaces.empty();
+    }
 
-bool tcp_connect_scan(const std::string& target, unsigned short port, int timeout_ms) {
-    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sock == INVALID_SOCKET) {
-        return false;
+    TargetSet run() {
+        std::atomic<uint64_t> stop_at(UINT64_MAX);
+        std::thread receiver(&HostDiscovery::receive_loop, this, std::ref(stop_at));
+
+        uint64_t hosts = params.targets.size();
+        std::random_device rd;
+        ProbePermutation order(hosts, ((uint64_t)rd() << 32) | rd());
+        auto started = std::chrono::steady_clock::now();
+
+        for (int pass = 0; pass <= params.max_retries; ++pass) {
+            uint64_t sent = 0;
+            for (uint64_t position = 0; position < hosts; ++position) {
+                uint64_t index = order.at(position);
+                if (is_live(index)) {
+                    continue;
+                }
+                uint32_t addr = params.targets.host_at(index);
+                rate.acquire(packets_for(addr));
+                probe_host(addr, (uint16_t)(position + pass));
+                sent++;
+            }
+            if (sent == 0) {
+                break;
+            }
+            uint64_t deadline = now_ms() + timing.scan_timeout(pass);
+            while (live_count.load() < hosts && now_ms() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+
+        stop_at = now_ms();
+        receiver.join();
+
+        TargetSet alive;
+        for (uint64_t index = 0; index < hosts; ++index) {
+            if (is_live(index)) {
+                alive.add_host(params.targets.host_at(index));
+            }
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::lock_guard<std::mutex> lock(cout_mutex);
+        *info_out << "Host discovery: " << alive.size() << " of " << hosts << " hosts up in "
+            << elapsed << " s" << std::endl;
+        return alive;
     }
 
-    sockaddr_in service;
-    service.sin_family = AF_INET;
-    InetPtonA(AF_INET, target.c_str(), &service.sin_addr);
-    service.sin_port = htons(port);
+private:
+    struct ArpInterface {
+        int sock;
+        int ifindex;
+        uint32_t addr;
+        uint32_t netmask;
+        unsigned char mac[6];
+    };
 
-    u_long mode = 1;
-    ioctlsocket(sock, FIONBIO, &mode);
+    struct ArpPacket {
+        uint16_t hardware_type;
+        uint16_t protocol_type;
+        uint8_t hardware_length;
+        uint8_t protocol_length;
+        uint16_t operation;
+        unsigned char sender_mac[6];
+        unsigned char sender_ip[4];
+        unsigned char target_mac[6];
+        unsigned char target_ip[4];
+    } __attribute__((packed));
 
-    connect(sock, (SOCKADDR*)&service, sizeof(service));
+    uint32_t cookie(uint32_t addr) const {
+        uint64_t value = (uint64_t)addr ^ secret;
+        value *= 0xFF51AFD7ED558CCDull;
+        value ^= value >> 33;
+        return (uint32_t)value;
+    }
 
-    fd_set writefds;
-    FD_ZERO(&writefds);
-    FD_SET(sock, &writefds);
+    bool is_live(uint64_t index) const {
+        return (live[index / 64].load(std::memory_order_relaxed) >> (index % 64)) & 1;
+    }
 
-    timeval timeout;
-    timeout.tv_sec = timeout_ms / 1000;
-    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    void mark_live(uint32_t addr) {
+        uint64_t index;
+        if (params.targets.index_of(addr, index)) {
+            uint64_t bit = 1ull << (index % 64);
+            if (!(live[index / 64].fetch_or(bit, std::memory_order_relaxed) & bit)) {
+                live_count++;
+            }
+            counters.replies++;
+        }
+    }
 
-    int result = select(0, NULL, &writefds, NULL, &timeout);
-    if (result <= 0) {
-        closesocket(sock);
-        return false;
+    void open_arp_interfaces() {
+        ifaddrs* interfaces = nullptr;
+        if (getifaddrs(&interfaces) != 0) {
+            return;
+        }
+        for (ifaddrs* entry = interfaces; entry != nullptr; entry = entry->ifa_next) {
+            if (entry->ifa_addr == nullptr || entry->ifa_addr->sa_family != AF_INET ||
+                entry->ifa_netmask == nullptr || (entry->ifa_flags & IFF_LOOPBACK) ||
+                !(entry->ifa_flags & IFF_UP) || (entry->ifa_flags & IFF_NOARP)) {
+                continue;
+            }
+
+            ArpInterface arp = {};
+            arp.addr = ((sockaddr_in*)entry->ifa_addr)->sin_addr.s_addr;
+            arp.netmask = ((sockaddr_in*)entry->ifa_netmask)->sin_addr.s_addr;
+            arp.ifindex = (int)if_nametoindex(entry->ifa_name);
+            arp.sock = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, htons(ETH_P_ARP));
+            if (arp.sock < 0) {
+                continue;
+            }
+
+            ifreq request = {};
+            strncpy(request.ifr_name, entry->ifa_name, IFNAMSIZ - 1);
+            sockaddr_ll bind_addr = {};
+            bind_addr.sll_family = AF_PACKET;
+            bind_addr.sll_protocol = htons(ETH_P_ARP);
+            bind_addr.sll_ifindex = arp.ifindex;
+            if (ioctl(arp.sock, SIOCGIFHWADDR, &request) != 0 ||
+                bind(arp.sock, (sockaddr*)&bind_addr, sizeof(bind_addr)) != 0) {
+                close(arp.sock);
+                continue;
+            }
+            memcpy(arp.mac, request.ifr_hwaddr.sa_data, 6);
+            arp_interfaces.push_back(arp);
+        }
+        freeifaddrs(interfaces);
     }
 
-    int error = 0;
-    int error_len = sizeof(error);
-    getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&error, &error_len);
+    // The rate limit counts packets, not hosts.
+    int packets_for(uint32_t addr) const {
+        int packets = (icmp_sock >= 0 ? 1 : 0) + (tcp_tx_sock >= 0 ? 2 : 0);
+        for (const ArpInterface& arp : arp_interfaces) {
+            if ((addr & arp.netmask) == (arp.addr & arp.netmask)) {
+                packets++;
+            }
+        }
+        return std::max(packets, 1);
+    }
 
-    closesocket(sock);
-    return error == 0;
-}
+    void probe_host(uint32_t addr, uint16_t sequence) {
+        sockaddr_in target = {};
+        target.sin_family = AF_INET;
+        target.sin_addr.s_addr = addr;
 
-bool udp_scan(const std::string& target, unsigned short port, int timeout_ms) {
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (sock == INVALID_SOCKET) {
-        return false;
+        if (icmp_sock >= 0) {
+            unsigned char packet[sizeof(icmphdr) + 8] = {};
+            icmphdr* icmp = (icmphdr*)packet;
+            icmp->type = ICMP_ECHO;
+            icmp->un.echo.id = htons(echo_id);
+            icmp->un.echo.sequence = htons(sequence);
+            icmp->checksum = internet_checksum(packet, sizeof(packet));
+            sendto(icmp_sock, packet, sizeof(packet), 0, (SOCKADDR*)&target, sizeof(target));
+        }
+
+        if (tcp_tx_sock >= 0) {
+            send_tcp_ping(target, 443, true);
+            send_tcp_ping(target, 80, false);
+        }
+
+        for (const ArpInterface& arp : arp_interfaces) {
+            if ((addr & arp.netmask) != (arp.addr & arp.netmask)) {
+                continue;
+            }
+            ArpPacket request = {};
+            request.hardware_type = htons(1);
+            request.protocol_type = htons(ETH_P_IP);
+            request.hardware_length = 6;
+            request.protocol_length = 4;
+            request.operation = htons(1);
+            memcpy(request.sender_mac, arp.mac, 6);
+            memcpy(request.sender_ip, &arp.addr, 4);
+            memcpy(request.target_ip, &addr, 4);
+
+            sockaddr_ll broadcast = {};
+            broadcast.sll_family = AF_PACKET;
+            broadcast.sll_protocol = htons(ETH_P_ARP);
+            broadcast.sll_ifindex = arp.ifindex;
+            broadcast.sll_halen = 6;
+            memset(broadcast.sll_addr, 0xFF, 6);
+            sendto(arp.sock, &request, sizeof(request), 0, (sockaddr*)&broadcast, sizeof(broadcast));
+        }
     }
 
-    sockaddr_in service;
-    service.sin_family = AF_INET;
-    InetPtonA(AF_INET, target.c_str(), &service.sin_addr);
-    service.sin_port = htons(port);
+    // SYN pings draw a SYN-ACK or RST acknowledging cookie + 1; ACK pings
+    // draw an RST whose sequence number is the cookie we sent as the ACK.
+    void send_tcp_ping(const sockaddr_in& target, uint16_t port, bool syn) {
+        unsigned char packet[sizeof(iphdr) + sizeof(tcphdr)] = {};
+        iphdr* ip = (iphdr*)packet;
+        ip->version = 4;
+        ip->ihl = 5;
+        ip->ttl = 64;
+        ip->protocol = IPPROTO_TCP;
+        ip->saddr = src_addr;
+        ip->daddr = target.sin_addr.s_addr;
 
-    const char* buf = "";
-    int sent = sendto(sock, buf, 0, 0, (SOCKADDR*)&service, sizeof(service));
-    if (sent == SOCKET_ERROR) {
-        closesocket(sock);
-        return false;
+        tcphdr* tcp = (tcphdr*)(ip + 1);
+        tcp->source = htons(src_port);
+        tcp->dest = htons(port);
+        tcp->doff = sizeof(tcphdr) / 4;
+        tcp->window = htons(1024);
+        if (syn) {
+            tcp->syn = 1;
+            tcp->seq = htonl(cookie(ip->daddr));
+        }
+        else {
+            tcp->ack = 1;
+            tcp->ack_seq = htonl(cookie(ip->daddr));
+        }
+
+        uint32_t pseudo = (ip->saddr & 0xFFFF) + (ip->saddr >> 16) + (ip->daddr & 0xFFFF) +
+            (ip->daddr >> 16) + htons(IPPROTO_TCP) + htons(sizeof(tcphdr));
+        tcp->check = internet_checksum(tcp, sizeof(tcphdr), pseudo);
+        sendto(tcp_tx_sock, packet, sizeof(packet), 0, (SOCKADDR*)&target, sizeof(target));
     }
 
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(sock, &readfds);
+    void handle_icmp(const unsigned char* frame, size_t len, uint32_t from) {
+        size_t offset = icmp_raw ? (size_t)(frame[0] & 0x0F) * 4 : 0;
+        if (len < offset + sizeof(icmphdr)) {
+            return;
+        }
+        const icmphdr* icmp = (const icmphdr*)(frame + offset);
+        // Datagram ICMP sockets rewrite the echo id to the socket's own.
+        if (icmp->type == ICMP_ECHOREPLY && (!icmp_raw || ntohs(icmp->un.echo.id) == echo_id)) {
+            mark_live(from);
+        }
+    }
 
-    timeval timeout;
-    timeout.tv_sec = timeout_ms / 1000;
-    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    void handle_tcp(const unsigned char* frame, size_t len) {
+        const iphdr* ip = (const iphdr*)frame;
+        size_t ip_len = (size_t)ip->ihl * 4;
+        if (len < ip_len + sizeof(tcphdr)) {
+            return;
+        }
+        const tcphdr* tcp = (const tcphdr*)(frame + ip_len);
+        if (ntohs(tcp->dest) != src_port) {
+            return;
+        }
+        uint32_t expected = cookie(ip->saddr);
+        if ((tcp->ack && ntohl(tcp->ack_seq) == expected + 1) || (tcp->rst && ntohl(tcp->seq) == expected)) {
+            mark_live(ip->saddr);
+        }
+    }
 
-    int result = select(0, &readfds, NULL, NULL, &timeout);
-    if (result <= 0) {
-        closesocket(sock);
-        return true;
+    void handle_arp(const unsigned char* frame, size_t len) {
+        if (len < sizeof(ArpPacket)) {
+            return;
+        }
+        const ArpPacket* reply = (const ArpPacket*)frame;
+        if (ntohs(reply->operation) == 2) {
+            uint32_t sender;
+            memcpy(&sender, reply->sender_ip, 4);
+            mark_live(sender);
+        }
     }
 
-    char recv_buf[256];
-    sockaddr_in from;
-    int from_len = sizeof(from);
-    recvfrom(sock, recv_buf, sizeof(recv_buf), 0, (SOCKADDR*)&from, &from_len);
+    void receive_loop(std::atomic<uint64_t>& stop_at) {
+        std::vector<pollfd> pfds;
+        for (int sock : { icmp_sock, tcp_rx_sock }) {
+            if (sock >= 0) {
+                pfds.push_back({ sock, POLLIN, 0 });
+            }
+        }
+        for (const ArpInterface& arp : arp_interfaces) {
+            pfds.push_back({ arp.sock, POLLIN, 0 });
+        }
 
-    closesocket(sock);
-    return true;
-}
+        unsigned char frame[1500];
+        while (now_ms() < stop_at.load()) {
+            if (poll(pfds.data(), pfds.size(), 50) <= 0) {
+                continue;
+            }
+            for (const pollfd& pfd : pfds) {
+                if (!(pfd.revents & POLLIN)) {
+                    continue;
+                }
+                for (;;) {
+                    sockaddr_in from = {};
+                    socklen_t from_len = sizeof(from);
+                    ssize_t len = recvfrom(pfd.fd, frame, sizeof(frame), MSG_DONTWAIT, (SOCKADDR*)&from, &from_len);
+                    if (len <= 0) {
+                        break;
+                    }
+                    if (pfd.fd == icmp_sock) {
+                        handle_icmp(frame, (size_t)len, from.sin_addr.s_addr);
+                    }
+                    else if (pfd.fd == tcp_rx_sock) {
+                        handle_tcp(frame, (size_t)len);
+                    }
+                    else {
+                        handle_arp(frame, (size_t)len);
+                    }
+                }
+            }
+        }
+    }
 
-void scan_ports_range(const ScanParams& params, unsigned short start, unsigned short end) {
-    for (unsigned short port = start; port <= end; ++port) {
-        bool is_open = false;
+    const ScanParams& params;
+    HostTimingTable& timing;
+    uint64_t secret;
+    uint16_t src_port;
+    uint16_t echo_id;
+    uint32_t src_addr = 0;
+    int icmp_sock = -1;
+    bool icmp_raw = false;
+    int tcp_tx_sock = -1;
+    int tcp_rx_sock = -1;
+    std::vector<ArpInterface> arp_interfaces;
+    std::vector<std::atomic<uint64_t>> live;
+    std::atomic<uint64_t> live_count{ 0 };
+    ReplyCounters counters;
+    AdaptiveRate rate;
+};
+#endif
+
+void scan_worker(const ScanParams& params, const ProbePermutation& permutation,
+    WorkScheduler& scheduler, HostTimingTable& timing, int worker) {
+    ProbeSource source(params, permutation, scheduler, worker);
+
+#ifdef __linux__
+    if (params.scan_type == 1) {
+        int window = clamp_inflight_window(params.max_inflight) / params.max_threads;
+        epoll_connect_worker(params, source, timing, std::max(window, 1));
+        threads_completed++;
+        return;
+    }
+#endif
+
+    uint32_t addr;
+    unsigned short port;
+    while (source.next(addr, port)) {
+        PortState state = PORT_FILTERED;
+        double rtt_ms = 0;
+        std::string service;
 
         switch (params.scan_type) {
-        case 1:
-            is_open = tcp_connect_scan(params.target, port, params.timeout_ms);
-            break;
         case 2:
-            is_open = udp_scan(params.target, port, params.timeout_ms);
+            for (int attempt = 0; attempt <= params.max_retries; ++attempt) {
+                state = udp_scan(addr, port, timing.timeout_for(addr, attempt));
+                if (state != PORT_OPEN_FILTERED) {
+                    break;
+                }
+            }
             break;
         default:
-            is_open = tcp_connect_scan(params.target, port, params.timeout_ms);
+            for (int attempt = 0; attempt <= params.max_retries; ++attempt) {
+                state = tcp_connect_scan(addr, port, timing.timeout_for(addr, attempt), rtt_ms,
+                    params.detect_services ? &service : nullptr, params.timeout_ms);
+                if (state == PORT_FILTERED) {
+                    continue;
+                }
+                if (attempt == 0) {
+                    timing.record_rtt(addr, rtt_ms);
+                }
+                break;
+            }
             break;
         }
 
-        if (is_open) {
-            std::lock_guard<std::mutex> lock(cout_mutex);
-            std::cout << "Port " << port << " is open" << std::endl;
-        }
+        report_result(params, addr, port, state, rtt_ms, service);
     }
 
     threads_completed++;
 }
 
-void start_scan(const ScanParams& params) {
-    if (!is_host_alive(params.target)) {
+void start_scan(const ScanParams& requested) {
+    ScanParams params = requested;
+    HostTimingTable timing(params.min_timeout_ms, params.timeout_ms);
+
+#ifdef __linux__
+    if (!params.skip_discovery) {
+        HostDiscovery discovery(requested, timing);
+        if (discovery.open()) {
+            params.targets = discovery.run();
+        }
+        else {
+            std::cerr << "Host discovery unavailable, scanning every target." << std::endl;
+        }
+    }
+    if (params.targets.size() == 0) {
+        std::cerr << "No hosts are up." << std::endl;
+        return;
+    }
+#else
+    if (!params.skip_discovery && params.targets.size() == 1 && !is_host_alive(params.targets.host_at(0))) {
         std::cerr << "Host is not reachable or does not respond to ICMP." << std::endl;
         return;
     }
+#endif
 
-    std::cout << "Starting scan for " << params.target << " (ports "
+    uint64_t hosts = params.targets.size();
+
+    *info_out << "Starting scan for " << params.target << " (" << hosts << " hosts, ports "
         << params.start_port << "-" << params.end_port << ")" << std::endl;
 
-    int total_ports = params.end_port - params.start_port + 1;
-    int ports_per_thread = total_ports / params.max_threads;
-    int remaining_ports = total_ports % params.max_threads;
+    uint64_t total_probes = hosts * (uint64_t)(params.end_port - params.start_port + 1);
+    int workers = (int)std::min<uint64_t>((uint64_t)params.max_threads, total_probes);
 
-    std::vector<std::thread> threads;
+    std::random_device rd;
+    ProbePermutation permutation(total_probes, ((uint64_t)rd() << 32) | rd());
 
-    unsigned short current_start = params.start_port;
-    for (int i = 0; i < params.max_threads; ++i) {
-        unsigned short current_end = current_start + ports_per_thread - 1;
-        if (i < remaining_ports) {
-            current_end++;
+#ifdef __linux__
+    if (params.scan_type == 3) {
+        SynScanner scanner(params, timing);
+        if (scanner.open()) {
+            scanner.run(permutation);
+            scan_completed();
         }
-
-        if (current_end > params.end_port) {
-            current_end = params.end_port;
+        return;
+    }
+    if (params.scan_type == 2) {
+        UdpScanner scanner(params, timing);
+        if (scanner.open()) {
+            scanner.run(permutation);
+            scan_completed();
         }
+        return;
+    }
+#endif
+
+    WorkScheduler scheduler(total_probes, workers);
 
-        threads.emplace_back(scan_ports_range, params, current_start, current_end);
-        current_start = current_end + 1;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; ++i) {
+        threads.emplace_back(scan_worker, std::cref(params), std::cref(permutation),
+            std::ref(scheduler), std::ref(timing), i);
     }
 
     for (auto& thread : threads) {
         thread.join();
     }
 
-    std::cout << "Scan completed." << std::endl;
+    scan_completed();
 }
 
-int main() {
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "WSAStartup failed." << std::endl;
-        return 1;
+#ifdef __linux__
+// Loopback benchmark. A forked listener farm owns a fixed block of ports in
+// four roles, and every scan engine is run against it with all results
+// written through the binary output path, then checked against the farm's
+// ground truth.
+enum BenchRole {
+    BENCH_UNKNOWN,
+    BENCH_OPEN,
+    BENCH_CLOSED,
+    BENCH_SLOW_ACCEPT,
+    BENCH_BLACKHOLE
+};
+
+static const unsigned short bench_base_port = 20000;
+static const int bench_port_count = 2048;
+
+static BenchRole bench_role_for(int index) {
+    if (index % 64 == 63) {
+        return BENCH_BLACKHOLE;
     }
+    if (index % 64 == 62) {
+        return BENCH_SLOW_ACCEPT;
+    }
+    return index % 4 == 0 ? BENCH_OPEN : BENCH_CLOSED;
+}
 
-    ScanParams params;
+// Runs in the child. Ports that cannot be bound are reported as unknown and
+// left out of the accuracy figures.
+static void run_listener_farm(int control) {
+    std::vector<unsigned char> truth(bench_port_count, BENCH_UNKNOWN);
+    std::vector<int> open_listeners;
+    std::vector<int> slow_listeners;
+    std::vector<int> held;
 
-    std::cout << "Enter target IP or hostname: ";
-    std::cin >> params.target;
+    for (int i = 0; i < bench_port_count; ++i) {
+        BenchRole role = bench_role_for(i);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((unsigned short)(bench_base_port + i));
 
-    addrinfo hints = {};
-    hints.ai_family = AF_INET;
-    addrinfo* result = nullptr;
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (fd < 0 || bind(fd, (SOCKADDR*)&addr, sizeof(addr)) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        if (role == BENCH_CLOSED) {
+            close(fd);
+            truth[i] = BENCH_CLOSED;
+            continue;
+        }
 
-    if (getaddrinfo(params.target.c_str(), nullptr, &hints, &result) != 0) {
-        std::cerr << "Failed to resolve hostname." << std::endl;
-        WSACleanup();
-        return 1;
+        listen(fd, role == BENCH_OPEN ? 1024 : role == BENCH_SLOW_ACCEPT ? 4 : 0);
+        set_nonblocking(fd);
+        if (role == BENCH_BLACKHOLE) {
+            // One connection fills a zero-backlog accept queue; the kernel then
+            // drops further SYNs, so probes see no answer at all.
+            int filler = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+            if (filler < 0 || connect(filler, (SOCKADDR*)&addr, sizeof(addr)) != 0) {
+                continue;
+            }
+            held.push_back(fd);
+            held.push_back(filler);
+        }
+        else {
+            (role == BENCH_OPEN ? open_listeners : slow_listeners).push_back(fd);
+        }
+        truth[i] = (unsigned char)role;
+    }
+
+    if (write(control, truth.data(), truth.size()) != (ssize_t)truth.size()) {
+        return;
+    }
+
+    std::vector<pollfd> pfds = { { control, POLLIN, 0 } };
+    for (int fd : open_listeners) {
+        pfds.push_back({ fd, POLLIN, 0 });
+    }
+
+    uint64_t next_slow_accept = 0;
+    for (;;) {
+        if (poll(pfds.data(), pfds.size(), 10) < 0 && errno != EINTR) {
+            return;
+        }
+        if (pfds[0].revents != 0) {
+            return;
+        }
+        for (size_t i = 1; i < pfds.size(); ++i) {
+            if (pfds[i].revents & POLLIN) {
+                int client;
+                while ((client = accept4(pfds[i].fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+                    close(client);
+                }
+            }
+        }
+        uint64_t now = now_ms();
+        if (now >= next_slow_accept) {
+            for (int fd : slow_listeners) {
+                int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client >= 0) {
+                    close(client);
+                }
+            }
+            next_slow_accept = now + 50;
+        }
+    }
+}
+
+static double cpu_seconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Returns false when any engine misclassified a port.
+bool run_benchmark(const ScanParams& requested) {
+    int control[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, control) != 0) {
+        std::cerr << "socketpair failed." << std::endl;
+        return false;
+    }
+    pid_t farm = fork();
+    if (farm < 0) {
+        std::cerr << "fork failed." << std::endl;
+        return false;
+    }
+    if (farm == 0) {
+        close(control[0]);
+        run_listener_farm(control[1]);
+        _exit(0);
+    }
+    close(control[1]);
+
+    std::vector<unsigned char> truth(bench_port_count);
+    size_t got = 0;
+    while (got < truth.size()) {
+        ssize_t length = read(control[0], truth.data() + got, truth.size() - got);
+        if (length <= 0) {
+            std::cerr << "Listener farm failed to start." << std::endl;
+            close(control[0]);
+            waitpid(farm, nullptr, 0);
+            return false;
+        }
+        got += (size_t)length;
+    }
+
+    char path[] = "/tmp/portscan-bench-XXXXXX";
+    int tmp = mkstemp(path);
+    if (tmp < 0) {
+        std::cerr << "Failed to create a results file." << std::endl;
+        close(control[0]);
+        waitpid(farm, nullptr, 0);
+        return false;
+    }
+    close(tmp);
+
+    ScanParams params = requested;
+    params.target = "127.0.0.1";
+    params.targets = TargetSet();
+    params.targets.add(params.target);
+    params.start_port = bench_base_port;
+    params.end_port = (unsigned short)(bench_base_port + bench_port_count - 1);
+    params.report_all = true;
+    params.skip_discovery = true;
+    params.detect_services = false;
+
+    std::vector<std::pair<int, const char*>> engines = { { 1, "connect" } };
+    int raw = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+    if (raw >= 0) {
+        close(raw);
+        engines.push_back({ 3, "syn" });
+    }
+    else {
+        std::cerr << "No raw socket access; skipping the SYN engine." << std::endl;
+    }
+
+    static std::ostream quiet(nullptr);
+    std::ostream* saved_info_out = info_out;
+    info_out = &quiet;
+
+    printf("%-8s %7s %8s %10s %8s %8s %7s %9s\n",
+        "engine", "probes", "wall_s", "probes/s", "p50_ms", "p99_ms", "cpu_s", "accuracy");
+
+    bool accurate = true;
+    for (const auto& engine : engines) {
+        params.scan_type = engine.first;
+        if (!result_writer.open(OUTPUT_BINARY, path, false)) {
+            std::cerr << "Failed to open " << path << "." << std::endl;
+            accurate = false;
+            break;
+        }
+        double cpu_before = cpu_seconds();
+        auto started = std::chrono::steady_clock::now();
+        start_scan(params);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        double cpu = cpu_seconds() - cpu_before;
+        result_writer.close();
+
+        std::vector<int> observed(bench_port_count, -1);
+        std::vector<double> latencies;
+        std::ifstream results(path, std::ios::binary);
+        unsigned char record[20];
+        results.ignore(4);
+        while (results.read((char*)record, sizeof(record))) {
+            int port = record[16] | (record[17] << 8);
+            uint32_t rtt_us = record[12] | (record[13] << 8) | (record[14] << 16) | ((uint32_t)record[15] << 24);
+            if (port < bench_base_port || port >= bench_base_port + bench_port_count) {
+                continue;
+            }
+            observed[port - bench_base_port] = record[19];
+            if (record[19] == PORT_OPEN || record[19] == PORT_CLOSED) {
+                latencies.push_back(rtt_us / 1000.0);
+            }
+        }
+
+        int known = 0;
+        int correct = 0;
+        for (int i = 0; i < bench_port_count; ++i) {
+            int expected;
+            switch (truth[i]) {
+            case BENCH_OPEN:
+            case BENCH_SLOW_ACCEPT:
+                expected = PORT_OPEN;
+                break;
+            case BENCH_CLOSED:
+                expected = PORT_CLOSED;
+                break;
+            case BENCH_BLACKHOLE:
+                expected = PORT_FILTERED;
+                break;
+            default:
+                continue;
+            }
+            known++;
+            correct += observed[i] == expected;
+        }
+        accurate = accurate && correct == known;
+
+        std::sort(latencies.begin(), latencies.end());
+        double p50 = latencies.empty() ? 0 : latencies[latencies.size() / 2];
+        double p99 = latencies.empty() ? 0 : latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+        printf("%-8s %7d %8.3f %10.0f %8.3f %8.3f %7.3f %8.2f%%\n",
+            engine.second, bench_port_count, elapsed, bench_port_count / elapsed, p50, p99, cpu,
+            known > 0 ? 100.0 * correct / known : 0.0);
+        fflush(stdout);
     }
 
-    char ip_str[INET_ADDRSTRLEN];
-    InetNtopA(AF_INET, &((sockaddr_in*)result->ai_addr)->sin_addr, ip_str, INET_ADDRSTRLEN);
-    params.target = ip_str;
-    freeaddrinfo(result);
+    info_out = saved_info_out;
+    unlink(path);
+    close(control[0]);
+    waitpid(farm, nullptr, 0);
+    return accurate;
+}
+#endif
+
+bool prompt_parameters(ScanParams& params) {
+    std::cout << "Enter targets (IP, hostname, CIDR, range or @hostfile, comma-separated): ";
+    std::cin >> params.target;
+
+    if (!params.targets.add_list(params.target)) {
+        std::cerr << "Failed to resolve targets." << std::endl;
+        return false;
+    }
 
     std::cout << "Enter start port: ";
     std::cin >> params.start_port;
@@ -219,26 +3261,247 @@ int main() {
     std::cout << "Enter end port: ";
     std::cin >> params.end_port;
 
+#ifdef __linux__
+    std::cout << "Select scan type (1 - TCP Connect, 2 - UDP Scan, 3 - TCP SYN): ";
+#else
     std::cout << "Select scan type (1 - TCP Connect, 2 - UDP Scan): ";
+#endif
     std::cin >> params.scan_type;
 
-    std::cout << "Enter timeout in milliseconds: ";
+    std::cout << "Enter max timeout in milliseconds (adapted down from measured RTT): ";
     std::cin >> params.timeout_ms;
 
+    std::cout << "Enter retries for unanswered probes: ";
+    std::cin >> params.max_retries;
+
     std::cout << "Enter max threads: ";
     std::cin >> params.max_threads;
 
-    if (params.start_port > params.end_port ||
+    if (params.scan_type == 1) {
+        std::cout << "Detect services on open ports (0 - no, 1 - yes): ";
+        std::cin >> params.detect_services;
+    }
+
+#ifdef __linux__
+    if (params.scan_type == 1) {
+        std::cout << "Enter max in-flight connects: ";
+        std::cin >> params.max_inflight;
+    }
+    if (params.scan_type == 2 || params.scan_type == 3) {
+        std::cout << "Enter max packets per second: ";
+        std::cin >> params.max_rate;
+    }
+#endif
+    return true;
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " -t <targets> [options]\n"
+        << "  -t <targets>   IPs, hostnames, CIDR blocks, ranges or @hostfile, comma-separated\n"
+        << "  -p <ports>     port or range (default 1-1024)\n"
+        << "  -s <type>      connect, udp or syn (default connect)\n"
+        << "  -T <ms>        max probe timeout (default 1000)\n"
+        << "  -r <count>     retries for unanswered probes (default 1)\n"
+        << "  -j <threads>   worker threads (default 4)\n"
+        << "  -w <count>     max in-flight connects (default 1024)\n"
+        << "  -R <pps>       max packets per second for udp/syn (default 10000)\n"
+        << "  -f <format>    text, jsonl, csv or bin (default text)\n"
+        << "  -o <file>      output file, - for stdout (default -)\n"
+        << "  -a             report closed and filtered ports too\n"
+        << "  -n             skip host discovery and scan every target\n"
+        << "  -V             detect services on open ports (connect scan)\n"
+        << "  --bench        scan a local listener farm with every engine and report\n"
+        << "                 throughput, latency, CPU time and accuracy (Linux);\n"
+        << "                 -R defaults to 1000000 here" << std::endl;
+}
+
+bool parse_arguments(int argc, char* argv[], ScanParams& params) {
+    int start_port = 1;
+    int end_port = 1024;
+    params.scan_type = 1;
+    params.timeout_ms = 1000;
+    params.max_retries = 1;
+    params.max_threads = 4;
+    params.max_inflight = 1024;
+    params.max_rate = 10000;
+    bool rate_given = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "-a") {
+            params.report_all = true;
+            continue;
+        }
+        if (option == "-n") {
+            params.skip_discovery = true;
+            continue;
+        }
+        if (option == "-V") {
+            params.detect_services = true;
+            continue;
+        }
+        if (option == "--bench") {
+            params.bench = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (option == "-t") {
+            params.target = value;
+            if (!params.targets.add_list(value)) {
+                std::cerr << "Failed to resolve targets." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "-p") {
+            size_t dash = value.find('-');
+            start_port = atoi(value.c_str());
+            end_port = dash == std::string::npos ? start_port : atoi(value.c_str() + dash + 1);
+        }
+        else if (option == "-s") {
+            params.scan_type = value == "udp" ? 2 : value == "syn" ? 3 : value == "connect" ? 1 : atoi(value.c_str());
+        }
+        else if (option == "-T") {
+            params.timeout_ms = atoi(value.c_str());
+        }
+        else if (option == "-r") {
+            params.max_retries = atoi(value.c_str());
+        }
+        else if (option == "-j") {
+            params.max_threads = atoi(value.c_str());
+        }
+        else if (option == "-w") {
+            params.max_inflight = atoi(value.c_str());
+        }
+        else if (option == "-R") {
+            params.max_rate = atoi(value.c_str());
+            rate_given = true;
+        }
+        else if (option == "-f") {
+            if (value == "text") {
+                params.output_format = OUTPUT_TEXT;
+            }
+            else if (value == "jsonl") {
+                params.output_format = OUTPUT_JSONL;
+            }
+            else if (value == "csv") {
+                params.output_format = OUTPUT_CSV;
+            }
+            else if (value == "bin") {
+                params.output_format = OUTPUT_BINARY;
+            }
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+        }
+        else if (option == "-o") {
+            params.output_path = value;
+        }
+        else {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+
+    if ((params.targets.size() == 0 && !params.bench) || start_port < 1 || end_port > 65535) {
+        print_usage(argv[0]);
+        return false;
+    }
+    // The benchmark farm is on loopback, where the default rate, meant to
+    // spare real networks, would only measure the pacing.
+    if (params.bench && !rate_given) {
+        params.max_rate = 1000000;
+    }
+    params.start_port = (unsigned short)start_port;
+    params.end_port = (unsigned short)end_port;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        std::cerr << "WSAStartup failed." << std::endl;
+        return 1;
+    }
+#endif
+
+    ScanParams params;
+    params.max_inflight = 0;
+    params.max_rate = 0;
+    params.output_format = OUTPUT_TEXT;
+    params.report_all = false;
+    params.skip_discovery = false;
+    params.detect_services = false;
+    params.bench = false;
+
+#ifdef __linux__
+    const int max_scan_type = 3;
+    bool paced = true;
+#else
+    const int max_scan_type = 2;
+    bool paced = false;
+#endif
+
+    bool parsed = argc > 1 ? parse_arguments(argc, argv, params) : prompt_parameters(params);
+    paced = paced && (params.scan_type == 2 || params.scan_type == 3);
+
+    if (!parsed || params.start_port > params.end_port ||
         params.start_port < 1 || params.end_port > 65535 ||
-        params.scan_type < 1 || params.scan_type > 2 ||
-        params.timeout_ms <= 0 || params.max_threads <= 0) {
+        params.scan_type < 1 || params.scan_type > max_scan_type ||
+        params.timeout_ms <= 0 || params.max_threads <= 0 ||
+        params.max_retries < 0 || params.max_retries > 10 ||
+        (params.scan_type == 1 && params.max_inflight < 0) ||
+        (paced && params.max_rate <= 0)) {
         std::cerr << "Invalid input parameters." << std::endl;
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 1;
+    }
+
+#ifdef __linux__
+    if (params.scan_type == 1 && params.max_inflight == 0) {
+        params.max_inflight = 1024;
+    }
+#endif
+    params.min_timeout_ms = std::min(params.timeout_ms, 25);
+
+    if (params.bench) {
+#ifdef __linux__
+        return run_benchmark(params) ? 0 : 1;
+#else
+        std::cerr << "--bench is only available on Linux." << std::endl;
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 1;
+#endif
+    }
+
+    // Keep stdout clean for machine-readable results.
+    bool results_on_stdout = params.output_path.empty() || params.output_path == "-";
+    if (results_on_stdout && params.output_format != OUTPUT_TEXT) {
+        info_out = &std::cerr;
+    }
+    if (!result_writer.open(params.output_format, params.output_path, params.targets.size() > 1)) {
+        std::cerr << "Failed to open output file " << params.output_path << "." << std::endl;
+#ifdef _WIN32
         WSACleanup();
+#endif
         return 1;
     }
 
     start_scan(params);
+    result_writer.close();
 
+#ifdef _WIN32
     WSACleanup();
+#endif
     return 0;
 }